@@ -0,0 +1,370 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <sstream>
+
+// すべてのハードウェアコンポーネントの定義をインクルード
+#include "memory_map.hpp"
+#include "logger.hpp"
+#include "event_scheduler.hpp"
+#include "load_generator.hpp"
+#include "dram.hpp"
+#include "spm.hpp"
+#include "bus.hpp"
+#include "riscv_core.hpp"
+#include "spm_module.hpp"
+#include "hash_module.hpp"
+#include "aes_module.hpp"
+#include "axi_manager_module.hpp"
+
+// =================================================================
+// シミュレータ自体の処理速度を測るマイクロベンチマーク
+// (シミュレーション時刻ではなく、ホスト上の実行時間を測る)
+// =================================================================
+
+// 最適化で計算が消えないよう、結果をここに畳み込む
+volatile uint64_t g_sink = 0;
+
+// main.cppと同じ構成のシステム (ベンチマークごとに作り直して状態を持ち越さない)
+struct System {
+    EventScheduler scheduler;
+    Dram dram;
+    Spm spm;
+    SpmModule spm_mod{dram, spm, scheduler};
+    HashModule hash_mod{spm, scheduler};
+    AxiManagerModule axi_mgr{spm, scheduler};
+    AesModule aes_mod{axi_mgr, scheduler};
+    Bus bus{dram, spm, scheduler};
+    RiscVCore core{bus, scheduler};
+
+    System() {
+        bus.connectSpmModule(spm_mod);
+        bus.connectHashModule(hash_mod);
+        bus.connectAesModule(aes_mod);
+        bus.connectAxiManagerModule(axi_mgr);
+        core.boot();
+    }
+};
+
+struct BenchConfig {
+    uint64_t ops = 200000;     // マイクロベンチマークの反復回数
+    uint64_t requests = 20000; // リクエスト単位のベンチマークのリクエスト数
+    std::string filter;        // 名前にこの文字列を含むものだけ実行する
+
+    bool parse(const std::string& arg) {
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = arg.substr(0, eq);
+        std::string value = arg.substr(eq + 1);
+        try {
+            if (key == "ops") ops = std::stoull(value);
+            else if (key == "requests") requests = std::stoull(value);
+            else if (key == "filter") filter = value;
+            else return false;
+        } catch (const std::exception&) {
+            return false;
+        }
+        return ops > 0 && requests > 0;
+    }
+};
+
+BenchConfig g_config;
+
+bool selected(const std::string& name) {
+    return g_config.filter.empty() || name.find(g_config.filter) != std::string::npos;
+}
+
+void printHeader(const std::string& title) {
+    std::cout << "\n--- " << title << " ---\n";
+}
+
+void printResult(const std::string& name, uint64_t ops, double seconds, const std::string& note = "") {
+    double ns_per_op = seconds * 1e9 / ops;
+    std::cout << "  " << std::left << std::setw(44) << name << std::right
+              << std::setw(10) << ops << " ops"
+              << std::fixed << std::setprecision(1) << std::setw(11) << ns_per_op << " ns/op"
+              << std::setprecision(0) << std::setw(13) << ops / seconds << " ops/s";
+    std::cout.unsetf(std::ios_base::floatfield);
+    if (!note.empty()) std::cout << "  " << note;
+    std::cout << "\n";
+}
+
+/**
+ * @brief body(i)をops回呼んだ時間を測る (先に1/10だけ空回しして、キャッシュや確保済みページを温める)
+ */
+template <class Body>
+void runBench(const std::string& name, uint64_t ops, Body body) {
+    if (!selected(name)) return;
+    for (uint64_t i = 0; i < ops / 10; ++i) body(i);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < ops; ++i) body(i);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printResult(name, ops, elapsed.count());
+}
+
+// アクセスパターン: 連続(64Bずつ) / 保護領域全体からランダム
+enum class Pattern { SEQUENTIAL, RANDOM };
+const char* patternName(Pattern pattern) { return pattern == Pattern::SEQUENTIAL ? "seq" : "random"; }
+
+// 反復iで使うDRAMアドレス (sizeバイト単位で整列)
+std::vector<uint64_t> makeAddresses(Pattern pattern, uint64_t count, uint64_t size) {
+    std::vector<uint64_t> addrs(count);
+    std::mt19937_64 rng(1);
+    uint64_t slots = MemoryMap::PROTECTION_SIZE / size;
+    std::uniform_int_distribution<uint64_t> dist(0, slots - 1);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t slot = pattern == Pattern::SEQUENTIAL ? i % slots : dist(rng);
+        addrs[i] = MemoryMap::PROTECTION_BASE_ADDR + slot * size;
+    }
+    return addrs;
+}
+
+// ---------------------------------------------------------------
+// AES: OTP生成 (encryptBlock 4回 = 64B分)
+// ---------------------------------------------------------------
+void benchAes() {
+    printHeader("AesModule (OTP generation, 4 x encryptBlock)");
+    System sys;
+    std::array<uint8_t, 64> input{};
+    runBench("aes.otp 64B", g_config.ops, [&](uint64_t i) {
+        std::memcpy(input.data(), &i, sizeof(i)); // カウンター値を毎回変える
+        sys.aes_mod.mmioWriteBurst(MemoryMap::AesReg::INPUT_0, input.data());
+        sys.aes_mod.mmioWrite64(MemoryMap::AesReg::START, 1);
+        // FIFOに積まれたOTPを復号コマンドで消費する
+        sys.axi_mgr.mmioWrite64(MemoryMap::AxiManagerReg::COMMAND, 8);
+        sys.scheduler.runAll();
+    });
+}
+
+// ---------------------------------------------------------------
+// MAC: FNV-1aによる64Bの更新 (SPMからのコピーを含む)
+// ---------------------------------------------------------------
+void benchHash() {
+    printHeader("HashModule (FNV-1a)");
+    System sys;
+    for (uint64_t addr = 0; addr < MemoryMap::SPM_SIZE; addr += 8) sys.spm.write64(MemoryMap::SPM_BASE_ADDR + addr, addr * 0x9E3779B97F4A7C15ULL);
+    runBench("mac.copy+update 64B", g_config.ops, [&](uint64_t i) {
+        sys.hash_mod.mmioWrite64(MemoryMap::MacReg::SPM_ADDR, MemoryMap::SPM_BASE_ADDR + (i % Parameter::SPM_LINES) * 64);
+        sys.hash_mod.mmioWrite64(MemoryMap::MacReg::SPM_START, 1);
+        sys.scheduler.runAll();
+        sys.hash_mod.mmioWrite64(MemoryMap::MacReg::START_BIT, 0);
+        sys.hash_mod.mmioWrite64(MemoryMap::MacReg::END_BIT, 511);
+        sys.hash_mod.mmioWrite64(MemoryMap::MacReg::COMMAND, 3); // INIT | UPDATE
+        sys.scheduler.runAll();
+        g_sink = g_sink + sys.hash_mod.mmioRead64(MemoryMap::MacReg::MAC_RESULT);
+    });
+    runBench("mac.update 56B (tag range)", g_config.ops, [&](uint64_t) {
+        sys.hash_mod.mmioWrite64(MemoryMap::MacReg::START_BIT, 0);
+        sys.hash_mod.mmioWrite64(MemoryMap::MacReg::END_BIT, 447);
+        sys.hash_mod.mmioWrite64(MemoryMap::MacReg::COMMAND, 3);
+        sys.scheduler.runAll();
+        g_sink = g_sink + sys.hash_mod.mmioRead64(MemoryMap::MacReg::MAC_RESULT);
+    });
+}
+
+// ---------------------------------------------------------------
+// SPM-DMA: DRAMとSPMの間の転送
+// ---------------------------------------------------------------
+void benchDma() {
+    printHeader("SpmModule (DMA transfer)");
+    struct Case { uint64_t size; uint64_t direction; Pattern pattern; };
+    const Case cases[] = {
+        {64, 0, Pattern::SEQUENTIAL}, {64, 0, Pattern::RANDOM},
+        {64, 1, Pattern::SEQUENTIAL}, {64, 1, Pattern::RANDOM},
+        {MemoryMap::SPM_SIZE, 0, Pattern::SEQUENTIAL}, {MemoryMap::SPM_SIZE, 1, Pattern::RANDOM},
+    };
+    for (const Case& c : cases) {
+        std::string name = "dma." + std::string(c.direction == 0 ? "dram->spm " : "spm->dram ") +
+                           std::to_string(c.size) + "B " + patternName(c.pattern);
+        if (!selected(name)) continue;
+        System sys;
+        std::vector<uint64_t> addrs = makeAddresses(c.pattern, 1 << 16, c.size);
+        runBench(name, g_config.ops, [&](uint64_t i) {
+            sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::DRAM_ADDR, addrs[i % addrs.size()]);
+            sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::SPM_ADDR, MemoryMap::SPM_BASE_ADDR + (c.size < MemoryMap::SPM_SIZE ? (i % Parameter::SPM_LINES) * 64 : 0));
+            sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::SIZE, c.size);
+            sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::DIRECTION, c.direction);
+            sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::START, 1);
+            sys.scheduler.runAll();
+        });
+    }
+    // ディスクリプタリングを満杯まで投入してから完了を待つ
+    const std::string ring_name = "dma.ring " + std::to_string(Parameter::SPM_DMA_RING_SIZE) + "x64B dram->spm random";
+    if (selected(ring_name)) {
+        System sys;
+        std::vector<uint64_t> addrs = makeAddresses(Pattern::RANDOM, 1 << 16, 64);
+        runBench(ring_name, g_config.ops, [&](uint64_t i) {
+            for (uint64_t d = 0; d < Parameter::SPM_DMA_RING_SIZE; ++d) {
+                sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::DRAM_ADDR, addrs[(i * Parameter::SPM_DMA_RING_SIZE + d) % addrs.size()]);
+                sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::SPM_ADDR, MemoryMap::SPM_BASE_ADDR + d * 64);
+                sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::SIZE, 64);
+                sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::DIRECTION, 0);
+                sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::RING_PUSH, 0);
+            }
+            sys.scheduler.runAll();
+        });
+    }
+    // 同じ数のラインをスキャッター・ギャザーの1コマンドで転送する
+    const std::string gather_name = "dma.gather " + std::to_string(Parameter::SPM_DMA_RING_SIZE) + "x64B dram->spm random";
+    if (selected(gather_name)) {
+        System sys;
+        std::vector<uint64_t> addrs = makeAddresses(Pattern::RANDOM, 1 << 16, 64);
+        runBench(gather_name, g_config.ops, [&](uint64_t i) {
+            for (uint64_t d = 0; d < Parameter::SPM_DMA_RING_SIZE; ++d) {
+                sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::SG_LIST + d * 16, addrs[(i * Parameter::SPM_DMA_RING_SIZE + d) % addrs.size()]);
+                sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::SG_LIST + d * 16 + 8, MemoryMap::SPM_BASE_ADDR + d * 64);
+            }
+            sys.spm_mod.mmioWrite64(MemoryMap::SPM_Reg::SG_START, Parameter::SPM_DMA_RING_SIZE);
+            sys.scheduler.runAll();
+        });
+    }
+}
+
+// ---------------------------------------------------------------
+// Bus: アドレスの振り分け (時刻の進行を含む)
+// ---------------------------------------------------------------
+void benchBus() {
+    printHeader("Bus (dispatch)");
+    System sys;
+    std::vector<uint64_t> seq = makeAddresses(Pattern::SEQUENTIAL, 1 << 16, 64);
+    std::vector<uint64_t> rnd = makeAddresses(Pattern::RANDOM, 1 << 16, 64);
+    std::array<uint8_t, 64> line{};
+    runBench("bus.read64 spm", g_config.ops, [&](uint64_t i) {
+        g_sink = g_sink + sys.bus.read64(MemoryMap::SPM_BASE_ADDR + (i * 8) % MemoryMap::SPM_SIZE);
+    });
+    runBench("bus.read64 mmio", g_config.ops, [&](uint64_t) {
+        g_sink = g_sink + sys.bus.read64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::STATUS);
+    });
+    runBench("bus.write64 mmio", g_config.ops, [&](uint64_t i) {
+        sys.bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::START_BIT, i & 63);
+    });
+    runBench("bus.read64 dram seq", g_config.ops, [&](uint64_t i) {
+        g_sink = g_sink + sys.bus.read64(seq[i % seq.size()]);
+    });
+    runBench("bus.read64 dram random", g_config.ops, [&](uint64_t i) {
+        g_sink = g_sink + sys.bus.read64(rnd[i % rnd.size()]);
+    });
+    runBench("bus.readBurst spm", g_config.ops, [&](uint64_t i) {
+        sys.bus.readBurst(MemoryMap::SPM_BASE_ADDR + (i % Parameter::SPM_LINES) * 64, line.data());
+        g_sink = g_sink + line[0];
+    });
+    runBench("bus.writeBurst aes", g_config.ops, [&](uint64_t) {
+        sys.bus.writeBurst(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_0, line.data());
+    });
+    runBench("bus.writeBurst dram random", g_config.ops, [&](uint64_t i) {
+        sys.bus.writeBurst(rnd[i % rnd.size()], line.data());
+    });
+}
+
+// ---------------------------------------------------------------
+// リクエスト単位: runAuthentication (Write) / runVerification (Read) の1往復
+// ---------------------------------------------------------------
+struct RequestCase {
+    std::string name;
+    LoadConfig load;
+};
+
+// 同じアドレス系列でWriteを全て発行した後、Readを全て発行する (1リクエストずつ完了を待つ)
+void runRequestCase(const RequestCase& rc) {
+    System sys;
+    for (int pass = 0; pass < 2; ++pass) {
+        bool is_write = pass == 0;
+        std::string name = rc.name + (is_write ? " write (auth)" : " read (verify)");
+        LoadGenerator generator(rc.load);
+        AxiManagerModule::DataBlock data{};
+        uint64_t responses = 0;
+        RiscVCore::SpmCacheStats before = sys.core.spmCacheStats();
+        uint64_t start_cycle = sys.scheduler.now();
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < rc.load.requests; ++i) {
+            uint64_t addr = generator.next().addr;
+            if (is_write) {
+                std::memcpy(data.data(), &i, sizeof(i));
+                sys.axi_mgr.receiveLlcWriteRequest(addr, i + 1, data);
+            } else {
+                sys.axi_mgr.receiveLlcReadRequest(addr, i + 1);
+            }
+            sys.core.runMainLoop();
+            sys.scheduler.runAll();
+            AxiManagerModule::Completion completion;
+            while (sys.axi_mgr.peekCompletion(completion)) {
+                if (completion.data) g_sink = g_sink + (*completion.data)[0];
+                responses++;
+                sys.axi_mgr.popCompletion();
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (responses != rc.load.requests) {
+            std::cerr << name << ": only " << responses << " of " << rc.load.requests << " requests completed\n";
+            exit(1);
+        }
+        const RiscVCore::SpmCacheStats& after = sys.core.spmCacheStats();
+        uint64_t hits = after.hits - before.hits;
+        uint64_t lookups = hits + after.misses - before.misses;
+        std::ostringstream note;
+        note << std::fixed << std::setprecision(1) << "spm hit " << (lookups ? 100.0 * hits / lookups : 0.0) << "%, "
+             << (sys.scheduler.now() - start_cycle) / rc.load.requests << " sim cycles/req";
+        printResult(name, rc.load.requests, elapsed.count(), note.str());
+    }
+}
+
+void benchRequests() {
+    printHeader("End-to-end requests (runAuthentication / runVerification)");
+    std::vector<RequestCase> cases;
+    // アクセスパターン (footprintは既定の4MB)
+    const std::pair<const char*, LoadConfig::Distribution> patterns[] = {
+        {"sequential", LoadConfig::Distribution::SEQUENTIAL},
+        {"strided", LoadConfig::Distribution::STRIDED},
+        {"zipfian", LoadConfig::Distribution::ZIPFIAN},
+        {"uniform", LoadConfig::Distribution::UNIFORM},
+    };
+    for (const auto& p : patterns) {
+        RequestCase rc{std::string("req.") + p.first, LoadConfig{}};
+        rc.load.distribution = p.second;
+        cases.push_back(rc);
+    }
+    // SPMのヒット率: 保護領域全体のうち64ラインのホットセットにhot_probabilityの割合でアクセスする
+    // (ホットセットのメタデータはSPMに収まり、それ以外はほぼ全てミスする)
+    for (double hot : {0.0, 0.5, 0.9, 0.99}) {
+        std::ostringstream name;
+        name << "req.hotset p=" << hot;
+        RequestCase rc{name.str(), LoadConfig{}};
+        rc.load.distribution = LoadConfig::Distribution::HOTSET;
+        rc.load.footprint = MemoryMap::PROTECTION_SIZE;
+        rc.load.hot_fraction = 64.0 / (MemoryMap::PROTECTION_SIZE / 64);
+        rc.load.hot_probability = hot;
+        cases.push_back(rc);
+    }
+    for (RequestCase& rc : cases) {
+        if (!selected(rc.name)) continue;
+        rc.load.requests = g_config.requests;
+        runRequestCase(rc);
+    }
+}
+
+void printUsage() {
+    std::cerr << "usage: simulator_bench [ops=N] [requests=N] [filter=SUBSTRING]\n"
+              << "  ops: iterations per microbenchmark, requests: requests per end-to-end case\n"
+              << "  filter: run only benchmarks whose name contains SUBSTRING (e.g. filter=dma, filter=req.hotset)\n";
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (!g_config.parse(argv[i])) {
+            std::cerr << "Invalid argument: " << argv[i] << "\n";
+            printUsage();
+            return 1;
+        }
+    }
+    std::cout << "Simulator microbenchmarks (host time; ops=" << g_config.ops << ", requests=" << g_config.requests << ")\n";
+    benchAes();
+    benchHash();
+    benchDma();
+    benchBus();
+    benchRequests();
+    return 0;
+}
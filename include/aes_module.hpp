@@ -1,6 +1,10 @@
 #pragma once
 #include "axi_manager_module.hpp"
 #include "memory_map.hpp"
+#include "logger.hpp"
+#include "event_scheduler.hpp"
+#include "perf_counters.hpp"
+#include "timeline_trace.hpp"
 #include <iostream>
 #include <vector>
 #include <array>
@@ -8,8 +12,8 @@
 
 class AesModule {
 public:
-    AesModule(AxiManagerModule& axi_manager) 
-        : m_axi_manager(axi_manager) {
+    AesModule(AxiManagerModule& axi_manager, EventScheduler& scheduler) 
+        : m_axi_manager(axi_manager), m_scheduler(scheduler) {
         m_input_data.fill(0);
     }
 
@@ -30,6 +34,21 @@ public:
         }
     }
 
+    /**
+     * @brief 64Bのバースト書き込みを処理 (INPUT_0〜INPUT_7の一括設定)
+     */
+    void mmioWriteBurst(uint64_t offset, const uint8_t* data) {
+        if (offset == MemoryMap::AesReg::INPUT_0) {
+            std::memcpy(m_input_data.data(), data, m_input_data.size());
+        } else {
+            for (uint64_t i = 0; i < 64; i += 8) {
+                uint64_t value;
+                std::memcpy(&value, data + i, sizeof(value));
+                mmioWrite64(offset + i, value);
+            }
+        }
+    }
+
     /**
      * @brief 64bitのMMIO読み出しを処理
      */
@@ -40,6 +59,15 @@ public:
         return 0;
     }
 
+    /**
+     * @brief 性能カウンターを接続する (接続しない場合は数えない)
+     */
+    void attachPerfCounters(PerfCounters& perf) { m_perf = &perf; }
+    /**
+     * @brief タイムラインを接続する (OTP生成の区間を記録する)
+     */
+    void attachTimeline(TimelineTrace& timeline) { m_timeline = &timeline; }
+
 private:
     // AESの状態 (128bit) は 4x4 のバイト行列として扱う
     using State = std::array<std::array<uint8_t, 4>, 4>;
@@ -151,15 +179,23 @@ private:
             // 固定のハードウェアキーを使って、カウンター値を暗号化する
             AxiManagerModule::Otp otp_block = encryptBlock(m_hardware_key, counter_block);
             
-            // std::cout << "  [AES HW] Encrypted counter " << i << ". Pushing result to FIFO...\n";
+            SIM_LOG(AES, TRACE, "  [AES HW] Encrypted counter " << i << ". Pushing result to FIFO...");
             m_axi_manager.pushOtpToFifo(otp_block);
         }
 
-        m_start_reg = 0;
-        // std::cout << "  [AES HW] OTP generation finished. START register cleared to 0.\n";
+        if (m_perf) m_perf->add(MemoryMap::PerfCounter::AES_BLOCKS, 4);
+        if (m_timeline) m_timeline->complete(TimelineTrace::Track::AES, "OTP", m_scheduler.now(), m_scheduler.now() + Parameter::aesCycles(4));
+        // OTPはFIFOに積み終えているが、STARTは処理時間後にクリアする
+        m_scheduler.schedule(Parameter::aesCycles(4), [this] {
+            m_start_reg = 0;
+            SIM_LOG(AES, TRACE, "  [AES HW] OTP generation finished. START register cleared to 0.");
+        });
     }
 
     AxiManagerModule& m_axi_manager;
+    EventScheduler& m_scheduler;
+    PerfCounters* m_perf = nullptr;
+    TimelineTrace* m_timeline = nullptr;
     std::array<uint8_t, 64> m_input_data; // 512bit (64-byte)の入力データバッファ
     uint64_t m_start_reg = 0; // STARTレジスタの状態
 };
\ No newline at end of file
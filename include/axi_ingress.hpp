@@ -0,0 +1,148 @@
+#pragma once
+#include "axi_manager_module.hpp"
+#include "memory_map.hpp"
+#include "mpsc_ring.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief 複数のホストスレッドからAXI Managerにリクエストを送る受付口
+ * @details 並列に動くキャッシュ・CPUモデルの各スレッド(ポート)がsubmitRead/submitWriteでリクエストを送り、
+ *          シミュレーションのスレッドがpumpでAXI Managerに入れる。受付キューは容量固定のロックフリーなMPSCキュー。
+ *          応答はポートごとの完了リング(シミュレーションのスレッドが唯一の生産者)に配り、各ポートのスレッドがpollCompletionで取り出す。
+ *          1つのポートは1つのスレッドから使う。ポートごとに応答を待てるリクエスト数(port_outstanding)の上限があり、
+ *          上限に達しているか受付キューが満杯の場合、submitはfalseを返す(応答を取り出してから再び送る)。
+ *          ポートの完了リングはport_outstandingの容量を持つため、応答を配れずに止まることはない。
+ *          AXI Managerへの入力はシミュレーションのスレッドのみが行うため、AxiManagerModule自体はスレッドセーフである必要がない。
+ */
+class AxiIngress {
+public:
+    using DataBlock = AxiManagerModule::DataBlock;
+
+    // ポートに返す応答 (データはリクエストスロットから写す)
+    struct Completion {
+        uint64_t id = 0;     // submit時に渡されたid
+        bool is_write = false;
+        bool success = false;
+        uint64_t cycle = 0;  // 応答したシミュレーション時刻
+        DataBlock data{};    // Readの応答データ
+    };
+
+    // ポートごとの送信の拒否回数 (満杯による背圧)
+    struct Backpressure {
+        uint64_t ingress_full = 0; // 受付キューが満杯
+        uint64_t port_full = 0;    // ポートの応答待ちが上限
+    };
+
+    AxiIngress(AxiManagerModule& axi_mgr, uint64_t ports, uint64_t depth = Parameter::AXIM_INGRESS_DEPTH,
+               uint64_t port_outstanding = Parameter::AXIM_PORT_OUTSTANDING)
+        : m_axi_mgr(axi_mgr), m_ingress(depth), m_port_outstanding(port_outstanding), m_contexts(axi_mgr.freeSlots()) {
+        for (uint64_t i = 0; i < ports; ++i) m_ports.push_back(std::make_unique<Port>(port_outstanding));
+        m_free_contexts.reserve(m_contexts.size());
+        for (size_t i = m_contexts.size(); i-- > 0;) m_free_contexts.push_back(static_cast<uint32_t>(i));
+    }
+
+    // --- ポートのスレッドから呼ぶ ---
+    bool submitRead(uint64_t port, uint64_t addr, uint64_t id) { return submit(port, {false, addr, id, port, {}}); }
+    bool submitWrite(uint64_t port, uint64_t addr, uint64_t id, const DataBlock& data) {
+        return submit(port, {true, addr, id, port, data});
+    }
+
+    bool pollCompletion(uint64_t port, Completion& completion) {
+        Port& p = *m_ports[port];
+        if (!p.completions.tryPop(completion)) return false;
+        p.in_flight.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 送信したが応答を取り出していないリクエスト数
+    uint64_t inFlight(uint64_t port) const { return m_ports[port]->in_flight.load(std::memory_order_relaxed); }
+
+    // --- シミュレーションのスレッドから呼ぶ ---
+    /**
+     * @brief AXI Managerの応答をポートに配り、受付キューのリクエストをスロットの空きの分だけAXI Managerに入れる
+     * @return AXI Managerに入れたリクエスト数
+     */
+    uint64_t pump() {
+        deliverCompletions();
+        uint64_t admitted = 0;
+        Request request;
+        while (m_axi_mgr.freeSlots() > 0 && m_ingress.tryPop(request)) {
+            // スロットとコンテキストは同数なので、スロットが空いていればコンテキストも空いている
+            uint32_t context = m_free_contexts.back();
+            m_free_contexts.pop_back();
+            m_contexts[context] = {request.port, request.id};
+            if (request.is_write) {
+                m_axi_mgr.receiveLlcWriteRequest(request.addr, context, request.data);
+            } else {
+                m_axi_mgr.receiveLlcReadRequest(request.addr, context);
+            }
+            admitted++;
+        }
+        return admitted;
+    }
+
+    Backpressure backpressure(uint64_t port) const {
+        const Port& p = *m_ports[port];
+        return {p.ingress_full.load(std::memory_order_relaxed), p.port_full.load(std::memory_order_relaxed)};
+    }
+
+private:
+    struct Request {
+        bool is_write = false;
+        uint64_t addr = 0;
+        uint64_t id = 0;
+        uint64_t port = 0;
+        DataBlock data{};
+    };
+    // AXI Managerに渡したidから引く、送信元のポートとid
+    struct Context {
+        uint64_t port;
+        uint64_t id;
+    };
+    // ポートの状態 (別々のスレッドが更新するため、ポートごとにキャッシュラインを分ける)
+    struct alignas(64) Port {
+        explicit Port(uint64_t outstanding) : completions(outstanding) {}
+        MpscRing<Completion> completions;      // 生産者: シミュレーションのスレッド, 消費者: ポートのスレッド
+        std::atomic<uint64_t> in_flight{0};    // 送信して応答を取り出していない数
+        std::atomic<uint64_t> ingress_full{0};
+        std::atomic<uint64_t> port_full{0};
+    };
+
+    bool submit(uint64_t port, const Request& request) {
+        Port& p = *m_ports[port];
+        if (p.in_flight.load(std::memory_order_relaxed) >= m_port_outstanding) {
+            p.port_full.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        p.in_flight.fetch_add(1, std::memory_order_relaxed);
+        if (!m_ingress.tryPush(request)) {
+            p.in_flight.fetch_sub(1, std::memory_order_relaxed);
+            p.ingress_full.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void deliverCompletions() {
+        AxiManagerModule::Completion done;
+        while (m_axi_mgr.peekCompletion(done)) {
+            const Context& context = m_contexts[done.id];
+            Completion completion{context.id, done.is_write, done.success, done.cycle, {}};
+            if (done.data) completion.data = *done.data;
+            m_ports[context.port]->completions.tryPush(completion); // 容量はポートの応答待ちの上限と同じ
+            m_axi_mgr.popCompletion();
+            m_free_contexts.push_back(static_cast<uint32_t>(done.id));
+        }
+    }
+
+    AxiManagerModule& m_axi_mgr;
+    MpscRing<Request> m_ingress;
+    uint64_t m_port_outstanding;
+    std::vector<std::unique_ptr<Port>> m_ports;
+    // シミュレーションのスレッドのみが使う
+    std::vector<Context> m_contexts;
+    std::vector<uint32_t> m_free_contexts;
+};
@@ -1,64 +1,198 @@
 #pragma once
 #include "spm.hpp" // SPMへのアクセスに必要
 #include "memory_map.hpp"
+#include "logger.hpp"
+#include "event_scheduler.hpp"
+#include "perf_counters.hpp"
+#include "timeline_trace.hpp"
+#include "fixed_ring.hpp"
 #include <iostream>
 #include <vector>
 #include <array>
-#include <queue>
-#include <functional>
+#include <algorithm>
 #include <cstdint>
 #include <bitset>
 // Forward declaration for SpmModule if needed, but including is fine.
 
+/**
+ * @brief LLCとコアの間のリクエスト管理とデータバッファ
+ * @details 到着したリクエストはタグ付きのリクエストテーブル(Parameter::AXIM_REQUEST_SLOTSエントリ)に入り、
+ *          エントリごとにRead/Writeのデータバッファを持つ。ファームウェアはSTATUSで次のリクエストのタグを知り、
+ *          REQ_IDにタグを書き込んでエントリを受け付ける(以降のコマンドはそのエントリのバッファに作用する)。
+ *          応答コマンドは選択中のエントリを完了させるため、受け付けた順によらず応答を返せる。
+ *          テーブルが満杯の間に到着したリクエストは、エントリが空くまで到着順に待たせる。
+ *          到着時に、応答していないWriteと同じラインへのReadはそのWriteの平文を転送して応答し(暗号処理を行わない)、
+ *          まだ受け付けられていないWriteと同じラインへのWriteはそのWriteにまとめる(認証は1回で済む)。
+ *          次に受け付けるリクエストは、テーブル内の受け付け待ちのエントリからスケジューリング方針(SchedulePolicy)で選ぶ。
+ *          リクエストは受け付けてからLLCが応答を取り出すまで、構築時に確保したリクエストスロット(max_outstanding個)の1つを使う。
+ *          スロットが無い間は受け付けない(receiveLlc*がfalseを返す)。データはスロットに1度だけ書き込み、
+ *          テーブル・待ち行列・完了リングの間はスロットの番号で受け渡すため、リクエストの経路でメモリを確保しない。
+ *          応答は完了リングに入り、LLC側がpeekCompletion/popCompletionで取り出す。
+ */
 class AxiManagerModule {
 public:
     // 型定義
     using Otp = std::array<uint8_t, 16>;
     using DataBlock = std::array<uint8_t, 64>;
-    // コールバック関数の型定義: Readはデータ、WriteはACK(成功フラグ)を返す
-    using ReadResponseCallback = std::function<void(const DataBlock&)>;
-    using WriteResponseCallback = std::function<void(bool)>;
+
+    // LLCへの応答 (完了リングの先頭)
+    struct Completion {
+        uint64_t id;           // リクエストの受け付け時に渡されたid
+        bool is_write;
+        bool success;          // WriteのACK (常に成功)
+        uint64_t cycle;        // 応答した時刻
+        const DataBlock* data; // Readの応答データ (popCompletionを呼ぶまで有効)。Writeではnullptr
+    };
+
+    /**
+     * @brief 次に受け付けるリクエストの選び方
+     * @details FIFO: 到着順。
+     *          READ_FIRST: Readを先に選び、Writeは受け付け待ちのWriteがwrite_high個以上になったら
+     *          write_low個以下になるまで続けて選ぶ(Readが無い間もWriteを選ぶ)。
+     *          最も古いWriteがwrite_max_ageサイクル以上待っていれば、Readより先に選ぶ。
+     *          同じラインへのより古いReadがあるWriteは、そのReadの後に選ぶ。
+     */
+    enum class SchedulePolicy { FIFO, READ_FIRST };
 
 private:
-    // LLCからのリクエストを格納する内部構造体
+    // LLCからのリクエスト
     struct LlcRequest {
         bool is_write;
         uint64_t addr;
         uint64_t id;
-        DataBlock write_data; // Writeリクエストの場合のみ使用
-        ReadResponseCallback read_cb;
-        WriteResponseCallback write_cb;
+        uint64_t arrival_cycle;
+        uint64_t seq = 0; // テーブル・待ち行列に入れた順
+    };
+    // リクエストスロット: 受け付けから応答を取り出すまで1つのリクエストが使う (データはキャッシュラインに揃える)
+    struct alignas(64) RequestSlot {
+        DataBlock data{};            // Write: 書き込みデータ(平文), Read: 応答データ (R Buffer)
+        LlcRequest request{};
+        uint64_t response_cycle = 0;
+    };
+    // 応答していないWrite (ラインごと。アドレスで引くオープンアドレス法の表の1エントリ)
+    struct PendingWrite {
+        uint64_t addr = 0;
+        uint64_t seq = 0;         // 最後に到着したWriteのseq
+        uint64_t outstanding = 0; // 応答していないWriteの数 (0なら空き)
+        uint32_t slot = 0;        // 最後に到着したWriteのスロット (平文を持つ)
     };
+    // リクエストテーブルの1エントリ (タグ = テーブルの添字)
+    struct RequestEntry {
+        enum class State { FREE, PENDING, CLAIMED }; // PENDING: ファームウェアの受け付け待ち
+        State state = State::FREE;
+        uint32_t slot = 0;
+        alignas(64) DataBlock w_buffer{}; // Write Buffer (受け付け時にスロットの平文を写し、その場で暗号化する)
+        alignas(64) DataBlock r_buffer{}; // Writeの処理中・エントリ外のコマンドのRead Buffer (ReadではスロットがR Buffer)
+    };
+    static constexpr uint64_t SLOTS = Parameter::AXIM_REQUEST_SLOTS;
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
 
 public:
     /**
      * @brief コンストラクタ
      * @param spm SPMへのアクセスに使用するSpmModuleへの参照
+     * @param scheduler コマンド完了イベントを登録するスケジューラ
+     * @param max_outstanding リクエストスロットの数 (受け付けて応答を取り出していないリクエストの上限)
      */
-    AxiManagerModule(Spm& spm) : m_spm(spm) {}
+    AxiManagerModule(Spm& spm, EventScheduler& scheduler, uint64_t max_outstanding = Parameter::AXIM_MAX_OUTSTANDING)
+        : m_spm(spm), m_scheduler(scheduler), m_slots(max_outstanding), m_overflow(max_outstanding),
+          m_completions(max_outstanding), m_otp_fifo(Parameter::AXIM_OTP_FIFO_DEPTH) {
+        m_free_slots.reserve(max_outstanding);
+        for (uint64_t slot = max_outstanding; slot-- > 0;) m_free_slots.push_back(static_cast<uint32_t>(slot));
+        m_pending.reserve(SLOTS);
+        // 応答していないWriteはスロット数以下なので、表の使用率は1/2以下
+        uint64_t bits = 1;
+        while ((1ULL << bits) < 2 * max_outstanding) ++bits;
+        m_pending_writes.resize(1ULL << bits);
+        m_pending_write_shift = 64 - bits;
+    }
 
     // --- LLCからのインターフェース ---
-    void receiveLlcReadRequest(uint64_t addr, uint64_t id, ReadResponseCallback cb) {
-        m_request_queue.push({false, addr, id, {}, cb, nullptr});
+    // 空きスロットが無ければ受け付けずにfalseを返す (応答を取り出してから再び送る)
+    bool receiveLlcReadRequest(uint64_t addr, uint64_t id) {
+        if (m_free_slots.empty()) return false;
+        uint32_t slot = acquireSlot({false, addr, id, m_scheduler.now()});
+        if (PendingWrite* pending = findPendingWrite(addr)) {
+            forwardRead(slot, pending->slot);
+            return true;
+        }
+        m_slots[slot].request.seq = m_next_seq++;
+        admit(slot);
         // std::cout << "[AXIM] Read Request Queued (Addr: 0x" << std::hex << addr << ").\n" << std::dec;
+        return true;
     }
 
-    void receiveLlcWriteRequest(uint64_t addr, uint64_t id, const DataBlock& data, WriteResponseCallback cb) {
-        m_request_queue.push({true, addr, id, data, nullptr, cb});
+    bool receiveLlcWriteRequest(uint64_t addr, uint64_t id, const DataBlock& data) {
+        if (m_free_slots.empty()) return false;
+        uint32_t slot = acquireSlot({true, addr, id, m_scheduler.now()});
+        m_slots[slot].data = data;
+        PendingWrite* pending = findPendingWrite(addr);
+        if (pending && coalesceWrite(*pending, slot)) return true;
+        m_queued_writes++;
+        if (!pending) pending = &insertPendingWrite(addr);
+        pending->seq = m_next_seq;
+        pending->outstanding++;
+        pending->slot = slot;
+        m_slots[slot].request.seq = m_next_seq++;
+        admit(slot);
         // std::cout << "[AXIM] Write Request Queued (Addr: 0x" << std::hex << addr << ").\n" << std::dec;
-        // w_data_bufferにデータをセット
-        m_w_buffer = data;
+        return true;
+    }
+
+    /**
+     * @brief 完了リングの先頭の応答 (無ければfalse)。取り出すまで先頭に残る
+     */
+    bool peekCompletion(Completion& completion) const {
+        if (m_completions.empty()) return false;
+        const RequestSlot& slot = m_slots[m_completions.front()];
+        completion = {slot.request.id, slot.request.is_write, true, slot.response_cycle,
+                      slot.request.is_write ? nullptr : &slot.data};
+        return true;
+    }
+    /**
+     * @brief 完了リングの先頭の応答を取り出し、そのスロットを空ける
+     */
+    void popCompletion() {
+        m_free_slots.push_back(m_completions.front());
+        m_completions.pop();
+    }
+
+    // 空きスロットの数 (0の間は新しいリクエストを受け付けない)
+    uint64_t freeSlots() const { return m_free_slots.size(); }
+
+    /**
+     * @brief ファームウェアがまだ受け付けていないリクエストの数 (テーブルの空きを待っているものを含む)
+     */
+    uint64_t queuedRequests() const { return m_pending.size() + m_overflow.size(); }
+
+    void setSchedulePolicy(SchedulePolicy policy, uint64_t write_high = Parameter::AXIM_WRITE_HIGH_WATERMARK,
+                           uint64_t write_low = Parameter::AXIM_WRITE_LOW_WATERMARK,
+                           uint64_t write_max_age = Parameter::AXIM_WRITE_MAX_AGE) {
+        m_policy = policy;
+        m_write_high = write_high;
+        m_write_low = write_low;
+        m_write_max_age = write_max_age;
     }
 
+    // 到着時に応答したReadの数と、前のWriteにまとめたWriteの数 (どちらも暗号処理を1回省いた)
+    uint64_t forwardedReads() const { return m_forwarded_reads; }
+    uint64_t coalescedWrites() const { return m_coalesced_writes; }
+
     // --- AESからのインターフェース ---
     void pushOtpToFifo(const Otp& otp) {
-        m_otp_fifo.push(otp);
+        if (!m_otp_fifo.push(otp)) {
+            SIM_LOG(AXIM, ERROR, "  [AXIM HW] Warning: OTP FIFO overflow.");
+            exit(1);
+        }
+        if (m_perf) m_perf->recordMax(MemoryMap::PerfCounter::OTP_FIFO_HIGH_WATER, m_otp_fifo.size());
     }
     
     // --- コアからのMMIOインターフェース ---
     void mmioWrite64(uint64_t offset, uint64_t value) {
         if (offset == MemoryMap::AxiManagerReg::SPM_ADDR) {
             m_spm_addr_reg = value;
+        } else if (offset == MemoryMap::AxiManagerReg::REQ_ID) {
+            selectEntry(value);
         } else if (offset == MemoryMap::AxiManagerReg::COMMAND) {
             if (m_busy_reg == 0) {
                 executeCommand(value);
@@ -69,93 +203,313 @@ public:
     uint64_t mmioRead64(uint64_t offset) {
         switch (offset) {
             case MemoryMap::AxiManagerReg::STATUS: {
+                // 読み出しごとに選び直し、REQ_ADDR・REQ_IDは受け付けるまでこの選択を返す
+                m_chosen = chooseNext();
                 uint64_t status = 0;
-                if (!m_request_queue.empty()) {
-                    status |= 1; // bit 0: キューにリクエストあり
-                    if (m_request_queue.front().is_write) {
+                if (m_chosen != SLOTS) {
+                    status |= 1; // bit 0: 受け付け待ちのリクエストあり
+                    if (requestAt(m_chosen).is_write) {
                         status |= 2; // bit 1: Writeリクエスト
                     }
+                    status |= m_chosen << 8; // [15:8]: タグ
                 }
                 return status;
             }
             case MemoryMap::AxiManagerReg::REQ_ADDR:
-                return m_request_queue.empty() ? 0 : m_request_queue.front().addr;
+                return chosen() == SLOTS ? 0 : requestAt(m_chosen).addr;
             case MemoryMap::AxiManagerReg::REQ_ID:
-                return m_request_queue.empty() ? 0 : m_request_queue.front().id;
+                return chosen() == SLOTS ? 0 : m_chosen;
             case MemoryMap::AxiManagerReg::BUSY:
                 return m_busy_reg;
         }
         return 0;
     }
 
+    /**
+     * @brief 性能カウンターを接続する (接続しない場合は数えない)
+     */
+    void attachPerfCounters(PerfCounters& perf) { m_perf = &perf; }
+    /**
+     * @brief タイムラインを接続する (コマンドの区間と応答の返却を記録する)
+     */
+    void attachTimeline(TimelineTrace& timeline) { m_timeline = &timeline; }
+
 private:
+    uint32_t acquireSlot(const LlcRequest& request) {
+        uint32_t slot = m_free_slots.back();
+        m_free_slots.pop_back();
+        m_slots[slot].request = request;
+        return slot;
+    }
+
+    const LlcRequest& requestAt(uint64_t tag) const { return m_slots[m_table[tag].slot].request; }
+
+    // 到着したリクエストを空きエントリに入れる (満杯なら空くまで待たせる)
+    void admit(uint32_t slot) {
+        for (uint64_t tag = 0; tag < SLOTS; ++tag) {
+            RequestEntry& entry = m_table[tag];
+            if (entry.state != RequestEntry::State::FREE) continue;
+            entry.state = RequestEntry::State::PENDING;
+            entry.slot = slot;
+            m_pending.push_back(tag);
+            return;
+        }
+        m_overflow.push(slot); // スロット数と同じ容量なので溢れない
+    }
+
+    // 応答を完了リングに入れる (スロットはLLCが取り出すまで使用中のまま)
+    void complete(uint32_t slot) {
+        RequestSlot& done = m_slots[slot];
+        countResponse(done.request.is_write, done.request.arrival_cycle);
+        done.response_cycle = m_scheduler.now();
+        m_completions.push(slot); // スロット数と同じ容量なので溢れない
+    }
+
+    /**
+     * @brief 応答していないWriteと同じラインへのRead: そのWriteの平文で応答する
+     */
+    void forwardRead(uint32_t slot, uint32_t write_slot) {
+        SIM_LOG(AXIM, TRACE, "  [AXIM HW] Read forwarded from a pending write.");
+        m_forwarded_reads++;
+        if (m_perf) m_perf->add(MemoryMap::PerfCounter::READ_FORWARDED);
+        if (m_timeline) m_timeline->instant(TimelineTrace::Track::AXIM, "read forward", m_scheduler.now());
+        m_slots[slot].data = m_slots[write_slot].data;
+        m_scheduler.schedule(Parameter::AXIM_COMMAND_CYCLES, [this, slot] { complete(slot); });
+    }
+
+    /**
+     * @brief 同じラインへの最後のWriteがまだ受け付けられていなければ、新しいWriteのスロットで置き換えてまとめる
+     * @details まとめられた前のWriteにはすぐに応答する(そのデータが読まれることはない)。
+     *          同じラインへのReadは全て転送で応答するため、2つのWriteの間にそのラインを読むリクエストは無い。
+     * @return まとめた場合はtrue
+     */
+    bool coalesceWrite(PendingWrite& pending, uint32_t slot) {
+        uint32_t* position = nullptr; // 前のWriteのスロット番号を持つ待ち行列・テーブルの位置
+        if (!m_overflow.empty() && pending.seq >= m_slots[m_overflow.front()].request.seq) {
+            position = &m_overflow[pending.seq - m_slots[m_overflow.front()].request.seq];
+        } else {
+            auto entry = std::find_if(m_table.begin(), m_table.end(), [this, &pending](const RequestEntry& e) {
+                return e.state == RequestEntry::State::PENDING && m_slots[e.slot].request.seq == pending.seq;
+            });
+            if (entry == m_table.end()) return false; // 受け付け済み
+            position = &entry->slot;
+        }
+        SIM_LOG(AXIM, TRACE, "  [AXIM HW] Write coalesced into a pending write.");
+        m_coalesced_writes++;
+        if (m_perf) m_perf->add(MemoryMap::PerfCounter::WRITES_COALESCED);
+        if (m_timeline) m_timeline->instant(TimelineTrace::Track::AXIM, "write coalesce", m_scheduler.now());
+        uint32_t old_slot = *position;
+        m_scheduler.schedule(Parameter::AXIM_COMMAND_CYCLES, [this, old_slot] { complete(old_slot); });
+        m_slots[slot].request.seq = pending.seq;
+        *position = slot;
+        pending.slot = slot;
+        return true;
+    }
+
+    // 応答していないWriteの表 (線形探索。outstandingが0のエントリは空き)
+    uint64_t pendingWriteHome(uint64_t addr) const {
+        return ((addr >> 6) * 0x9E3779B97F4A7C15ULL) >> m_pending_write_shift;
+    }
+    PendingWrite* findPendingWrite(uint64_t addr) {
+        const uint64_t mask = m_pending_writes.size() - 1;
+        for (uint64_t i = pendingWriteHome(addr);; i = (i + 1) & mask) {
+            PendingWrite& pending = m_pending_writes[i];
+            if (pending.outstanding == 0) return nullptr;
+            if (pending.addr == addr) return &pending;
+        }
+    }
+    PendingWrite& insertPendingWrite(uint64_t addr) {
+        const uint64_t mask = m_pending_writes.size() - 1;
+        uint64_t i = pendingWriteHome(addr);
+        while (m_pending_writes[i].outstanding != 0) i = (i + 1) & mask;
+        m_pending_writes[i].addr = addr;
+        return m_pending_writes[i];
+    }
+    // outstandingが0になったエントリを消す (後ろのエントリを詰めて、探索の連続を保つ)
+    void erasePendingWrite(PendingWrite& erased) {
+        const uint64_t mask = m_pending_writes.size() - 1;
+        uint64_t hole = &erased - m_pending_writes.data();
+        for (uint64_t i = (hole + 1) & mask; m_pending_writes[i].outstanding != 0; i = (i + 1) & mask) {
+            // 本来の位置からiまでの間に穴があれば、穴に移す
+            if (((i - pendingWriteHome(m_pending_writes[i].addr)) & mask) >= ((i - hole) & mask)) {
+                m_pending_writes[hole] = m_pending_writes[i];
+                m_pending_writes[i].outstanding = 0;
+                hole = i;
+            }
+        }
+    }
+
+    void countResponse(bool is_write, uint64_t arrival_cycle) {
+        if (!m_perf) return;
+        m_perf->add(is_write ? MemoryMap::PerfCounter::WRITE_REQUESTS : MemoryMap::PerfCounter::READ_REQUESTS);
+        m_perf->add(is_write ? MemoryMap::PerfCounter::WRITE_LATENCY_SUM : MemoryMap::PerfCounter::READ_LATENCY_SUM,
+                    m_scheduler.now() - arrival_cycle);
+    }
+
+    // 次に受け付けるエントリのタグ (無ければSLOTS)
+    uint64_t chooseNext() {
+        if (m_pending.empty()) return SLOTS;
+        if (m_policy == SchedulePolicy::FIFO) return m_pending.front();
+        if (m_queued_writes >= m_write_high) {
+            m_draining = true;
+        } else if (m_queued_writes <= m_write_low) {
+            m_draining = false;
+        }
+        uint64_t first_read = SLOTS;
+        uint64_t first_write = SLOTS;
+        for (uint64_t tag : m_pending) { // m_pendingは到着順
+            uint64_t& first = requestAt(tag).is_write ? first_write : first_read;
+            if (first == SLOTS) first = tag;
+        }
+        // 待ちすぎたWriteはReadより先に選ぶ (Readが続く間もWriteが止まらないように)
+        bool write_expired = first_write != SLOTS && m_scheduler.now() - requestAt(first_write).arrival_cycle >= m_write_max_age;
+        if (first_read != SLOTS && (first_write == SLOTS || (!m_draining && !write_expired))) return first_read;
+        // Writeより前に到着した同じラインへのReadは追い越さない (Readは古いデータを返す必要がある)
+        for (uint64_t tag : m_pending) {
+            if (tag == first_write) break;
+            if (requestAt(tag).addr == requestAt(first_write).addr) return tag;
+        }
+        return first_write;
+    }
+    // 直前のSTATUSの読み出しで選んだエントリ (受け付け済みなら選び直す)
+    uint64_t chosen() {
+        if (m_chosen == SLOTS || m_table[m_chosen].state != RequestEntry::State::PENDING) m_chosen = chooseNext();
+        return m_chosen;
+    }
+
+    // REQ_IDへの書き込み: 受け付け待ちのエントリなら受け付け、以降のコマンドの対象にする
+    void selectEntry(uint64_t tag) {
+        if (tag >= SLOTS || m_table[tag].state == RequestEntry::State::FREE) {
+            SIM_LOG(AXIM, WARN, "  [AXIM HW] Ignored selection of free request entry " << tag << ".");
+            return;
+        }
+        RequestEntry& entry = m_table[tag];
+        if (entry.state == RequestEntry::State::PENDING) {
+            entry.state = RequestEntry::State::CLAIMED;
+            m_pending.erase(std::find(m_pending.begin(), m_pending.end(), tag));
+            if (m_slots[entry.slot].request.is_write) {
+                m_queued_writes--;
+                entry.w_buffer = m_slots[entry.slot].data; // スロットの平文は同じラインへのReadの転送に残す
+            }
+        }
+        m_selected = tag;
+    }
+
     void executeCommand(uint64_t command) {
         m_busy_reg = 1;
-        std::cout << "  [AXIM HW] Executing Command: 0b" << std::bitset<6>(command) << "\n";
+        SIM_LOG(AXIM, TRACE, "  [AXIM HW] Executing Command: 0b" << std::bitset<6>(command) << " (entry " << m_selected << ")");
+        RequestEntry& entry = m_table[m_selected];
+        bool claimed = entry.state == RequestEntry::State::CLAIMED;
+        const bool is_write = m_slots[entry.slot].request.is_write;
+        // ReadはスロットをR Bufferとして使い、応答のデータをそのまま完了リングに渡す
+        DataBlock& r_buffer = claimed && !is_write ? m_slots[entry.slot].data : entry.r_buffer;
+        DataBlock& w_buffer = entry.w_buffer;
 
         if (command & 1) { // Data Write Back (W Buffer -> SPM)
-            m_spm.write(m_spm_addr_reg, m_w_buffer.data(), m_w_buffer.size());
+            m_spm.write(m_spm_addr_reg, w_buffer.data(), w_buffer.size());
         }
         if (command & 2) { // Data Copy (SPM -> R Buffer)
-            m_spm.read(m_spm_addr_reg, m_r_buffer.data(), m_r_buffer.size());
-            for (size_t i = 0; i < m_r_buffer.size(); ++i) {
-                std::cout << std::hex << static_cast<int>(m_r_buffer[i]) << " ";
-            }
-            std::cout << std::dec << "\n";
+            m_spm.read(m_spm_addr_reg, r_buffer.data(), r_buffer.size());
+            SIM_LOG(AXIM, TRACE, Log::hexBytes(r_buffer.data(), r_buffer.size()));
         }
         if (command & 4) { // 暗号化 (OTP xor W Buffer)
             // 暗号化する前のw_bufferをprint
             for (size_t j = 0; j < 4; ++j) { // 64Bを16Bずつ4回に分けて処理
                 // OTPが足りない場合はスキップ
                 if (!m_otp_fifo.empty()) {
-                    auto otp_part = m_otp_fifo.front(); m_otp_fifo.pop();
-                    for(size_t i=0; i<16; ++i) m_w_buffer[16*j+i] ^= otp_part[i];
+                    const Otp& otp_part = m_otp_fifo.front();
+                    for(size_t i=0; i<16; ++i) w_buffer[16*j+i] ^= otp_part[i];
+                    m_otp_fifo.pop();
                 }
             }
         }
         if (command & 8) { // 復号化 (OTP xor R Buffer)
             for (size_t j = 0; j < 4; ++j) { // 64Bを16Bずつ4回に分けて処理
                 if (!m_otp_fifo.empty()) {
-                    std::cout << "  [AXIM HW] Processing Decryption Command.\n";
-                    auto otp_part = m_otp_fifo.front(); m_otp_fifo.pop();
-                    for(size_t i=0; i<16; ++i) m_r_buffer[j*16+i] ^= otp_part[i];
+                    SIM_LOG(AXIM, TRACE, "  [AXIM HW] Processing Decryption Command.");
+                    const Otp& otp_part = m_otp_fifo.front();
+                    for(size_t i=0; i<16; ++i) r_buffer[j*16+i] ^= otp_part[i];
+                    m_otp_fifo.pop();
 
                 } else {
-                    std::cout << "  [AXIM HW] Warning: OTP FIFO empty during decryption.\n";
+                    SIM_LOG(AXIM, ERROR, "  [AXIM HW] Warning: OTP FIFO empty during decryption.");
                     exit(1);
                 }
             }
             if (!m_otp_fifo.empty()) {
-                std::cout << "  [AXIM HW] Warning: OTP FIFO not empty after decryption.\n";
+                SIM_LOG(AXIM, ERROR, "  [AXIM HW] Warning: OTP FIFO not empty after decryption.");
                 exit(1);
             }
 
         }
-        if (command & 16) { // Read Response (R Buffer -> LLC)
-            if (!m_request_queue.empty() && !m_request_queue.front().is_write) {
-                auto req = m_request_queue.front(); m_request_queue.pop();
-                if(req.read_cb) req.read_cb(m_r_buffer);
-            }
+        if (command & 64) { // Data Write Back (R Buffer -> SPM)
+            m_spm.write(m_spm_addr_reg, r_buffer.data(), r_buffer.size());
         }
-        if (command & 32) { // Write Response (ACK -> LLC)
-            if (!m_request_queue.empty() && m_request_queue.front().is_write) {
-                auto req = m_request_queue.front(); m_request_queue.pop();
-                if(req.write_cb) req.write_cb(true); // 常に成功を返す
+        // 選択中のエントリはコマンド受付時に解放し、LLCへの応答は完了イベントで完了リングに入れる
+        // (スロットは応答を取り出すまで使用中のため、エントリを次のリクエストが使ってもデータは残る)
+        uint32_t response = NO_SLOT;
+        if (claimed && ((command & 16) && !is_write)) response = entry.slot; // Read Response (R Buffer -> LLC)
+        if (claimed && ((command & 32) && is_write)) response = entry.slot;  // Write Response (ACK -> LLC)
+        if (response != NO_SLOT) releaseEntry(entry);
+        if (m_timeline) {
+            const char* name = (command & 8) ? "decrypt" : (command & 4) ? "encrypt" : (command & 48) ? "response" : "buffer copy";
+            m_timeline->complete(TimelineTrace::Track::AXIM, name, m_scheduler.now(), m_scheduler.now() + Parameter::AXIM_COMMAND_CYCLES);
+        }
+        m_scheduler.schedule(Parameter::AXIM_COMMAND_CYCLES, [this, response] {
+            m_busy_reg = 0;
+            if (response == NO_SLOT) return;
+            if (m_timeline) {
+                m_timeline->instant(TimelineTrace::Track::AXIM, m_slots[response].request.is_write ? "write ack" : "read ack", m_scheduler.now());
             }
+            complete(response);
+        });
+    }
+
+    // 応答したエントリを解放し、空きを待っていたリクエストを入れる
+    void releaseEntry(RequestEntry& entry) {
+        const LlcRequest& request = m_slots[entry.slot].request;
+        if (request.is_write) {
+            PendingWrite* pending = findPendingWrite(request.addr);
+            if (--pending->outstanding == 0) erasePendingWrite(*pending);
+        }
+        entry.state = RequestEntry::State::FREE;
+        if (!m_overflow.empty()) {
+            uint32_t slot = m_overflow.front();
+            m_overflow.pop();
+            admit(slot);
         }
-        m_busy_reg = 0;
     }
 
     // --- 依存モジュール ---
     Spm& m_spm;
+    EventScheduler& m_scheduler;
+    PerfCounters* m_perf = nullptr;
+    TimelineTrace* m_timeline = nullptr;
 
     // --- 内部状態 ---
-    std::queue<LlcRequest> m_request_queue;
-    std::queue<Otp> m_otp_fifo;
-    DataBlock m_r_buffer{}; // Read Buffer
-    DataBlock m_w_buffer{}; // Write Buffer
+    std::vector<RequestSlot> m_slots;     // リクエストスロット (構築時に確保)
+    std::vector<uint32_t> m_free_slots;   // 空きスロットの番号 (最後に空いたものから使う)
+    std::array<RequestEntry, SLOTS> m_table{};
+    std::vector<uint64_t> m_pending;      // 受け付け待ちのエントリのタグ (到着順。最大SLOTS個)
+    FixedRing<uint32_t> m_overflow;       // テーブルの空きを待つリクエストのスロット (到着順。seqは連続する)
+    FixedRing<uint32_t> m_completions;    // LLCが取り出していない応答のスロット (応答順)
+    uint64_t m_next_seq = 0;
+    std::vector<PendingWrite> m_pending_writes; // 応答していないWrite (アドレスで引く。要素数は2の冪)
+    uint64_t m_pending_write_shift = 0;
+    uint64_t m_forwarded_reads = 0;
+    // スケジューリング
+    SchedulePolicy m_policy = SchedulePolicy::FIFO;
+    uint64_t m_write_high = Parameter::AXIM_WRITE_HIGH_WATERMARK;
+    uint64_t m_write_low = Parameter::AXIM_WRITE_LOW_WATERMARK;
+    uint64_t m_write_max_age = Parameter::AXIM_WRITE_MAX_AGE;
+    uint64_t m_queued_writes = 0; // 受け付け待ちのWrite (テーブルの空きを待つものを含む)
+    bool m_draining = false;      // READ_FIRST: Writeを続けて選んでいる
+    uint64_t m_chosen = SLOTS;    // 直前のSTATUSの読み出しで選んだエントリ
+    uint64_t m_coalesced_writes = 0;
+    FixedRing<Otp> m_otp_fifo;
     
     // MMIOレジスタの状態
     uint64_t m_spm_addr_reg = 0;
+    uint64_t m_selected = 0; // REQ_IDで選択したエントリのタグ
     uint64_t m_busy_reg = 0;
 };
\ No newline at end of file
@@ -1,12 +1,13 @@
 #pragma once
+#include <array>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "memory_map.hpp"
-
-#pragma once
-#include <cstdint>
-#include <iostream>
-#include "memory_map.hpp"
+#include "event_scheduler.hpp"
 
 // --- 1. 前方宣言 (名前だけを知らせる) ---
 // これにより、Busクラス内でポインタメンバを宣言できる
@@ -16,28 +17,115 @@ class SpmModule;
 class HashModule;
 class AesModule;
 class AxiManagerModule;
+class PerfCounters;
 
+namespace BusDetail {
+    // デバイスがバースト転送用のメソッド(mmioReadBurst/mmioWriteBurst)を持つかどうか
+    template <class T, class = void>
+    struct HasReadBurst : std::false_type {};
+    template <class T>
+    struct HasReadBurst<T, std::void_t<decltype(std::declval<T&>().mmioReadBurst(uint64_t{}, std::declval<uint8_t*>()))>> : std::true_type {};
+    template <class T, class = void>
+    struct HasWriteBurst : std::false_type {};
+    template <class T>
+    struct HasWriteBurst<T, std::void_t<decltype(std::declval<T&>().mmioWriteBurst(uint64_t{}, std::declval<const uint8_t*>()))>> : std::true_type {};
+}
+
+/**
+ * @brief コアから各デバイス・DRAMへの64bitアクセスを振り分けるバス
+ * @details デバイス領域(MemoryMap::DEVICE_BASE_ADDR〜)を4KBページ単位の表で引き、登録されたデバイスに定数時間で振り分ける。
+ *          表に登録されていないアドレスは全てDRAMへのアクセスとして扱う。アドレスは64bitで扱う。
+ *          新しいデバイスは mapDevice (mmioRead64/mmioWrite64を持つクラス) または mapRegion で登録する。
+ *
+ *          readBurst/writeBurstは64B(1ライン)をまとめて転送するバーストトランザクションで、デバイスには1回の呼び出しで渡す。
+ *          バースト用の処理を持たないデバイスには、64bitアクセス8回に分解して渡す。
+ *
+ *          1回のアクセス(バーストを含む)ごとに、アクセス先に応じたサイクル数だけシミュレーション時刻を進める
+ *          (MMIOレジスタ: Parameter::MMIO_ACCESS_CYCLES、SPM: Parameter::SPM_ACCESS_CYCLES、DRAM: Parameter::DRAM_ACCESS_CYCLES)。
+ */
 class Bus {
 public:
-    Bus(Dram& dram, Spm& spm) : m_dram(dram), m_spm(spm) {}
+    using ReadFn = uint64_t (*)(void* device, uint64_t offset);
+    using WriteFn = void (*)(void* device, uint64_t offset, uint64_t data);
+    using ReadBurstFn = void (*)(void* device, uint64_t offset, uint8_t* data);
+    using WriteBurstFn = void (*)(void* device, uint64_t offset, const uint8_t* data);
+    static constexpr uint64_t PAGE_SIZE = 4096; // デバイス領域の振り分け単位
+    static constexpr uint64_t BURST_SIZE = 64;  // バースト転送の単位 (1ライン)
+    static constexpr uint64_t DEVICE_PAGES = MemoryMap::DEVICE_SIZE / PAGE_SIZE;
+
+    Bus(Dram& dram, Spm& spm, EventScheduler& scheduler);
 
     // 接続用のメソッド宣言
-    void connectSpmModule(SpmModule& mod) { m_spm_mod = &mod; }
-    void connectHashModule(HashModule& mod) { m_hash_mod = &mod; }
-    void connectAesModule(AesModule& mod) { m_aes_mod = &mod; }
-    void connectAxiManagerModule(AxiManagerModule& mod) { m_axi_mgr_mod = &mod; }
+    void connectSpmModule(SpmModule& mod);
+    void connectHashModule(HashModule& mod);
+    void connectAesModule(AesModule& mod);
+    void connectAxiManagerModule(AxiManagerModule& mod);
+    void connectPerfCounters(PerfCounters& perf);
+
+    /**
+     * @brief デバイス領域の[base, base+size)にデバイスを登録する
+     * @details read/writeには領域先頭からのオフセットが渡される。base・sizeはPAGE_SIZE単位。
+     *          read_burst/write_burstがnullptrの場合、バースト転送はread/writeの8回に分解される。
+     *          access_cyclesは1回のアクセス(バーストを含む)にかかるサイクル数。
+     */
+    void mapRegion(uint64_t base, uint64_t size, void* device, ReadFn read, WriteFn write,
+                   ReadBurstFn read_burst = nullptr, WriteBurstFn write_burst = nullptr,
+                   uint64_t access_cycles = Parameter::MMIO_ACCESS_CYCLES);
+    /**
+     * @brief mmioRead64(offset)/mmioWrite64(offset, value)を持つデバイスを登録する
+     * @details mmioReadBurst(offset, data)/mmioWriteBurst(offset, data)を持つ場合はバースト転送にも使う
+     */
+    template <class Device>
+    void mapDevice(uint64_t base, uint64_t size, Device& device) {
+        ReadBurstFn read_burst = nullptr;
+        WriteBurstFn write_burst = nullptr;
+        if constexpr (BusDetail::HasReadBurst<Device>::value) {
+            read_burst = [](void* d, uint64_t offset, uint8_t* data) { static_cast<Device*>(d)->mmioReadBurst(offset, data); };
+        }
+        if constexpr (BusDetail::HasWriteBurst<Device>::value) {
+            write_burst = [](void* d, uint64_t offset, const uint8_t* data) { static_cast<Device*>(d)->mmioWriteBurst(offset, data); };
+        }
+        mapRegion(base, size, &device,
+                  [](void* d, uint64_t offset) { return static_cast<Device*>(d)->mmioRead64(offset); },
+                  [](void* d, uint64_t offset, uint64_t data) { static_cast<Device*>(d)->mmioWrite64(offset, data); },
+                  read_burst, write_burst);
+    }
 
     // アクセス用メソッドの宣言
-    void write64(uint32_t addr, uint64_t data);
-    uint64_t read64(uint32_t addr);
+    void write64(uint64_t addr, uint64_t data);
+    uint64_t read64(uint64_t addr);
+    /**
+     * @brief 64Bアラインされたアドレスへの64Bバースト書き込み
+     */
+    void writeBurst(uint64_t addr, const uint8_t* data);
+    /**
+     * @brief 64Bアラインされたアドレスからの64Bバースト読み出し
+     */
+    void readBurst(uint64_t addr, uint8_t* data);
 
 private:
+    struct Region {
+        uint64_t base;
+        void* device;
+        ReadFn read;
+        WriteFn write;
+        ReadBurstFn read_burst;
+        WriteBurstFn write_burst;
+        uint64_t access_cycles;
+    };
+
+    // デバイス領域内のアドレスなら対応するRegionを返す (未登録・領域外ならnullptr)
+    const Region* findRegion(uint64_t addr) const {
+        uint64_t page = (addr - MemoryMap::DEVICE_BASE_ADDR) / PAGE_SIZE; // 領域より下のアドレスはラップして範囲外になる
+        if (page >= DEVICE_PAGES || m_page_table[page] == 0) return nullptr;
+        return &m_regions[m_page_table[page] - 1];
+    }
+
     Dram& m_dram;
     Spm& m_spm;
-    SpmModule* m_spm_mod = nullptr;
-    HashModule* m_hash_mod = nullptr;
-    AesModule* m_aes_mod = nullptr;
-    AxiManagerModule* m_axi_mgr_mod = nullptr;
+    EventScheduler& m_scheduler;
+    std::vector<Region> m_regions;
+    std::array<uint8_t, DEVICE_PAGES> m_page_table{}; // 0: 未登録, n: m_regions[n - 1]
 };
 
 
@@ -49,56 +137,114 @@ private:
 #include "hash_module.hpp"
 #include "aes_module.hpp"
 #include "axi_manager_module.hpp"
+#include "perf_counters.hpp"
 
 
 // --- 3. メソッドの実装 ---
 // この時点では、コンパイラは全てのクラスの詳細を知っているので、エラーにならない
-inline void Bus::write64(uint32_t addr, uint64_t data) {
-    // MMIOアドレス範囲の判定
-    // std::cout << "[Bus] Write64 to Address 0x" << std::hex << addr << " Data 0x" << data << std::dec << "\n";
-        if (addr >= MemoryMap::MMIO_SPM_DMA_BASE_ADDR && addr < MemoryMap::MMIO_MAC_BASE_ADDR) {
-            if (m_spm_mod) m_spm_mod->mmioWrite64(addr - MemoryMap::MMIO_SPM_DMA_BASE_ADDR, data);
-        } 
-        else if (addr >= MemoryMap::MMIO_MAC_BASE_ADDR && addr < MemoryMap::MMIO_AES_ACCEL_BASE_ADDR) {
-            if (m_hash_mod) m_hash_mod->mmioWrite64(addr - MemoryMap::MMIO_MAC_BASE_ADDR, data);
-        }
-        else if (addr >= MemoryMap::MMIO_AES_ACCEL_BASE_ADDR && addr < MemoryMap::MMIO_AXI_MGR_BASE_ADDR) {
-            if (m_aes_mod) m_aes_mod->mmioWrite64(addr - MemoryMap::MMIO_AES_ACCEL_BASE_ADDR, data);
-        }
-        else if (addr >= MemoryMap::MMIO_AXI_MGR_BASE_ADDR && addr < MemoryMap::SPM_BASE_ADDR) {
-            if (m_axi_mgr_mod) m_axi_mgr_mod->mmioWrite64(addr - MemoryMap::MMIO_AXI_MGR_BASE_ADDR, data);
-        }
-        // SPMデータ領域へのアクセス
-        else if (addr >= MemoryMap::SPM_BASE_ADDR && addr < (MemoryMap::SPM_SIZE + MemoryMap::SPM_BASE_ADDR)) { // SPMの終端を仮定
-            m_spm.write64(addr, data);
+inline Bus::Bus(Dram& dram, Spm& spm, EventScheduler& scheduler) : m_dram(dram), m_spm(spm), m_scheduler(scheduler) {
+    // SPMデータ領域 (Spmは絶対アドレスでアクセスする)
+    mapRegion(MemoryMap::SPM_BASE_ADDR, MemoryMap::SPM_SIZE, &m_spm,
+              [](void* d, uint64_t offset) { return static_cast<Spm*>(d)->read64(MemoryMap::SPM_BASE_ADDR + offset); },
+              [](void* d, uint64_t offset, uint64_t data) { static_cast<Spm*>(d)->write64(MemoryMap::SPM_BASE_ADDR + offset, data); },
+              [](void* d, uint64_t offset, uint8_t* data) { static_cast<Spm*>(d)->read(MemoryMap::SPM_BASE_ADDR + offset, data, BURST_SIZE); },
+              [](void* d, uint64_t offset, const uint8_t* data) { static_cast<Spm*>(d)->write(MemoryMap::SPM_BASE_ADDR + offset, data, BURST_SIZE); },
+              Parameter::SPM_ACCESS_CYCLES);
+}
+
+inline void Bus::connectSpmModule(SpmModule& mod) { mapDevice(MemoryMap::MMIO_SPM_DMA_BASE_ADDR, MemoryMap::MMIO_WINDOW_SIZE, mod); }
+inline void Bus::connectHashModule(HashModule& mod) { mapDevice(MemoryMap::MMIO_MAC_BASE_ADDR, MemoryMap::MMIO_WINDOW_SIZE, mod); }
+inline void Bus::connectAesModule(AesModule& mod) { mapDevice(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR, MemoryMap::MMIO_WINDOW_SIZE, mod); }
+inline void Bus::connectAxiManagerModule(AxiManagerModule& mod) { mapDevice(MemoryMap::MMIO_AXI_MGR_BASE_ADDR, MemoryMap::MMIO_WINDOW_SIZE, mod); }
+inline void Bus::connectPerfCounters(PerfCounters& perf) { mapDevice(MemoryMap::MMIO_PERF_BASE_ADDR, MemoryMap::MMIO_WINDOW_SIZE, perf); }
+
+inline void Bus::mapRegion(uint64_t base, uint64_t size, void* device, ReadFn read, WriteFn write,
+                           ReadBurstFn read_burst, WriteBurstFn write_burst, uint64_t access_cycles) {
+    if (base < MemoryMap::DEVICE_BASE_ADDR || base + size > MemoryMap::DEVICE_BASE_ADDR + MemoryMap::DEVICE_SIZE ||
+        base % PAGE_SIZE != 0 || size % PAGE_SIZE != 0 || size == 0) {
+        std::cerr << "Bus: Invalid device region! Base: 0x" << std::hex << base << ", Size: 0x" << size << std::dec << "\n";
+        exit(1);
+    }
+    uint64_t first_page = (base - MemoryMap::DEVICE_BASE_ADDR) / PAGE_SIZE;
+    for (uint64_t page = first_page; page < first_page + size / PAGE_SIZE; ++page) {
+        if (m_page_table[page] != 0) {
+            std::cerr << "Bus: Device region overlaps an existing one! Base: 0x" << std::hex << base << std::dec << "\n";
+            exit(1);
         }
+    }
+    m_regions.push_back({base, device, read, write, read_burst, write_burst, access_cycles});
+    if (m_regions.size() > UINT8_MAX) {
+        std::cerr << "Bus: Too many device regions!\n";
+        exit(1);
+    }
+    for (uint64_t page = first_page; page < first_page + size / PAGE_SIZE; ++page) {
+        m_page_table[page] = static_cast<uint8_t>(m_regions.size());
+    }
+}
+
+inline void Bus::write64(uint64_t addr, uint64_t data) {
+    // std::cout << "[Bus] Write64 to Address 0x" << std::hex << addr << " Data 0x" << data << std::dec << "\n";
+    if (const Region* region = findRegion(addr)) {
+        m_scheduler.advance(region->access_cycles);
+        region->write(region->device, addr - region->base, data);
+    } else {
         // DRAMへのアクセス
-        else {
-            m_dram.write64(addr, data);
-        }
+        m_scheduler.advance(Parameter::DRAM_ACCESS_CYCLES);
+        m_dram.write64(addr, data);
+    }
 }
 
-inline uint64_t Bus::read64(uint32_t addr) {
-    // MMIOアドレス範囲の判定
-        if (addr >= MemoryMap::MMIO_SPM_DMA_BASE_ADDR && addr < MemoryMap::MMIO_MAC_BASE_ADDR) {
-            if (m_spm_mod) return m_spm_mod->mmioRead64(addr - MemoryMap::MMIO_SPM_DMA_BASE_ADDR);
-        }
-        else if (addr >= MemoryMap::MMIO_MAC_BASE_ADDR && addr < MemoryMap::MMIO_AES_ACCEL_BASE_ADDR) {
-            if (m_hash_mod) return m_hash_mod->mmioRead64(addr - MemoryMap::MMIO_MAC_BASE_ADDR);
-        }
-        else if (addr >= MemoryMap::MMIO_AES_ACCEL_BASE_ADDR && addr < MemoryMap::MMIO_AXI_MGR_BASE_ADDR) {
-            if (m_aes_mod) return m_aes_mod->mmioRead64(addr - MemoryMap::MMIO_AES_ACCEL_BASE_ADDR);
-        }
-        else if (addr >= MemoryMap::MMIO_AXI_MGR_BASE_ADDR && addr < MemoryMap::SPM_BASE_ADDR) {
-            if (m_axi_mgr_mod) return m_axi_mgr_mod->mmioRead64(addr - MemoryMap::MMIO_AXI_MGR_BASE_ADDR);
-        }
-        // SPMデータ領域へのアクセス
-        else if (addr >= MemoryMap::SPM_BASE_ADDR && addr < (MemoryMap::SPM_SIZE + MemoryMap::SPM_BASE_ADDR)) {
-            return m_spm.read64(addr);
+inline uint64_t Bus::read64(uint64_t addr) {
+    if (const Region* region = findRegion(addr)) {
+        m_scheduler.advance(region->access_cycles);
+        return region->read(region->device, addr - region->base);
+    }
+    // DRAMへのアクセス
+    m_scheduler.advance(Parameter::DRAM_ACCESS_CYCLES);
+    return m_dram.read64(addr);
+}
+
+inline void Bus::writeBurst(uint64_t addr, const uint8_t* data) {
+    if (addr % BURST_SIZE != 0) {
+        std::cerr << "Bus: Unaligned burst write! Addr: 0x" << std::hex << addr << std::dec << "\n";
+        exit(1);
+    }
+    if (const Region* region = findRegion(addr)) {
+        m_scheduler.advance(region->access_cycles);
+        if (region->write_burst) {
+            region->write_burst(region->device, addr - region->base, data);
+        } else {
+            for (uint64_t offset = 0; offset < BURST_SIZE; offset += 8) {
+                uint64_t word;
+                std::memcpy(&word, data + offset, sizeof(word));
+                region->write(region->device, addr - region->base + offset, word);
+            }
         }
+    } else {
         // DRAMへのアクセス
-        else {
-            return m_dram.read64(addr);
+        m_scheduler.advance(Parameter::DRAM_ACCESS_CYCLES);
+        m_dram.write(addr, data, BURST_SIZE);
+    }
+}
+
+inline void Bus::readBurst(uint64_t addr, uint8_t* data) {
+    if (addr % BURST_SIZE != 0) {
+        std::cerr << "Bus: Unaligned burst read! Addr: 0x" << std::hex << addr << std::dec << "\n";
+        exit(1);
+    }
+    if (const Region* region = findRegion(addr)) {
+        m_scheduler.advance(region->access_cycles);
+        if (region->read_burst) {
+            region->read_burst(region->device, addr - region->base, data);
+        } else {
+            for (uint64_t offset = 0; offset < BURST_SIZE; offset += 8) {
+                uint64_t word = region->read(region->device, addr - region->base + offset);
+                std::memcpy(data + offset, &word, sizeof(word));
+            }
         }
-        return 0; // 該当なし
-}
\ No newline at end of file
+    } else {
+        // DRAMへのアクセス
+        m_scheduler.advance(Parameter::DRAM_ACCESS_CYCLES);
+        m_dram.read(addr, data, BURST_SIZE);
+    }
+}
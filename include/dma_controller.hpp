@@ -2,8 +2,8 @@
 #include "memory_map.hpp"
 #include "dram.hpp"
 #include "spm.hpp"
+#include "logger.hpp"
 #include <iostream>
-#include <vector>
 
 class DmaController {
 public:
@@ -30,18 +30,16 @@ public:
 
 private:
     void executeDmaTransfer() {
-        std::cout << "  HW (DMA): Transfer started.\n";
-        std::vector<uint8_t> buffer(m_size);
-
+        SIM_LOG(DMA, TRACE, "  HW (DMA): Transfer started.");
+        // 一時バッファを介さず、SPMの記憶領域とDramの間で直接コピーする
+        uint8_t* spm_data = m_spm.view(m_spm_addr, m_size);
         if (m_direction == 0) { // DRAM -> SPM
-            m_dram.read(m_dram_addr, buffer.data(), m_size);
-            m_spm.write(m_spm_addr, buffer.data(), m_size);
+            m_dram.read(m_dram_addr, spm_data, m_size);
         } else { // SPM -> DRAM
-            m_spm.read(m_spm_addr, buffer.data(), m_size);
-            m_dram.write(m_dram_addr, buffer.data(), m_size);
+            m_dram.write(m_dram_addr, spm_data, m_size);
         }
 
-        std::cout << "  HW (DMA): Transfer finished.\n";
+        SIM_LOG(DMA, TRACE, "  HW (DMA): Transfer finished.");
         m_status = 0;
     }
 
@@ -1,21 +1,52 @@
 #pragma once
+#include <algorithm>
+#include <array>
 #include <vector>
+#include <memory>
 #include <cstdint>
 #include <iostream>
 #include <cstring>
+#include "logger.hpp"
+#include "memory_map.hpp"
+#include "traffic_stats.hpp"
 
+/**
+ * @brief DRAMモデル (疎なバッキングストア)
+ * @details 2段のページテーブルで管理し、4KBページを最初の書き込み時に確保する。
+ *          書き込まれていない領域の読み出しは0を返し、メモリを確保しない。
+ *          容量全体をゼロ埋めして確保しないため、起動時間とメモリ使用量はアクセスした範囲にのみ比例する。
+ */
 class Dram {
 public:
-    Dram(size_t size_bytes = 1024 * 1024 * 768) : m_memory(size_bytes) { // 768MB
-        std::cout << "DRAM: Initializing... (Size: " << size_bytes / 1024 << " KB)\n";
+    static constexpr uint64_t PAGE_SIZE = 4096;               // 確保単位 (4KB)
+    static constexpr uint64_t PAGES_PER_REGION = 512;         // 1段目の1エントリが管理するページ数 (2MB)
+    static constexpr uint64_t REGION_SIZE = PAGE_SIZE * PAGES_PER_REGION;
+
+    Dram(size_t size_bytes = MemoryMap::DRAM_SIZE) // 既定768MB
+        : m_size(size_bytes), m_regions((size_bytes + REGION_SIZE - 1) / REGION_SIZE) {
+        SIM_LOG(DRAM, INFO, "DRAM: Initializing... (Size: " << size_bytes / 1024 << " KB)");
         // テストデータを書き込む
         const char* test_data = "Hello from DRAM!";
         write(0x1000, reinterpret_cast<const uint8_t*>(test_data), std::strlen(test_data) + 1);
     }
 
+    /**
+     * @brief トラフィックの内訳の集計を接続する。以降の全てのアクセスを領域ごとに数える
+     */
+    void attachTrafficStats(TrafficStats& traffic) { m_traffic = &traffic; }
+
     void write(uint64_t addr, const uint8_t* data, uint64_t size) {
-        if (addr + size <= m_memory.size()) {
-            std::memcpy(&m_memory[addr], data, size);
+        if (addr + size <= m_size) {
+            if (m_traffic) m_traffic->record(addr, size, true);
+            // ページ境界で分割して書き込む
+            while (size > 0) {
+                uint64_t offset = addr % PAGE_SIZE;
+                uint64_t chunk = std::min(size, PAGE_SIZE - offset);
+                std::memcpy(touchPage(addr)->data() + offset, data, chunk);
+                addr += chunk;
+                data += chunk;
+                size -= chunk;
+            }
         } else {
             std::cerr << "DRAM: Write out of bounds! Addr: 0x" << std::hex << addr << ", Size: " << std::dec << size << "\n";
             exit(1);
@@ -23,25 +54,71 @@ public:
     }
 
     void read(uint64_t addr, uint8_t* data, uint64_t size) {
-        if (addr + size <= m_memory.size()) {
-            std::memcpy(data, &m_memory[addr], size);
+        if (addr + size <= m_size) {
+            if (m_traffic) m_traffic->record(addr, size, false);
+            while (size > 0) {
+                uint64_t offset = addr % PAGE_SIZE;
+                uint64_t chunk = std::min(size, PAGE_SIZE - offset);
+                const Page* page = findPage(addr);
+                if (page) {
+                    std::memcpy(data, page->data() + offset, chunk);
+                } else {
+                    std::memset(data, 0, chunk); // 未確保のページは0として読む
+                }
+                addr += chunk;
+                data += chunk;
+                size -= chunk;
+            }
         } else {
             std::cerr << "DRAM: Read out of bounds! Addr: 0x" << std::hex << addr << ", Size: " << std::dec << size << "\n";
             exit(1);
         }
     }
-    void write64(uint32_t addr, uint64_t data) {
-        if (addr + 8 <= m_memory.size()) {
-            *reinterpret_cast<uint64_t*>(&m_memory[addr]) = data;
+    void write64(uint64_t addr, uint64_t data) {
+        if (addr + 8 <= m_size) {
+            write(addr, reinterpret_cast<const uint8_t*>(&data), sizeof(data));
         }
     }
-    uint64_t read64(uint32_t addr) {
-        if (addr + 8 <= m_memory.size()) {
-            return *reinterpret_cast<uint64_t*>(&m_memory[addr]);
+    uint64_t read64(uint64_t addr) {
+        uint64_t data = 0;
+        if (addr + 8 <= m_size) {
+            read(addr, reinterpret_cast<uint8_t*>(&data), sizeof(data));
         }
-        return 0;
+        return data;
+    }
+
+    /**
+     * @brief 確保済みのページが占めるバイト数 (実際のメモリ使用量の目安)
+     */
+    uint64_t residentBytes() const {
+        return m_resident_pages * PAGE_SIZE;
     }
 
 private:
-    std::vector<uint8_t> m_memory;
-};
\ No newline at end of file
+    using Page = std::array<uint8_t, PAGE_SIZE>;
+    using Region = std::array<std::unique_ptr<Page>, PAGES_PER_REGION>;
+
+    // 読み出し用: ページが未確保ならnullptrを返す
+    const Page* findPage(uint64_t addr) const {
+        const std::unique_ptr<Region>& region = m_regions[addr / REGION_SIZE];
+        if (!region) return nullptr;
+        return (*region)[addr % REGION_SIZE / PAGE_SIZE].get();
+    }
+
+    // 書き込み用: ページが未確保なら0埋めで確保する
+    Page* touchPage(uint64_t addr) {
+        std::unique_ptr<Region>& region = m_regions[addr / REGION_SIZE];
+        if (!region) region = std::make_unique<Region>();
+        std::unique_ptr<Page>& page = (*region)[addr % REGION_SIZE / PAGE_SIZE];
+        if (!page) {
+            page = std::make_unique<Page>(); // 値初期化により0埋めされる
+            ++m_resident_pages;
+        }
+        return page.get();
+    }
+
+    uint64_t m_size;
+    std::vector<std::unique_ptr<Region>> m_regions; // 1段目: 2MB単位の領域
+    uint64_t m_resident_pages = 0;
+    TrafficStats* m_traffic = nullptr;
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief 離散イベントシミュレーションのカーネル
+ * @details 各モジュールはコマンドを受け付けるとBusyになり、処理時間(サイクル)後の完了イベントを登録する。
+ *          コアはステータスをポーリングする代わりに、条件が成立するまでイベントを時刻順に処理し、シミュレーション時刻を進める。
+ *          同じ時刻のイベントは登録順に処理する。
+ */
+class EventScheduler {
+public:
+    using Cycle = uint64_t;
+    using Action = std::function<void()>;
+
+    /**
+     * @brief 現在時刻からdelayサイクル後に実行するイベントを登録する
+     */
+    void schedule(Cycle delay, Action action) {
+        m_events.push({m_now + delay, m_next_seq++, std::move(action)});
+    }
+
+    /**
+     * @brief 最も早いイベントを1つ処理し、時刻をそのイベントの時刻まで進める
+     * @return 処理するイベントが無ければfalse
+     */
+    bool runNext() {
+        if (m_events.empty()) return false;
+        // actionの中で新しいイベントが登録される場合があるため、取り出してから実行する
+        // (popする要素なのでムーブしてよい)
+        Event event = std::move(const_cast<Event&>(m_events.top()));
+        m_events.pop();
+        m_now = event.time;
+        event.action();
+        return true;
+    }
+
+    /**
+     * @brief done()が成立するまでイベントを処理する
+     * @return 成立せずにイベントが尽きた場合はfalse (デッドロック)
+     */
+    template <class Predicate>
+    bool runUntil(Predicate done) {
+        while (!done()) {
+            if (!runNext()) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 時刻をdeltaサイクル進める (コア自身の処理時間)
+     * @details 進めた時刻までに発生するイベントは時刻順に処理する
+     */
+    void advance(Cycle delta) {
+        Cycle target = m_now + delta;
+        while (!m_events.empty() && m_events.top().time <= target) runNext();
+        m_now = target;
+    }
+
+    /**
+     * @brief 登録済みのイベントを全て処理する
+     */
+    void runAll() {
+        while (runNext()) {}
+    }
+
+    Cycle now() const { return m_now; }
+    bool empty() const { return m_events.empty(); }
+
+private:
+    struct Event {
+        Cycle time;
+        uint64_t seq; // 同時刻のイベントを登録順に処理するための通し番号
+        Action action;
+    };
+    struct Later {
+        bool operator()(const Event& a, const Event& b) const {
+            return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+        }
+    };
+
+    std::priority_queue<Event, std::vector<Event>, Later> m_events;
+    Cycle m_now = 0;
+    uint64_t m_next_seq = 0;
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief 容量固定のリングバッファ (FIFO)
+ * @details 要素は構築時に確保し、push/popではメモリを確保しない。
+ *          満杯の時のpushはfalseを返す(呼び出し側が空きを待つ)。operator[]は先頭からi番目の要素。
+ */
+template <class T>
+class FixedRing {
+public:
+    explicit FixedRing(size_t capacity) : m_items(capacity) {}
+
+    size_t capacity() const { return m_items.size(); }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    bool full() const { return m_size == m_items.size(); }
+
+    bool push(T value) {
+        if (full()) return false;
+        m_items[index(m_size)] = std::move(value);
+        m_size++;
+        return true;
+    }
+
+    T& front() { return m_items[m_head]; }
+    const T& front() const { return m_items[m_head]; }
+
+    void pop() {
+        m_head = index(1);
+        m_size--;
+    }
+
+    T& operator[](size_t i) { return m_items[index(i)]; }
+    const T& operator[](size_t i) const { return m_items[index(i)]; }
+
+private:
+    size_t index(size_t i) const {
+        size_t at = m_head + i;
+        return at < m_items.size() ? at : at - m_items.size();
+    }
+
+    std::vector<T> m_items;
+    size_t m_head = 0;
+    size_t m_size = 0;
+};
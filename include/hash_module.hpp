@@ -1,6 +1,10 @@
 #pragma once
 #include "spm.hpp" // SPMへのアクセスに必要
 #include "memory_map.hpp"
+#include "logger.hpp"
+#include "event_scheduler.hpp"
+#include "perf_counters.hpp"
+#include "timeline_trace.hpp"
 #include <iostream>
 #include <array>
 #include <vector>
@@ -11,8 +15,9 @@ public:
     /**
      * @brief コンストラクタ
      * @param spm データコピー元となるSpmModuleへの参照
+     * @param scheduler 処理完了イベントを登録するスケジューラ
      */
-    HashModule(Spm& spm) : m_spm(spm) {
+    HashModule(Spm& spm, EventScheduler& scheduler) : m_spm(spm), m_scheduler(scheduler) {
         reset();
     }
 
@@ -22,7 +27,7 @@ public:
     void mmioWrite64(uint32_t offset, uint64_t value) {
         // STATUSが1(Busy)の場合、いかなる入力も受け付けない
         if (m_status == 1) {
-            std::cout << "  [Hash HW] Ignored write while busy.\n";
+            SIM_LOG(MAC, WARN, "  [Hash HW] Ignored write while busy.");
             return;
         }
 
@@ -61,6 +66,15 @@ public:
         return 0;
     }
 
+    /**
+     * @brief 性能カウンターを接続する (接続しない場合は数えない)
+     */
+    void attachPerfCounters(PerfCounters& perf) { m_perf = &perf; }
+    /**
+     * @brief タイムラインを接続する (コマンドごとの区間を記録する)
+     */
+    void attachTimeline(TimelineTrace& timeline) { m_timeline = &timeline; }
+
 private:
     // FNV-1aハッシュ用の定数 (64bit版)
     static constexpr uint64_t FNV_PRIME = 0x100000001b3;
@@ -74,6 +88,14 @@ private:
         m_internal_buffer.fill(0);
     }
 
+    // バイトiのうち、START_BIT〜END_BITの範囲に含まれるビットのマスク
+    uint8_t bitRangeMask(uint64_t i) const {
+        uint8_t mask = 0xFF;
+        if (i == m_start_bit_reg / 8) mask &= static_cast<uint8_t>(0xFF << (m_start_bit_reg % 8));
+        if (i == m_end_bit_reg / 8) mask &= static_cast<uint8_t>(0xFF >> (7 - m_end_bit_reg % 8));
+        return mask;
+    }
+
     // SPMから内部バッファへのDMAコピーを実行
     void executeDmaCopy() {
         m_status = 1; // Busyに設定
@@ -81,14 +103,15 @@ private:
         //           << " -> Internal Buffer, 64 Bytes)\n" << std::dec;
         m_spm.read(m_spm_addr_reg, m_internal_buffer.data(), m_internal_buffer.size());
         // std::cout << "  [Hash HW] DMA Copy Finished.\n";
-        m_status = 0; // Idleに戻す
+        finishAfter(Parameter::MAC_COPY_CYCLES, "copy");
     }
 
     // COMMANDレジスタに書き込まれたコマンドを実行
     void executeCommand(uint64_t command) {
         m_status = 1; // Busyに設定
+        uint64_t cycles = Parameter::MAC_COMMAND_CYCLES;
         if (command & 1) { // INIT
-            std::cout << "  [Hash HW] Command INIT received. MAC state cleared.\n";
+            SIM_LOG(MAC, TRACE, "  [Hash HW] Command INIT received. MAC state cleared.");
             m_mac_result = FNV_OFFSET_BASIS;
         }
         if (command & 2) { // UPDATE
@@ -102,30 +125,37 @@ private:
                 //  std::cout << "  [Hash HW] ERROR: Invalid bit range.\n";
             } else {
                 
-                std::cout << "  [Hash HW] Processing bytes from " << start_byte << " to " << end_byte << ".\n";
+                SIM_LOG(MAC, TRACE, "  [Hash HW] Processing bytes from " << start_byte << " to " << end_byte << ".");
                 // internal_bufferの指定バイト範囲をprint
-                std::cout << "  [Hash HW] Data: ";
-                for (uint64_t i = start_byte; i <= end_byte; ++i) {
-                    std::cout << std::hex << static_cast<int>(m_internal_buffer[i]) << " ";
-                }
-                std::cout << std::dec << "\n";
+                SIM_LOG(MAC, TRACE, "  [Hash HW] Data: " << Log::hexBytes(&m_internal_buffer[start_byte], end_byte - start_byte + 1));
                 // FNV-1aアルゴリズムをそのバイト範囲で実行
-
+                // 範囲外のビットは0として扱う (バイト境界に揃っていないマイナーカウンター用)
                 for (uint64_t i = start_byte; i <= end_byte; ++i) {
-                    m_mac_result ^= m_internal_buffer[i];
+                    m_mac_result ^= m_internal_buffer[i] & bitRangeMask(i);
                     m_mac_result *= FNV_PRIME;
                 }
+                cycles += (end_byte - start_byte + 1) * Parameter::MAC_CYCLES_PER_BYTE;
+                if (m_perf) m_perf->add(MemoryMap::PerfCounter::MAC_UPDATE_BYTES, end_byte - start_byte + 1);
             }
         }
         if (command & 4) { // DIGEST
             // std::cout << "  [Hash HW] Command DIGEST received. Calculation finalized.\n";
             // 実際のハードウェアではパディングなどを行うが、シミュレーションでは何もしない
         }
-        m_status = 0; // Idleに戻す
+        finishAfter(cycles, (command & 2) ? "update" : (command & 1) ? "init" : "command");
+    }
+
+    // 処理時間後にIdleに戻す (結果はコマンド受付時に計算済み)
+    void finishAfter(uint64_t latency, const char* name) {
+        if (m_timeline) m_timeline->complete(TimelineTrace::Track::MAC, name, m_scheduler.now(), m_scheduler.now() + latency);
+        m_scheduler.schedule(latency, [this] { m_status = 0; });
     }
 
     // --- 依存モジュール ---
     Spm& m_spm;
+    EventScheduler& m_scheduler;
+    PerfCounters* m_perf = nullptr;
+    TimelineTrace* m_timeline = nullptr;
 
     // --- 内部状態 ---
     std::array<uint8_t, 64> m_internal_buffer;
@@ -0,0 +1,101 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+/**
+ * @brief HDR形式のレイテンシヒストグラム
+ * @details 値を2の冪の区間ごとに、SUB_BUCKETS/2個の等幅サブバケットに分けて数える。
+ *          SUB_BUCKET_BITS=7なら各バケットの幅は値の1/64以下(相対誤差1.6%以下)で、64bitの全範囲を約3800バケットで表す。
+ *          記録は定数時間でメモリも固定のため、数百万リクエストでもコストは変わらない。
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 7;
+    static constexpr uint64_t SUB_BUCKETS = 1ULL << SUB_BUCKET_BITS; // 値が128未満の区間は1刻み
+    static constexpr uint64_t HALF_BUCKETS = SUB_BUCKETS / 2;
+    static constexpr size_t BUCKET_COUNT = SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * HALF_BUCKETS;
+
+    void record(uint64_t value) {
+        m_buckets[bucketIndex(value)]++;
+        m_count++;
+        m_total += value;
+        m_min = std::min(m_min, value);
+        m_max = std::max(m_max, value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) m_buckets[i] += other.m_buckets[i];
+        m_count += other.m_count;
+        m_total += other.m_total;
+        m_min = std::min(m_min, other.m_min);
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t min() const { return m_count ? m_min : 0; }
+    uint64_t max() const { return m_max; }
+    uint64_t mean() const { return m_count ? m_total / m_count : 0; }
+
+    /**
+     * @brief p%点の値 (その値を含むバケットの上端。最大値を超えない)
+     */
+    uint64_t percentile(double p) const {
+        if (m_count == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * m_count + 0.5);
+        rank = std::clamp<uint64_t>(rank, 1, m_count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += m_buckets[i];
+            if (seen >= rank) return std::min(bucketHighest(i), m_max);
+        }
+        return m_max;
+    }
+
+    /**
+     * @brief 2の冪の区間ごとの件数を出力する (分布の概観用)
+     */
+    void printDistribution(std::ostream& os) const {
+        // ranges[g]: g=0は値0、g>=1は[2^(g-1), 2^g)
+        std::array<uint64_t, 65> ranges{};
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            uint64_t lowest = bucketLowest(i);
+            ranges[lowest == 0 ? 0 : 64 - __builtin_clzll(lowest)] += m_buckets[i];
+        }
+        for (size_t g = 0; g < ranges.size(); ++g) {
+            if (ranges[g] == 0) continue;
+            if (g == 0) {
+                os << "    [0, 1): " << ranges[g] << "\n";
+            } else {
+                os << "    [" << (1ULL << (g - 1)) << ", " << (g < 64 ? std::to_string(1ULL << g) : "2^64") << "): " << ranges[g] << "\n";
+            }
+        }
+    }
+
+private:
+    static size_t bucketIndex(uint64_t value) {
+        if (value < SUB_BUCKETS) return value;
+        unsigned msb = 63 - __builtin_clzll(value);
+        unsigned shift = msb - SUB_BUCKET_BITS + 1; // value >> shift は [HALF_BUCKETS, SUB_BUCKETS)
+        return SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + ((value >> shift) - HALF_BUCKETS);
+    }
+    static uint64_t bucketLowest(size_t index) {
+        if (index < SUB_BUCKETS) return index;
+        uint64_t k = index - SUB_BUCKETS;
+        unsigned shift = static_cast<unsigned>(k / HALF_BUCKETS) + 1;
+        return (k % HALF_BUCKETS + HALF_BUCKETS) << shift;
+    }
+    static uint64_t bucketHighest(size_t index) {
+        if (index < SUB_BUCKETS) return index;
+        unsigned shift = static_cast<unsigned>((index - SUB_BUCKETS) / HALF_BUCKETS) + 1;
+        return bucketLowest(index) + ((1ULL << shift) - 1);
+    }
+
+    std::array<uint64_t, BUCKET_COUNT> m_buckets{};
+    uint64_t m_count = 0;
+    uint64_t m_total = 0;
+    uint64_t m_min = UINT64_MAX;
+    uint64_t m_max = 0;
+};
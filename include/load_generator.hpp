@@ -0,0 +1,177 @@
+#pragma once
+#include "memory_map.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief 開ループ負荷の設定
+ * @details コマンドライン引数 key=value で上書きする (parseを参照)。
+ */
+struct LoadConfig {
+    enum class Arrival { POISSON, FIXED };
+    enum class Distribution { UNIFORM, ZIPFIAN, SEQUENTIAL, STRIDED, HOTSET };
+
+    uint64_t requests = 100000;        // 発行するリクエスト数
+    Arrival arrival = Arrival::POISSON; // 到着間隔の分布
+    double interval = 2000.0;           // 平均到着間隔 (サイクル)
+    double write_ratio = 0.5;           // Writeの割合
+    Distribution distribution = Distribution::UNIFORM;
+    uint64_t footprint = std::min<uint64_t>(4ULL << 20, MemoryMap::PROTECTION_SIZE); // アクセスする範囲 (保護領域の先頭からのバイト数、既定4MB)
+    double zipf_theta = 0.99;           // ZIPFIAN: 偏りの強さ (0 < theta < 1)
+    uint64_t stride = 4096;             // STRIDED: アクセス間隔 (バイト)
+    double hot_fraction = 0.01;         // HOTSET: ホットセットの大きさ (footprintに対する割合)
+    double hot_probability = 0.9;       // HOTSET: ホットセットにアクセスする確率
+    uint64_t seed = 1;
+
+    /**
+     * @brief key=value 形式の引数を1つ反映する
+     * @return 未知のキー・不正な値ならfalse
+     */
+    bool parse(const std::string& arg) {
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = arg.substr(0, eq);
+        std::string value = arg.substr(eq + 1);
+        try {
+            if (key == "requests") requests = std::stoull(value);
+            else if (key == "interval") interval = std::stod(value);
+            else if (key == "write_ratio") write_ratio = std::stod(value);
+            else if (key == "footprint") footprint = std::stoull(value, nullptr, 0);
+            else if (key == "zipf_theta") zipf_theta = std::stod(value);
+            else if (key == "stride") stride = std::stoull(value, nullptr, 0);
+            else if (key == "hot_fraction") hot_fraction = std::stod(value);
+            else if (key == "hot_probability") hot_probability = std::stod(value);
+            else if (key == "seed") seed = std::stoull(value);
+            else if (key == "arrival") {
+                if (value == "poisson") arrival = Arrival::POISSON;
+                else if (value == "fixed") arrival = Arrival::FIXED;
+                else return false;
+            } else if (key == "dist") {
+                if (value == "uniform") distribution = Distribution::UNIFORM;
+                else if (value == "zipfian") distribution = Distribution::ZIPFIAN;
+                else if (value == "sequential") distribution = Distribution::SEQUENTIAL;
+                else if (value == "strided") distribution = Distribution::STRIDED;
+                else if (value == "hotset") distribution = Distribution::HOTSET;
+                else return false;
+            } else {
+                return false;
+            }
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 値の範囲を確認する
+     */
+    bool valid() const {
+        return interval >= 0 && write_ratio >= 0 && write_ratio <= 1 &&
+               footprint >= 64 && footprint <= MemoryMap::PROTECTION_SIZE &&
+               zipf_theta > 0 && zipf_theta < 1 && stride >= 64 && stride % 64 == 0 &&
+               hot_fraction > 0 && hot_fraction <= 1 && hot_probability >= 0 && hot_probability <= 1;
+    }
+};
+
+/**
+ * @brief 開ループの負荷生成器
+ * @details 到着間隔・Read/Writeの別・64Bラインのアドレスを設定に従って生成する。
+ *          到着は処理の完了を待たずに決まるため、負荷が処理能力を超えると待ち時間がレイテンシに含まれる。
+ *          同じseedからは同じ系列を生成する。
+ */
+class LoadGenerator {
+public:
+    struct Request {
+        uint64_t delay; // 前の到着からの間隔 (サイクル)
+        bool is_write;
+        uint64_t addr;  // 64Bアラインされたアドレス
+    };
+
+    explicit LoadGenerator(const LoadConfig& config)
+        : m_config(config), m_rng(config.seed), m_lines(config.footprint / 64) {
+        if (m_config.distribution == LoadConfig::Distribution::ZIPFIAN) setupZipfian();
+    }
+
+    const LoadConfig& config() const { return m_config; }
+
+    Request next() {
+        Request req;
+        req.delay = nextDelay();
+        req.is_write = std::bernoulli_distribution(m_config.write_ratio)(m_rng);
+        req.addr = MemoryMap::PROTECTION_BASE_ADDR + nextLine() * 64;
+        m_issued++;
+        return req;
+    }
+
+private:
+    uint64_t nextDelay() {
+        if (m_config.arrival == LoadConfig::Arrival::FIXED) {
+            // 端数は累積して、平均が設定値になるようにする
+            m_arrival_clock += m_config.interval;
+        } else {
+            m_arrival_clock += std::exponential_distribution<double>(1.0 / std::max(m_config.interval, 1e-9))(m_rng);
+        }
+        uint64_t now = static_cast<uint64_t>(m_arrival_clock);
+        uint64_t delay = now - m_last_arrival;
+        m_last_arrival = now;
+        return delay;
+    }
+
+    uint64_t nextLine() {
+        switch (m_config.distribution) {
+            case LoadConfig::Distribution::UNIFORM:
+                return uniformLine(m_lines);
+            case LoadConfig::Distribution::ZIPFIAN:
+                return zipfianLine();
+            case LoadConfig::Distribution::SEQUENTIAL:
+                return m_issued % m_lines;
+            case LoadConfig::Distribution::STRIDED:
+                return (m_issued * (m_config.stride / 64)) % m_lines;
+            case LoadConfig::Distribution::HOTSET: {
+                uint64_t hot_lines = std::max<uint64_t>(1, static_cast<uint64_t>(m_lines * m_config.hot_fraction));
+                if (std::bernoulli_distribution(m_config.hot_probability)(m_rng)) return uniformLine(hot_lines);
+                return uniformLine(m_lines);
+            }
+        }
+        return 0;
+    }
+
+    uint64_t uniformLine(uint64_t lines) {
+        return std::uniform_int_distribution<uint64_t>(0, lines - 1)(m_rng);
+    }
+
+    // Gray et al. "Quickly Generating Billion-Record Synthetic Databases" の方法 (YCSBと同じ)
+    // 順位0のラインが最もよくアクセスされ、順位はラインの番号と一致する
+    void setupZipfian() {
+        double theta = m_config.zipf_theta;
+        m_zeta_n = 0;
+        for (uint64_t i = 1; i <= m_lines; ++i) m_zeta_n += 1.0 / std::pow(static_cast<double>(i), theta);
+        double zeta_2 = 1.0 + 1.0 / std::pow(2.0, theta);
+        m_zipf_alpha = 1.0 / (1.0 - theta);
+        m_zipf_eta = (1.0 - std::pow(2.0 / m_lines, 1.0 - theta)) / (1.0 - zeta_2 / m_zeta_n);
+    }
+    uint64_t zipfianLine() {
+        double theta = m_config.zipf_theta;
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(m_rng);
+        double uz = u * m_zeta_n;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta)) return std::min<uint64_t>(1, m_lines - 1);
+        uint64_t line = static_cast<uint64_t>(m_lines * std::pow(m_zipf_eta * u - m_zipf_eta + 1.0, m_zipf_alpha));
+        return std::min(line, m_lines - 1);
+    }
+
+    LoadConfig m_config;
+    std::mt19937_64 m_rng;
+    uint64_t m_lines;
+    uint64_t m_issued = 0;
+    double m_arrival_clock = 0;
+    uint64_t m_last_arrival = 0;
+    // ZIPFIAN用
+    double m_zeta_n = 0;
+    double m_zipf_alpha = 0;
+    double m_zipf_eta = 0;
+};
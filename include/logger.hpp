@@ -0,0 +1,187 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/**
+ * @brief コンパイル時にレベルとカテゴリを選択できるログ機構
+ * @details ログはSIM_LOG(カテゴリ, レベル, ストリーム式)で出力する。
+ *          レベル・カテゴリが無効な呼び出しは if constexpr で除去され、引数の評価も文字列整形も行われない。
+ *
+ *          コンパイル時の設定 (-Dで上書き可):
+ *          - SIM_LOG_LEVEL       : コンソールに出力する最大レベル (0:NONE 1:ERROR 2:WARN 3:INFO 4:DEBUG 5:TRACE、既定2)
+ *          - SIM_LOG_CATEGORIES  : 有効なカテゴリのビットマスク (bit順はLog::Category、既定は全て)
+ *          - SIM_LOG_RING_ENTRIES: リングバッファのエントリ数 (0で無効、既定0)
+ *          - SIM_LOG_RING_LEVEL  : リングバッファに記録する最大レベル (既定5)
+ *          - SIM_LOG_RING_FILE   : 終了時にリングバッファを書き出すファイル (既定 "sim_log_ring.bin")
+ *
+ *          リングバッファは固定長(128B)のバイナリレコードで直近のログを保持し、exit()時(検証失敗による中断を含む)に
+ *          古い順にファイルへ書き出す。コンソールへの出力を絞ったまま、中断直前の詳細なログを事後に確認できる。
+ */
+#ifndef SIM_LOG_LEVEL
+#define SIM_LOG_LEVEL 2
+#endif
+#ifndef SIM_LOG_CATEGORIES
+#define SIM_LOG_CATEGORIES 0xFFFFFFFFu
+#endif
+#ifndef SIM_LOG_RING_ENTRIES
+#define SIM_LOG_RING_ENTRIES 0
+#endif
+#ifndef SIM_LOG_RING_LEVEL
+#define SIM_LOG_RING_LEVEL 5
+#endif
+#ifndef SIM_LOG_RING_FILE
+#define SIM_LOG_RING_FILE "sim_log_ring.bin"
+#endif
+
+namespace Log {
+    enum class Level : int { NONE = 0, ERROR = 1, WARN = 2, INFO = 3, DEBUG = 4, TRACE = 5 };
+    enum class Category : uint32_t { SPM = 0, DMA, MAC, AES, AXIM, CORE, TB, DRAM, COUNT };
+
+    constexpr const char* categoryName(Category category) {
+        constexpr const char* names[] = {"SPM", "DMA", "MAC", "AES", "AXIM", "CORE", "TB", "DRAM"};
+        return static_cast<uint32_t>(category) < static_cast<uint32_t>(Category::COUNT) ? names[static_cast<uint32_t>(category)] : "?";
+    }
+    constexpr const char* levelName(Level level) {
+        constexpr const char* names[] = {"NONE", "ERROR", "WARN", "INFO", "DEBUG", "TRACE"};
+        return names[static_cast<int>(level)];
+    }
+
+    constexpr bool categoryEnabled(Category category) {
+        return ((SIM_LOG_CATEGORIES) >> static_cast<uint32_t>(category)) & 1u;
+    }
+    constexpr bool consoleEnabled(Category category, Level level) {
+        return level != Level::NONE && static_cast<int>(level) <= SIM_LOG_LEVEL && categoryEnabled(category);
+    }
+    constexpr bool ringEnabled(Category category, Level level) {
+        return SIM_LOG_RING_ENTRIES > 0 && level != Level::NONE && static_cast<int>(level) <= SIM_LOG_RING_LEVEL && categoryEnabled(category);
+    }
+    constexpr bool enabled(Category category, Level level) {
+        return consoleEnabled(category, level) || ringEnabled(category, level);
+    }
+
+    /**
+     * @brief リングバッファの1レコード (128B固定長)
+     * @details ファイルはヘッダ(RING_MAGIC 8B + レコード数 8B)の後に、古い順にレコードが並ぶ
+     */
+    struct RingRecord {
+        uint64_t seq;      // 通し番号
+        uint8_t category;  // Log::Category
+        uint8_t level;     // Log::Level
+        uint16_t length;   // textの有効バイト数
+        char text[116];    // メッセージ (超過分は切り捨て)
+    };
+    static_assert(sizeof(RingRecord) == 128, "ring record must stay 128 bytes");
+    constexpr char RING_MAGIC[8] = {'S', 'I', 'M', 'L', 'O', 'G', '1', '\0'};
+
+#if SIM_LOG_RING_ENTRIES > 0
+    class Ring {
+    public:
+        static Ring& instance() {
+            static Ring ring;
+            return ring;
+        }
+
+        void record(Category category, Level level, const std::string& text) {
+            RingRecord& r = m_records[m_next_seq % SIM_LOG_RING_ENTRIES];
+            r.seq = m_next_seq++;
+            r.category = static_cast<uint8_t>(category);
+            r.level = static_cast<uint8_t>(level);
+            r.length = static_cast<uint16_t>(std::min(text.size(), sizeof(r.text)));
+            std::memcpy(r.text, text.data(), r.length);
+        }
+
+        /**
+         * @brief 保持しているレコードを古い順にバイナリで書き出す
+         */
+        void dumpBinary(const char* path) const {
+            std::FILE* fp = std::fopen(path, "wb");
+            if (!fp) return;
+            uint64_t count = size();
+            std::fwrite(RING_MAGIC, 1, sizeof(RING_MAGIC), fp);
+            std::fwrite(&count, sizeof(count), 1, fp);
+            for (uint64_t seq = m_next_seq - count; seq < m_next_seq; ++seq) {
+                std::fwrite(&m_records[seq % SIM_LOG_RING_ENTRIES], sizeof(RingRecord), 1, fp);
+            }
+            std::fclose(fp);
+        }
+
+        /**
+         * @brief 保持しているレコードを古い順にテキストで出力する
+         */
+        void dumpText(std::ostream& os) const {
+            for (uint64_t seq = m_next_seq - size(); seq < m_next_seq; ++seq) {
+                const RingRecord& r = m_records[seq % SIM_LOG_RING_ENTRIES];
+                os << r.seq << " " << categoryName(static_cast<Category>(r.category)) << " "
+                   << levelName(static_cast<Level>(r.level)) << " " << std::string(r.text, r.length) << "\n";
+            }
+        }
+
+        uint64_t size() const {
+            return m_next_seq < SIM_LOG_RING_ENTRIES ? m_next_seq : SIM_LOG_RING_ENTRIES;
+        }
+
+    private:
+        Ring() {
+            std::atexit([] { Ring::instance().dumpBinary(SIM_LOG_RING_FILE); });
+        }
+
+        std::array<RingRecord, SIM_LOG_RING_ENTRIES> m_records{};
+        uint64_t m_next_seq = 0;
+    };
+#endif
+
+    /**
+     * @brief 整形済みのメッセージを有効なシンクに出力する (SIM_LOGから呼ばれる)
+     */
+    template <Category C, Level L>
+    void emit(const std::string& text) {
+        if constexpr (consoleEnabled(C, L)) {
+            (L == Level::ERROR ? std::cerr : std::cout) << text << "\n";
+        }
+#if SIM_LOG_RING_ENTRIES > 0
+        if constexpr (ringEnabled(C, L)) {
+            Ring::instance().record(C, L, text);
+        }
+#endif
+    }
+
+    /**
+     * @brief バイト列を16進数で並べて出力するためのラッパー (DMA・バッファのダンプ用)
+     */
+    struct HexBytes {
+        const uint8_t* data;
+        uint64_t size;
+    };
+    inline std::ostream& operator<<(std::ostream& os, const HexBytes& bytes) {
+        std::ios_base::fmtflags flags = os.flags();
+        os << std::hex;
+        for (uint64_t i = 0; i < bytes.size; ++i) os << static_cast<int>(bytes.data[i]) << " ";
+        os.flags(flags);
+        return os;
+    }
+    inline HexBytes hexBytes(const uint8_t* data, uint64_t size) {
+        return HexBytes{data, size};
+    }
+}
+
+/**
+ * @brief ログ出力マクロ
+ * @details 例: SIM_LOG(CORE, DEBUG, "[Core FW] Request Address: 0x" << std::hex << addr);
+ *          無効なレベル・カテゴリではメッセージ式ごと除去される。
+ */
+#define SIM_LOG(category, level, message)                                                              \
+    do {                                                                                               \
+        if constexpr (::Log::enabled(::Log::Category::category, ::Log::Level::level)) {                \
+            std::ostringstream sim_log_stream_;                                                        \
+            sim_log_stream_ << message;                                                                \
+            ::Log::emit<::Log::Category::category, ::Log::Level::level>(sim_log_stream_.str());        \
+        }                                                                                              \
+    } while (0)
@@ -1,23 +1,41 @@
 #pragma once
 #include <cstdint>
+#include "tree_geometry.hpp"
+
+namespace Parameter {
+    // 保護領域とカウンターツリーの形状 (分岐数, 保護領域サイズ, メジャーカウンター幅, マイナーカウンター幅)
+    // 例: 64分木なら <64, ..., 64, 6>、128分木なら <128, ..., 64, 3>
+    using Geometry = TreeGeometry<32, 64ULL << 20, 64, 8>;
+}
 
 namespace MemoryMap {
-    // 各コンポーネントのベースアドレス
+    // 各コンポーネントのベースアドレス (保護領域・データタグ・カウンターツリーはツリー形状から導出)
     constexpr uint64_t PROTECTION_BASE_ADDR = 0x00000000;
-    constexpr uint64_t PROTECTION_SIZE = 0x04000000; // 64MB
+    constexpr uint64_t PROTECTION_SIZE = Parameter::Geometry::PROTECTED_SIZE; // 既定64MB
     constexpr uint64_t DATA_TAG_BASE_ADDR = PROTECTION_BASE_ADDR + PROTECTION_SIZE; // 0x04000000
-    constexpr uint64_t DATA_TAG_SIZE = 1024 * 1024 * 8; // 8MB
+    constexpr uint64_t DATA_TAG_SIZE = Parameter::Geometry::DATA_TAG_SIZE; // 保護領域の1/8
     constexpr uint64_t COUNTER_BASE_ADDR = DATA_TAG_BASE_ADDR + DATA_TAG_SIZE; // 0x04800000
-    constexpr uint64_t COUNTER_SIZE = 1024 * 1024 * 4; // 4MB
+    constexpr uint64_t COUNTER_SIZE = Parameter::Geometry::TREE_SIZE;
 
 
-    constexpr uint64_t MMIO_SPM_DMA_BASE_ADDR   = 0x40000000;
-    constexpr uint64_t MMIO_MAC_BASE_ADDR = 0x40010000;
-    constexpr uint64_t MMIO_AES_ACCEL_BASE_ADDR  = 0x40020000;
-    constexpr uint64_t MMIO_AXI_MGR_BASE_ADDR   = 0x40030000;
+    // デバイス領域 (MMIOレジスタとSPM)。保護領域の配置と重ならないよう、64bitアドレスの高位に置く
+    // バスはこの領域をページ単位の表で引き、それ以外のアドレスは全てDRAMとして扱う
+    constexpr uint64_t DEVICE_BASE_ADDR = 0x1000000000ULL; // 64GB
+    constexpr uint64_t DEVICE_SIZE      = 0x00200000;      // 2MB
+    constexpr uint64_t MMIO_WINDOW_SIZE = 0x00010000;      // MMIOデバイス1つあたりの領域 (64KB)
+    constexpr uint64_t MMIO_SPM_DMA_BASE_ADDR   = DEVICE_BASE_ADDR + 0x00000;
+    constexpr uint64_t MMIO_MAC_BASE_ADDR = DEVICE_BASE_ADDR + 0x10000;
+    constexpr uint64_t MMIO_AES_ACCEL_BASE_ADDR  = DEVICE_BASE_ADDR + 0x20000;
+    constexpr uint64_t MMIO_AXI_MGR_BASE_ADDR   = DEVICE_BASE_ADDR + 0x30000;
+    constexpr uint64_t MMIO_PERF_BASE_ADDR      = DEVICE_BASE_ADDR + 0x40000;
     // constexpr uint64_t MMIO_BASE_ADDR            = MMIO_SPM_DMA_BASE_ADDR;
-    constexpr uint64_t SPM_BASE_ADDR        = 0x50000000;
+    constexpr uint64_t SPM_BASE_ADDR        = DEVICE_BASE_ADDR + 0x00100000;
     constexpr uint64_t SPM_SIZE               = 0x00001000; // 4KB
+    static_assert(COUNTER_BASE_ADDR + COUNTER_SIZE <= DEVICE_BASE_ADDR, "protected region layout overlaps the device window");
+    static_assert(SPM_BASE_ADDR + SPM_SIZE <= DEVICE_BASE_ADDR + DEVICE_SIZE, "SPM must be inside the device window");
+
+    // DRAMの容量 (保護領域・データタグ・カウンターツリーが収まる大きさ。既定768MB)
+    constexpr uint64_t DRAM_SIZE = COUNTER_BASE_ADDR + COUNTER_SIZE > (768ULL << 20) ? COUNTER_BASE_ADDR + COUNTER_SIZE : (768ULL << 20);
 
     // SpmDmaController用レジスタ・オフセット
     namespace SPM_Reg {
@@ -26,6 +44,15 @@ namespace MemoryMap {
         constexpr uint64_t SIZE      = 0x10;
         constexpr uint64_t DIRECTION = 0x18;
         constexpr uint64_t START     = 0x20;
+        // ディスクリプタリング (複数の転送をまとめて投入し、完了を待たずに次を投入できる)
+        constexpr uint64_t RING_PUSH   = 0x30; // W: DRAM_ADDR〜DIRECTIONの内容を1つのディスクリプタとして投入 (値は優先度 0: 通常, 1: 高)
+        constexpr uint64_t RING_STATUS = 0x38; // R: [7:0] 未完了のディスクリプタ数, [15:8] 次に投入するディスクリプタのスロット番号
+        constexpr uint64_t RING_DONE   = 0x40; // R: 完了ビットマップ (ビットi = スロットiの転送が完了。投入時にクリア)
+        // スキャッター・ギャザー (複数の64Bラインの転送を1つのコマンドでまとめて実行する)
+        constexpr uint64_t SG_START = 0x48; // W: SG_LISTの先頭から値の数のエントリを実行 / R: 1 = 実行中
+        constexpr uint64_t SG_LINES = 0x50; // R: 最後に完了したコマンドで転送したライン数
+        constexpr uint64_t RING_LAST_SLOT = 0x58; // R: 最後に投入したディスクリプタのスロット番号 (満杯で投入できなかった場合はリングのサイズ)
+        constexpr uint64_t SG_LIST  = 0x100; // エントリi: +16i DRAMラインのアドレス | 方向(bit0, 0: DRAM -> SPM, 1: SPM -> DRAM), +16i+8 SPMラインのアドレス
     }
 
     // HashAccelerator用レジスタ・オフセット
@@ -50,17 +77,154 @@ namespace MemoryMap {
         constexpr uint64_t START = 0x40;
     }
     namespace AxiManagerReg {
-        constexpr uint64_t STATUS = 0x00;
-        constexpr uint64_t REQ_ADDR = 0x08;
-        constexpr uint64_t REQ_ID = 0x10;
+        constexpr uint64_t STATUS = 0x00;   // R: 次に受け付けるリクエスト [0] あり, [1] Write, [15:8] タグ
+        constexpr uint64_t REQ_ADDR = 0x08; // R: 次に受け付けるリクエストのアドレス
+        constexpr uint64_t REQ_ID = 0x10;   // R: 次に受け付けるリクエストのタグ / W: タグのエントリを受け付け、以降のコマンドの対象にする
         constexpr uint64_t SPM_ADDR = 0x18;
         constexpr uint64_t COMMAND = 0x20;
         constexpr uint64_t BUSY = 0x28;
     }
+    // 性能カウンター用レジスタ・オフセット
+    namespace PerfReg {
+        constexpr uint64_t CONTROL = 0x00;       // W: 1で全カウンターを0に戻す / R: カウンター数
+        constexpr uint64_t EVENT = 0x08;         // W: 書き込んだ番号のカウンターを1増やす (ファームウェアのイベント用)
+        constexpr uint64_t COUNTER_BASE = 0x100; // カウンターiは COUNTER_BASE + i * 8 (R)
+    }
+    // 性能カウンターの番号 (ツリーの形状によらず番号が変わらないよう、階層ごとの枠は固定数とする)
+    namespace PerfCounter {
+        constexpr uint64_t MAX_TREE_LEVELS = 16;
+        constexpr uint64_t READ_REQUESTS = 0;       // 応答したReadリクエスト数
+        constexpr uint64_t WRITE_REQUESTS = 1;      // 応答したWriteリクエスト数
+        constexpr uint64_t READ_LATENCY_SUM = 2;    // Readの到着から応答までのサイクルの合計
+        constexpr uint64_t WRITE_LATENCY_SUM = 3;   // Writeの到着から応答までのサイクルの合計
+        constexpr uint64_t DMA_BYTES_TO_SPM = 4;    // SPM-DMAの転送バイト数 (DRAM -> SPM)
+        constexpr uint64_t DMA_BYTES_TO_DRAM = 5;   // SPM-DMAの転送バイト数 (SPM -> DRAM)
+        constexpr uint64_t MAC_UPDATE_BYTES = 6;    // MACのUPDATEで処理したバイト数
+        constexpr uint64_t AES_BLOCKS = 7;          // 暗号化した16Bブロック数
+        constexpr uint64_t OTP_FIFO_HIGH_WATER = 8; // OTP FIFOの最大段数 (16B単位)
+        constexpr uint64_t SPM_WRITEBACKS = 9;      // SPMキャッシュの追い出しに伴うDirtyブロックの書き戻し
+        constexpr uint64_t SPM_HIT_TAG = 10;        // SPMキャッシュのヒット/ミス: データタグ(MAC)ブロック
+        constexpr uint64_t SPM_MISS_TAG = 11;
+        constexpr uint64_t SPM_HIT_COUNTER = 12;    //   カウンターブロック (ツリーの最下位)
+        constexpr uint64_t SPM_MISS_COUNTER = 13;
+        constexpr uint64_t SPM_HIT_TREE = 14;       //   ツリーの階層i (0: 最上位) は SPM_HIT_TREE + 2i / SPM_MISS_TREE + 2i
+        constexpr uint64_t SPM_MISS_TREE = 15;
+        constexpr uint64_t READ_FORWARDED = SPM_HIT_TREE + 2 * MAX_TREE_LEVELS; // 応答していないWriteから転送したRead
+        constexpr uint64_t WRITES_COALESCED = READ_FORWARDED + 1; // 受け付け前のWriteにまとめたWrite
+        constexpr uint64_t COUNT = WRITES_COALESCED + 1;
+        static_assert(Parameter::Geometry::HEIGHT - 1 <= MAX_TREE_LEVELS, "too many tree levels for the performance counters");
+    }
+
+    // SPM管理領域の各ワード(8B/ライン)のビット定義
+    // | タグ(58bit) | 置換状態(3bit) | verified(1bit) | dirty(1bit) | valid(1bit) |
+    namespace SpmManage {
+        constexpr uint64_t VALID    = 1ULL << 0;
+        constexpr uint64_t DIRTY    = 1ULL << 1;
+        constexpr uint64_t VERIFIED = 1ULL << 2; // ツリー検証済み(オンチップで信頼できる)
+        constexpr uint64_t REPL_SHIFT = 3;     // LRU: 経過順位 / RRIP: 再参照予測値
+        constexpr uint64_t REPL_MASK  = 0x7ULL << REPL_SHIFT;
+    }
 }
 
 namespace Parameter {
-    constexpr uint64_t BLOCK_SIZE = 64;
-    constexpr uint64_t HEIGHT = 4; // ツリーの高さ
-    constexpr uint64_t BLOCKS_PER_LINE = 32; // 1カウンターラインあたりのカウンター数(=分岐数)
+    constexpr uint64_t BLOCK_SIZE = Geometry::LINE_SIZE;
+    constexpr uint64_t HEIGHT = Geometry::HEIGHT; // ツリーの高さ
+    constexpr uint64_t BLOCKS_PER_LINE = Geometry::ARITY; // 1カウンターラインあたりのカウンター数(=分岐数)
+
+    // --- SPMメタデータキャッシュ ---
+    // 0ライン目: ルート, 1ライン目: 暗号文, 2ライン目以降: 常駐ツリーノード, 書き戻し用ステージング, メタデータキャッシュ,
+    // 56-63ライン目: 管理領域(タグ配列)
+    // カウンター・データタグ・常駐しないツリーノードは全てこのキャッシュを共有する
+    enum class SpmReplacement { LRU, RRIP };
+    constexpr uint64_t SPM_LINES = MemoryMap::SPM_SIZE / BLOCK_SIZE; // 64
+    constexpr uint64_t SPM_ROOT_LINE = 0;
+    constexpr uint64_t SPM_DATA_LINE = 1;
+    constexpr uint64_t SPM_MANAGE_LINE = 56; // 管理領域の先頭ライン
+
+    // --- 上位階層のSPM常駐 ---
+    // ツリーの上位SPM_PINNED_LEVELS階層は起動時に検証してSPMに常駐させ、追い出さない
+    constexpr uint64_t SPM_PINNED_FIRST_LINE = 2;
+    // 上位levels階層のノード数の合計
+    constexpr uint64_t pinnedLineCount(uint64_t levels) {
+        uint64_t lines = 0;
+        for (uint64_t i = 0; i < levels; ++i) lines += Geometry::levelNodes(i);
+        return lines;
+    }
+    // 既定では、常駐させてもメタデータキャッシュに最小構成で2セット以上残る最大の階層数を選ぶ
+    // (32分木・64MBでは2: 階層1-2の33ライン)
+    constexpr uint64_t defaultPinnedLevels() {
+        uint64_t levels = 0;
+        while (levels + 1 < HEIGHT) {
+            uint64_t next = levels + 1;
+            uint64_t staging = HEIGHT - next - 1;
+            uint64_t min_ways = HEIGHT - next + 1;
+            if (SPM_PINNED_FIRST_LINE + pinnedLineCount(next) + staging + 2 * min_ways > SPM_MANAGE_LINE) break;
+            levels = next;
+        }
+        return levels;
+    }
+    constexpr uint64_t SPM_PINNED_LEVELS = defaultPinnedLevels(); // 0: 常駐なし, 1: 階層1のみ, 2: 階層1-2, ...
+    constexpr uint64_t SPM_PINNED_LINES = pinnedLineCount(SPM_PINNED_LEVELS);
+
+    // --- ツリー更新方式 ---
+    // EAGER: 書き込みごとにパス上の全階層のカウンターをインクリメントし、MACを再計算する
+    // LAZY:  書き込みではリーフ(カウンターブロック)のカウンターのみ更新し、
+    //        Dirtyなツリーノードが追い出される時に親のカウンター更新とMAC再計算を行う
+    enum class TreeUpdate { EAGER, LAZY };
+    constexpr TreeUpdate SPM_TREE_UPDATE = TreeUpdate::EAGER;
+    // 遅延更新の書き戻し時、SPMキャッシュに無い祖先(常駐階層とリーフの間)を一時的に置くライン
+    constexpr uint64_t SPM_STAGING_FIRST_LINE = SPM_PINNED_FIRST_LINE + SPM_PINNED_LINES;
+    constexpr uint64_t SPM_STAGING_LINES = SPM_TREE_UPDATE == TreeUpdate::LAZY ? HEIGHT - SPM_PINNED_LEVELS - 1 : 0;
+    constexpr uint64_t SPM_CACHE_FIRST_LINE = SPM_STAGING_FIRST_LINE + SPM_STAGING_LINES;
+    static_assert(SPM_PINNED_LEVELS < HEIGHT, "leaf counter level cannot be pinned");
+    static_assert(SPM_CACHE_FIRST_LINE < SPM_MANAGE_LINE, "pinned tree levels and staging lines do not fit in SPM");
+
+    constexpr uint64_t SPM_CACHE_WAYS = HEIGHT - SPM_PINNED_LEVELS + 1 > 6 ? HEIGHT - SPM_PINNED_LEVELS + 1 : 6; // 連想度 (既定6)
+    constexpr uint64_t SPM_CACHE_SETS = (SPM_MANAGE_LINE - SPM_CACHE_FIRST_LINE) / SPM_CACHE_WAYS;
+    constexpr SpmReplacement SPM_CACHE_POLICY = SpmReplacement::LRU;
+    constexpr uint64_t SPM_RRIP_MAX = 3;    // 2bit RRPV
+    constexpr uint64_t SPM_RRIP_INSERT = 2; // SRRIP: 挿入時は「遠い再参照」と予測
+
+    // 1リクエストは最大で常駐しないツリー階層 + データタグのラインを同時に使うため、それ以上のウェイが必要
+    static_assert(SPM_CACHE_WAYS >= HEIGHT - SPM_PINNED_LEVELS + 1, "SPM cache needs at least one way per unpinned level plus the data tag");
+    // LRUの経過順位は管理ワードの3bitに格納する
+    static_assert(SPM_CACHE_WAYS <= 8, "SPM cache supports up to 8 ways");
+    static_assert(SPM_CACHE_SETS > 0, "SPM cache has no sets");
+
+    // --- タイミングモデル (サイクル) ---
+    // 各モジュールはコマンドを受け付けてから以下で求まる処理時間後に、完了イベントでBUSY/STATUSをクリアする
+    constexpr uint64_t DRAM_ACCESS_CYCLES = 100;   // DRAMアクセスのレイテンシ (1回の転送につき1回)
+    constexpr uint64_t DMA_SETUP_CYCLES = 16;      // SPM-DMAの起動
+    constexpr uint64_t DMA_BYTES_PER_CYCLE = 8;    // SPM-DMAの転送帯域 (転送時間 = サイズ / 帯域)
+    constexpr uint64_t SPM_DMA_RING_SIZE = 8;      // SPM-DMAのディスクリプタリングのスロット数
+    constexpr uint64_t SPM_DMA_SG_ENTRIES = 16;    // SPM-DMAのスキャッター・ギャザーの最大エントリ数
+    constexpr uint64_t MAC_COPY_CYCLES = 8;        // SPMからHashモジュールの内部バッファへの64Bコピー
+    constexpr uint64_t MAC_COMMAND_CYCLES = 4;     // INIT/UPDATE/DIGESTコマンドの固定コスト
+    constexpr uint64_t MAC_CYCLES_PER_BYTE = 1;    // UPDATEで処理する1バイトあたり
+    constexpr uint64_t AES_PIPELINE_DEPTH = 20;    // 1ブロック目のOTPが出るまで
+    constexpr uint64_t AES_CYCLES_PER_BLOCK = 4;   // 2ブロック目以降の16Bブロックの投入間隔
+    constexpr uint64_t AXIM_COMMAND_CYCLES = 4;    // バッファ操作・LLCへの応答
+    constexpr uint64_t AXIM_REQUEST_SLOTS = 16;    // AXI Managerのリクエストテーブルのエントリ数 (タグは8bit)
+    constexpr uint64_t AXIM_OTP_FIFO_DEPTH = 16;    // AXI ManagerのOTP FIFOの段数 (16B単位)
+    constexpr uint64_t AXIM_MAX_OUTSTANDING = 4096; // LLCから受け付けて、応答を取り出していないリクエストの上限 (リクエストスロット数)
+    constexpr uint64_t AXIM_INGRESS_DEPTH = 1024;   // 複数スレッドからの受付キュー(AxiIngress)の段数
+    constexpr uint64_t AXIM_PORT_OUTSTANDING = 256; // AxiIngressの1ポート(ホストスレッド)が応答を待てるリクエスト数
+    constexpr uint64_t AXIM_WRITE_HIGH_WATERMARK = 12; // READ_FIRST: 受け付け待ちのWriteがこの数以上でWriteを続けて処理する
+    constexpr uint64_t AXIM_WRITE_LOW_WATERMARK = 4;   //   この数以下に減ったらReadの優先に戻る
+    constexpr uint64_t AXIM_WRITE_MAX_AGE = 16384;     //   到着からこのサイクル数以上待ったWriteはReadより先に選ぶ
+    constexpr uint64_t MMIO_ACCESS_CYCLES = 4;     // コアからのMMIOレジスタへの1アクセス (バーストも1回)
+    constexpr uint64_t SPM_ACCESS_CYCLES = 1;      // コアからのSPMへの1アクセス (バーストも1回)
+
+    // size バイトのDMA転送の処理時間
+    constexpr uint64_t dmaCycles(uint64_t size) {
+        return DMA_SETUP_CYCLES + DRAM_ACCESS_CYCLES + (size + DMA_BYTES_PER_CYCLE - 1) / DMA_BYTES_PER_CYCLE;
+    }
+    // size バイトのDMA転送がチャネルを占有する時間 (次の転送はこの後に開始でき、DRAMのレイテンシは重なる)
+    constexpr uint64_t dmaIssueCycles(uint64_t size) {
+        return DMA_SETUP_CYCLES + (size + DMA_BYTES_PER_CYCLE - 1) / DMA_BYTES_PER_CYCLE;
+    }
+    // blocks 個の16BブロックのOTP生成の処理時間 (パイプライン処理)
+    constexpr uint64_t aesCycles(uint64_t blocks) {
+        return blocks == 0 ? 0 : AES_PIPELINE_DEPTH + (blocks - 1) * AES_CYCLES_PER_BLOCK;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * @brief 容量固定のロックフリーなリングバッファ (複数の生産者・1つの消費者)
+ * @details 要素ごとに通し番号を持つ有界キュー。生産者は末尾の位置をCASで確保してから要素を書き込み、
+ *          通し番号を更新して消費者に公開する。満杯の時のtryPushはfalseを返す(生産者が空きを待つ)。
+ *          tryPopは1つのスレッドからのみ呼ぶ。生産者が1つの場合はSPSCのキューとして使える。
+ *          容量は2の冪に切り上げる。
+ */
+template <class T>
+class MpscRing {
+public:
+    explicit MpscRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        m_mask = size - 1;
+        m_cells = std::make_unique<Cell[]>(size);
+        for (size_t i = 0; i < size; ++i) m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // 生産者 (任意のスレッド)
+    bool tryPush(const T& value) {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                // この位置が空いている: 確保できたら書き込む (失敗時はposが最新の末尾になる)
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false; // 満杯 (消費者がまだ取り出していない)
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed); // 他の生産者が先に確保した
+            }
+        }
+        cell->value = value;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 消費者 (1つのスレッド)
+    bool tryPop(T& value) {
+        Cell& cell = m_cells[m_head & m_mask];
+        if (cell.seq.load(std::memory_order_acquire) != m_head + 1) return false; // 空、または書き込み中
+        value = std::move(cell.value);
+        cell.seq.store(m_head + m_mask + 1, std::memory_order_release); // 1周後の生産者に空ける
+        m_head++;
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq{0}; // pos: 空き(生産者がposに書ける), pos + 1: 書き込み済み(消費者が取り出せる)
+        T value{};
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask = 0;
+    alignas(64) std::atomic<size_t> m_tail{0}; // 生産者が共有する (消費者側と別のキャッシュラインに置く)
+    alignas(64) size_t m_head = 0;             // 消費者のみが使う
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include "memory_map.hpp"
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/**
+ * @brief 性能カウンターのMMIOブロック
+ * @details 64bitのカウンター(番号はMemoryMap::PerfCounter)を持ち、各モジュールがイベントごとに加算する。
+ *          ファームウェアはCOUNTER_BASE + i * 8から読み出し、CONTROLに1を書き込んで全て0に戻す。
+ *          カウンターの加算はハードウェアの配線に相当し、シミュレーション時刻は進めない。
+ *          実行の最後にwriteJsonで書き出し、ファームウェアの変更とメタデータのトラフィックを対応付ける。
+ */
+class PerfCounters {
+public:
+    void add(uint64_t counter, uint64_t value = 1) {
+        m_counters[counter] += value;
+    }
+
+    // 最大値を記録するカウンター (OTP FIFOの段数など)
+    void recordMax(uint64_t counter, uint64_t value) {
+        if (value > m_counters[counter]) m_counters[counter] = value;
+    }
+
+    uint64_t get(uint64_t counter) const { return m_counters[counter]; }
+
+    void reset() { m_counters.fill(0); }
+
+    /**
+     * @brief 64bitのMMIO書き込みを処理
+     */
+    void mmioWrite64(uint64_t offset, uint64_t value) {
+        if (offset == MemoryMap::PerfReg::CONTROL) {
+            if (value & 1) reset();
+        } else if (offset == MemoryMap::PerfReg::EVENT) {
+            if (value < MemoryMap::PerfCounter::COUNT) add(value);
+        }
+    }
+
+    /**
+     * @brief 64bitのMMIO読み出しを処理
+     */
+    uint64_t mmioRead64(uint64_t offset) {
+        if (offset == MemoryMap::PerfReg::CONTROL) return MemoryMap::PerfCounter::COUNT;
+        if (offset >= MemoryMap::PerfReg::COUNTER_BASE && offset % 8 == 0) {
+            uint64_t index = (offset - MemoryMap::PerfReg::COUNTER_BASE) / 8;
+            if (index < MemoryMap::PerfCounter::COUNT) return m_counters[index];
+        }
+        return 0;
+    }
+
+    /**
+     * @brief カウンター名 (JSONのキー)。ツリーの階層は1始まりで表す
+     */
+    static std::string counterName(uint64_t counter) {
+        using namespace MemoryMap::PerfCounter;
+        static const char* const names[] = {
+            "read_requests", "write_requests", "read_latency_sum", "write_latency_sum",
+            "dma_bytes_to_spm", "dma_bytes_to_dram", "mac_update_bytes", "aes_blocks",
+            "otp_fifo_high_water", "spm_writebacks", "spm_hit_tag", "spm_miss_tag",
+            "spm_hit_counter", "spm_miss_counter",
+        };
+        if (counter < SPM_HIT_TREE) return names[counter];
+        if (counter == READ_FORWARDED) return "axim_read_forwarded";
+        if (counter == WRITES_COALESCED) return "axim_writes_coalesced";
+        uint64_t level = (counter - SPM_HIT_TREE) / 2 + 1;
+        return std::string((counter - SPM_HIT_TREE) % 2 == 0 ? "spm_hit_tree_level" : "spm_miss_tree_level") + std::to_string(level);
+    }
+
+    /**
+     * @brief 全カウンターと主な比率をJSONで書き出す
+     * @details ツリーの階層は、カウンターブロックを除く実在する階層(1〜HEIGHT-1)のみ出力する。
+     *          crypto_passes_savedは、AXI Managerの転送・まとめで省いた認証・検証の回数
+     */
+    void writeJson(std::ostream& os) const {
+        using namespace MemoryMap::PerfCounter;
+        const uint64_t tree_levels = Parameter::Geometry::HEIGHT - 1;
+        os << "{\n  \"counters\": {\n";
+        bool first = true;
+        for (uint64_t i = 0; i < SPM_HIT_TREE + 2 * tree_levels; ++i) {
+            os << (first ? "" : ",\n") << "    \"" << counterName(i) << "\": " << m_counters[i];
+            first = false;
+        }
+        for (uint64_t i = READ_FORWARDED; i < COUNT; ++i) os << ",\n    \"" << counterName(i) << "\": " << m_counters[i];
+        uint64_t hits = m_counters[SPM_HIT_TAG] + m_counters[SPM_HIT_COUNTER];
+        uint64_t misses = m_counters[SPM_MISS_TAG] + m_counters[SPM_MISS_COUNTER];
+        for (uint64_t level = 0; level < tree_levels; ++level) {
+            hits += m_counters[SPM_HIT_TREE + 2 * level];
+            misses += m_counters[SPM_MISS_TREE + 2 * level];
+        }
+        uint64_t requests = m_counters[READ_REQUESTS] + m_counters[WRITE_REQUESTS];
+        os << "\n  },\n  \"derived\": {\n"
+           << "    \"spm_hit_rate\": " << ratio(hits, hits + misses) << ",\n"
+           << "    \"read_latency_avg\": " << ratio(m_counters[READ_LATENCY_SUM], m_counters[READ_REQUESTS]) << ",\n"
+           << "    \"write_latency_avg\": " << ratio(m_counters[WRITE_LATENCY_SUM], m_counters[WRITE_REQUESTS]) << ",\n"
+           << "    \"dma_bytes_per_request\": " << ratio(m_counters[DMA_BYTES_TO_SPM] + m_counters[DMA_BYTES_TO_DRAM], requests) << ",\n"
+           << "    \"crypto_passes_saved\": " << m_counters[READ_FORWARDED] + m_counters[WRITES_COALESCED] << "\n"
+           << "  }\n}\n";
+    }
+
+private:
+    static double ratio(uint64_t numerator, uint64_t denominator) {
+        return denominator ? static_cast<double>(numerator) / denominator : 0.0;
+    }
+
+    std::array<uint64_t, MemoryMap::PerfCounter::COUNT> m_counters{};
+};
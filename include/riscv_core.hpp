@@ -1,7 +1,17 @@
 #pragma once
 #include "bus.hpp"
 #include "memory_map.hpp"
+#include "logger.hpp"
+#include "event_scheduler.hpp"
+#include "perf_counters.hpp"
+#include "traffic_stats.hpp"
+#include "timeline_trace.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <string_view>
 #include <vector>
 
 class RiscVCore {
@@ -9,95 +19,514 @@ public:
     /**
      * @brief コンストラクタ
      * @param bus コアがアクセスするシステムバスへの参照
+     * @param scheduler 待ち合わせ中に処理を進めるイベントスケジューラ
      */
-    RiscVCore(Bus& bus) : m_bus(bus) {}
+    RiscVCore(Bus& bus, EventScheduler& scheduler) : m_bus(bus), m_scheduler(scheduler) {}
+
+    // 1リクエストの処理の段階 (処理時間の内訳の集計単位)
+    enum class Phase { TREE_VERIFY, COUNTER_UPDATE, OTP, DATA_LOAD, MAC, WRITEBACK, COUNT };
+    static constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::COUNT);
+    static constexpr const char* phaseName(Phase phase) {
+        constexpr const char* names[] = {"tree verify", "counter update", "OTP", "data load", "MAC", "writeback"};
+        return names[static_cast<size_t>(phase)];
+    }
+    /**
+     * @brief 1リクエストの処理時間の内訳 (サイクル)
+     * @details リクエストを検出してから応答コマンドを発行するまでを、ファームウェアの段階ごとに集計する。
+     *          キャッシュの追い出しに伴う書き戻しは、それが発生した段階に含まれる。
+     */
+    struct RequestProfile {
+        bool is_write = false;
+        std::array<uint64_t, PHASE_COUNT> cycles{};
+    };
+    /**
+     * @brief 直前に処理したリクエストの処理時間の内訳
+     */
+    const RequestProfile& lastProfile() const { return m_profile; }
+    /**
+     * @brief SPMキャッシュ(カウンター・MAC・ツリーノード)のヒット・ミスの累計
+     * @details ensureBlockInSpmでの参照を数える。evictionsはDirtyなブロックの書き戻し回数
+     */
+    struct SpmCacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+    const SpmCacheStats& spmCacheStats() const { return m_cache_stats; }
+    /**
+     * @brief 性能カウンターを接続する
+     * @details ファームウェアのイベント(SPMキャッシュのヒット・ミス、書き戻し)を数える。
+     *          PerfReg::EVENTへの書き込みに相当するが、計測がタイミングに影響しないようバスを経由せずに加算する
+     */
+    void attachPerfCounters(PerfCounters& perf) { m_perf = &perf; }
+    /**
+     * @brief DRAMトラフィックの集計を接続する。リクエストの処理中のアクセスをそのリクエストの種類に数えさせる
+     */
+    void attachTrafficStats(TrafficStats& traffic) { m_traffic = &traffic; }
+    /**
+     * @brief タイムラインを接続する。リクエスト・処理の段階・ファームウェアの各ステップを区間として記録する
+     */
+    void attachTimeline(TimelineTrace& timeline) { m_timeline = &timeline; }
 
     /**
      * @brief コアのメインループ。外部からのリクエストを待って処理を開始する。
      */
     void runMainLoop() {
-        std::cout << "[Core] Started. Polling for requests from AXI Manager...\n";
-        // AXI ManagerのSTATUSレジスタをポーリングし、リクエストがキューに入るのを待つ
-        while ((m_bus.read64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::STATUS) & 1) == 0) {}
-        std::cout << "[Core] Request detected in AXI Manager's queue.\n";
+        SIM_LOG(CORE, DEBUG, "[Core] Started. Polling for requests from AXI Manager...");
+        // AXI ManagerのSTATUSレジスタを確認し、リクエストがキューに入るのを待つ
+        uint64_t status = 0;
+        waitUntil([this, &status] {
+            status = m_bus.read64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::STATUS);
+            return (status & 1) != 0;
+        });
+        SIM_LOG(CORE, DEBUG, "[Core] Request detected in AXI Manager's queue (tag " << ((status >> 8) & 0xff) << ").");
         
         // リクエストを処理するアルゴリズムを実行
-        if (m_bus.read64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::STATUS) & 2) {
-            runAuthentication();
-        } else {
-            runVerification();
+        m_profile = RequestProfile{};
+        m_phase = Phase::TREE_VERIFY;
+        m_phase_start = m_scheduler.now();
+        m_profile.is_write = (status & 2) != 0;
+        // アドレスを読んでからリクエストを受け付ける (以降のAXI Managerのコマンドはこのリクエストのバッファに作用する)
+        m_request_addr = m_bus.read64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::REQ_ADDR);
+        m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::REQ_ID, (status >> 8) & 0xff);
+        if (m_traffic) m_traffic->beginRequest(m_profile.is_write);
+        if (m_timeline) m_timeline->beginRequest();
+        {
+            TimelineTrace::Scope request(m_timeline, TimelineTrace::Track::REQUEST, m_profile.is_write ? "write" : "read");
+            if (m_profile.is_write) {
+                runAuthentication();
+            } else {
+                runVerification();
+            }
+            enterPhase(m_phase); // 最後の段階の時間を集計する
+        }
+        if (m_traffic) m_traffic->endRequest();
+    }
+
+    /**
+     * @brief 起動時処理。ツリーの上位階層をSPMの専用ラインにロード・検証して常駐させる
+     * @details 常駐したノードは追い出されず、以降の検証・更新ではオンチップの信頼できる状態として扱う
+     */
+    void boot() {
+        SIM_LOG(CORE, INFO, "[Core FW] Boot: pinning top " << Parameter::SPM_PINNED_LEVELS << " tree levels in SPM.");
+        for (uint64_t i = 0; i < Parameter::SPM_PINNED_LEVELS; ++i) {
+            for (uint64_t node = 0; node < Geometry::levelNodes(i); ++node) {
+                uint64_t dram_addr = treeNodeAddr(i, node * Geometry::ARITY);
+                uint64_t spm_addr = pinnedNodeAddr(i, node * Geometry::ARITY);
+                startSpmDma(dram_addr, spm_addr, 64, 0); // 0: DRAM -> SPM
+                pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
+                // 一度も書き込まれていないノードは検証しない
+                uint64_t parent_spm_addr = i == 0 ? spmLineAddr(Parameter::SPM_ROOT_LINE) : pinnedNodeAddr(i - 1, node);
+                if (!isNeverWrittenNode(spm_addr, i, parent_spm_addr, node)) {
+                    uint64_t computed_mac = computeNodeMac(spm_addr, i, parent_spm_addr, node);
+                    if (computed_mac != m_bus.read64(spm_addr + 56)) {
+                        SIM_LOG(CORE, ERROR, "[Core FW] Boot: verification of pinned level " << i + 1 << " node " << node << " failed. Aborting.");
+                        exit(1);
+                    }
+                }
+                m_bus.write64(manageAddrOf(spm_addr), dram_addr | MemoryMap::SpmManage::VALID | MemoryMap::SpmManage::VERIFIED);
+            }
         }
     }
 
 private:
     // --- 1. アドレス計算をまとめるための構造体とメソッド ---
-    std::array<uint64_t, 4> level_base_addr = {
-    (1ULL << (5 *3)) * 64 + (1ULL << (5 *2)) * 64 + (1ULL << (5 *1)) * 64, // height 1
-    (1ULL << (5 *3)) * 64 + (1ULL << (5 *2)) * 64 , // height 2
-    (1ULL << (5 *3)) * 64, // height 3
-    0, // height 4
+    // ツリーの形状(分岐数・高さ・各階層の配置・カウンター幅)は全てParameter::Geometryから導出する
+    using Geometry = Parameter::Geometry;
+    using PathIndices = std::array<uint64_t, Parameter::HEIGHT>;
+    // スキャッター・ギャザーで転送するラインのリスト (SPM-DMAのSG_LISTと同じ形式)
+    struct GatherList {
+        std::array<uint64_t, 2 * Parameter::SPM_DMA_SG_ENTRIES> words{};
+        uint64_t count = 0;
+        void add(uint64_t dram_addr, uint64_t spm_addr, uint64_t direction) {
+            words[2 * count] = dram_addr | direction;
+            words[2 * count + 1] = spm_addr;
+            ++count;
+        }
     };
     struct AddressContext {
         uint64_t request_addr;
         uint64_t counterblock_addr, datamacblock_addr;
         uint64_t counter_bit_offset, dmac_byte_offset;
         uint64_t spm_data, spm_mac_block, spm_counter_block;
-        uint64_t spm_counter_manage, spm_mac_manage;
     };
 
     AddressContext setupAddressContext() {
         AddressContext ctx;
-        ctx.request_addr = m_bus.read64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::REQ_ADDR);
+        ctx.request_addr = m_request_addr;
         // DRAMアドレス
-        ctx.counterblock_addr = MemoryMap::COUNTER_BASE_ADDR + ((ctx.request_addr / (64 * 32))) * 64;
-        ctx.datamacblock_addr = MemoryMap::DATA_TAG_BASE_ADDR + ((ctx.request_addr / (64 * 8))) * 64;
+        ctx.counterblock_addr = MemoryMap::COUNTER_BASE_ADDR + ((ctx.request_addr / (64 * Geometry::ARITY))) * 64;
+        ctx.datamacblock_addr = MemoryMap::DATA_TAG_BASE_ADDR + ((ctx.request_addr / (64 * Geometry::TAGS_PER_LINE))) * 64;
         // オフセット
-        ctx.counter_bit_offset = 64 + (ctx.request_addr / 64) % 32 * 8;
-        ctx.dmac_byte_offset = (ctx.request_addr / 64) % 8 * 8;
+        ctx.counter_bit_offset = Geometry::minorBit(ctx.request_addr / 64);
+        ctx.dmac_byte_offset = (ctx.request_addr / 64) % Geometry::TAGS_PER_LINE * 8;
 
-        // SPMアドレス
-        ctx.spm_data = MemoryMap::SPM_BASE_ADDR + 0x040;
-        ctx.spm_mac_block = MemoryMap::SPM_BASE_ADDR + 0x080;
-        ctx.spm_counter_block = MemoryMap::SPM_BASE_ADDR + 0x0C0;
-        ctx.spm_mac_manage = MemoryMap::SPM_BASE_ADDR + 56 * 64 + 1*8;
-        ctx.spm_counter_manage = MemoryMap::SPM_BASE_ADDR + 56 * 64 + 3*8;
+        // SPMアドレス (カウンター・MACブロックはキャッシュ上の位置が決まった時点で設定する)
+        ctx.spm_data = spmLineAddr(Parameter::SPM_DATA_LINE);
+        ctx.spm_mac_block = 0;
+        ctx.spm_counter_block = 0;
         return ctx;
     }
-    // --- 2. SPMキャッシュ管理ロジックを共通化 ---
+    /**
+     * @brief リクエストアドレスから各階層のパスインデックスを求める (先頭は階層1)
+     * @details path_index[i]は階層iのエントリ番号。階層iのノードはpath_index[i] / ARITY番目で、
+     *          その中のpath_index[i] % ARITY番目のカウンターがパス上の子に対応する
+     */
+    static PathIndices pathIndices(uint64_t request_addr) {
+        PathIndices path_index;
+        for (uint64_t i = 0; i < Parameter::HEIGHT; ++i) {
+            path_index[i] = request_addr / 64 / Geometry::entrySpan(i);
+        }
+        return path_index;
+    }
+    /**
+     * @brief ツリーの階層i(0: 最上位)でpath_indexを含むノードのDRAMアドレスを返す
+     */
+    static constexpr uint64_t treeNodeAddr(uint64_t i, uint64_t path_index) {
+        return MemoryMap::COUNTER_BASE_ADDR + path_index / Geometry::ARITY * 64 + Geometry::levelBase(i);
+    }
+    /**
+     * @brief 階層iがSPMに常駐する階層かどうか
+     */
+    static constexpr bool isPinnedLevel(uint64_t i) {
+        return i < Parameter::SPM_PINNED_LEVELS;
+    }
+    /**
+     * @brief 常駐階層iでpath_indexを含むノードを格納するSPMアドレスを返す
+     */
+    static constexpr uint64_t pinnedNodeAddr(uint64_t i, uint64_t path_index) {
+        return spmLineAddr(Parameter::SPM_PINNED_FIRST_LINE + Parameter::pinnedLineCount(i) + path_index / Geometry::ARITY);
+    }
+    /**
+     * @brief 遅延更新の書き戻し時に階層iのノードを一時的に置くSPMアドレスを返す
+     */
+    static constexpr uint64_t stagingNodeAddr(uint64_t i) {
+        return spmLineAddr(Parameter::SPM_STAGING_FIRST_LINE + i - Parameter::SPM_PINNED_LEVELS);
+    }
+    /**
+     * @brief DRAMアドレスがツリーノード(カウンターブロックを含む)を指すかどうか
+     */
+    static constexpr bool isTreeNodeAddr(uint64_t addr) {
+        return addr >= MemoryMap::COUNTER_BASE_ADDR && addr < MemoryMap::COUNTER_BASE_ADDR + Geometry::TREE_SIZE;
+    }
+    /**
+     * @brief ツリーノードのDRAMアドレスから階層(0: 最上位)を求める
+     */
+    static constexpr uint64_t treeLevelOf(uint64_t addr) {
+        uint64_t offset = addr - MemoryMap::COUNTER_BASE_ADDR;
+        uint64_t i = 0;
+        while (offset < Geometry::levelBase(i)) ++i;
+        return i;
+    }
+    // --- 2. SPMメタデータキャッシュ ---
+    // 56ラインのうちルートと暗号文を除くラインをセットアソシアティブキャッシュとして使い、
+    // 管理領域の各ワードをタグ配列として扱う。
+    using CacheSetInfo = std::array<uint64_t, Parameter::SPM_CACHE_WAYS>;
+
+    static constexpr uint64_t spmLineAddr(uint64_t line) {
+        return MemoryMap::SPM_BASE_ADDR + line * 64;
+    }
+    static constexpr uint64_t spmManageAddr(uint64_t line) {
+        return MemoryMap::SPM_BASE_ADDR + Parameter::SPM_MANAGE_LINE * 64 + line * 8;
+    }
+    static constexpr uint64_t manageAddrOf(uint64_t spm_addr) {
+        return spmManageAddr((spm_addr - MemoryMap::SPM_BASE_ADDR) / 64);
+    }
+    static constexpr uint64_t cacheLine(uint64_t set, uint64_t way) {
+        return Parameter::SPM_CACHE_FIRST_LINE + set * Parameter::SPM_CACHE_WAYS + way;
+    }
+    static constexpr uint64_t replState(uint64_t info) {
+        return (info & MemoryMap::SpmManage::REPL_MASK) >> MemoryMap::SpmManage::REPL_SHIFT;
+    }
+    static constexpr uint64_t withReplState(uint64_t info, uint64_t state) {
+        return (info & ~MemoryMap::SpmManage::REPL_MASK) | (state << MemoryMap::SpmManage::REPL_SHIFT);
+    }
+    static constexpr bool isValidTag(uint64_t info, uint64_t block_addr) {
+        return (info & MemoryMap::SpmManage::VALID) && ((info >> 6) << 6) == block_addr;
+    }
+
+    /**
+     * @brief 新しいリクエストの処理開始時に呼び、使用中ラインの記録をクリアする
+     */
+    void beginRequest() { m_request_lines = 0; }
+    /**
+     * @brief 現在の段階の経過時間を集計し、次の段階に移る
+     */
+    void enterPhase(Phase next) {
+        m_profile.cycles[static_cast<size_t>(m_phase)] += m_scheduler.now() - m_phase_start;
+        if (m_timeline && m_scheduler.now() > m_phase_start) {
+            m_timeline->complete(TimelineTrace::Track::PHASE, phaseName(m_phase), m_phase_start, m_scheduler.now());
+        }
+        m_phase = next;
+        m_phase_start = m_scheduler.now();
+    }
+    /**
+     * @brief 現在のリクエストで使用中のラインを記録する (処理中に追い出されないようにする)
+     */
+    void markLineInUse(uint64_t line) { m_request_lines |= (1ULL << line); }
+    bool isLineInUse(uint64_t line) const { return (m_request_lines >> line) & 1; }
+
+    /**
+     * @brief SPM上の連続したcount個の64bitワードを、それを含むラインのバースト読み出しでまとめて読む
+     */
+    void readSpmWords(uint64_t spm_addr, uint64_t count, uint64_t* words) {
+        std::array<uint8_t, 2 * Bus::BURST_SIZE> lines;
+        uint64_t first_line = spm_addr / Bus::BURST_SIZE * Bus::BURST_SIZE;
+        uint64_t last_line = (spm_addr + count * 8 - 1) / Bus::BURST_SIZE * Bus::BURST_SIZE;
+        for (uint64_t line = first_line; line <= last_line; line += Bus::BURST_SIZE) {
+            m_bus.readBurst(line, lines.data() + (line - first_line));
+        }
+        std::memcpy(words, lines.data() + (spm_addr - first_line), count * 8);
+    }
+    void readCacheSet(uint64_t set, CacheSetInfo& infos) {
+        // 1セットの管理ワードは連続しているので、まとめて読み出す
+        readSpmWords(spmManageAddr(cacheLine(set, 0)), Parameter::SPM_CACHE_WAYS, infos.data());
+    }
+    /**
+     * @brief 置換状態を更新し、変化した管理ワードのみ書き戻す
+     * @param way 参照(ヒット)または新規割り当てしたウェイ
+     * @param lru_old_age LRU時、参照前のウェイの経過順位 (無効ウェイへの割り当てはWAYS)
+     * @param is_hit ヒットならtrue、新規割り当てならfalse
+     */
+    void updateReplacementState(uint64_t set, CacheSetInfo& infos, uint64_t way, uint64_t lru_old_age, bool is_hit) {
+        CacheSetInfo updated = infos;
+        if constexpr (Parameter::SPM_CACHE_POLICY == Parameter::SpmReplacement::LRU) {
+            for (uint64_t w = 0; w < Parameter::SPM_CACHE_WAYS; ++w) {
+                if (w != way && (updated[w] & MemoryMap::SpmManage::VALID) && replState(updated[w]) < lru_old_age) {
+                    updated[w] = withReplState(updated[w], replState(updated[w]) + 1);
+                }
+            }
+            updated[way] = withReplState(updated[way], 0);
+        } else {
+            updated[way] = withReplState(updated[way], is_hit ? 0 : Parameter::SPM_RRIP_INSERT);
+        }
+        for (uint64_t w = 0; w < Parameter::SPM_CACHE_WAYS; ++w) {
+            // 新規割り当て時は呼び出し側がタグを書き換えているので必ず書き込む
+            if (updated[w] != infos[w] || (!is_hit && w == way)) m_bus.write64(spmManageAddr(cacheLine(set, w)), updated[w]);
+        }
+        infos = updated;
+    }
+    /**
+     * @brief 追い出し対象のウェイを選ぶ。現在のリクエストで使用中のラインは選ばない。
+     */
+    uint64_t selectVictimWay(uint64_t set, CacheSetInfo& infos) {
+        for (uint64_t w = 0; w < Parameter::SPM_CACHE_WAYS; ++w) {
+            if ((infos[w] & MemoryMap::SpmManage::VALID) == 0) return w;
+        }
+        if constexpr (Parameter::SPM_CACHE_POLICY == Parameter::SpmReplacement::LRU) {
+            uint64_t victim = Parameter::SPM_CACHE_WAYS;
+            for (uint64_t w = 0; w < Parameter::SPM_CACHE_WAYS; ++w) {
+                if (isLineInUse(cacheLine(set, w))) continue;
+                if (victim == Parameter::SPM_CACHE_WAYS || replState(infos[w]) > replState(infos[victim])) victim = w;
+            }
+            return victim;
+        } else {
+            // SRRIP: 再参照予測値が最大のラインを探し、なければ全体を加齢して繰り返す
+            while (true) {
+                for (uint64_t w = 0; w < Parameter::SPM_CACHE_WAYS; ++w) {
+                    if (!isLineInUse(cacheLine(set, w)) && replState(infos[w]) == Parameter::SPM_RRIP_MAX) return w;
+                }
+                for (uint64_t w = 0; w < Parameter::SPM_CACHE_WAYS; ++w) {
+                    if (isLineInUse(cacheLine(set, w))) continue;
+                    infos[w] = withReplState(infos[w], replState(infos[w]) + 1);
+                    m_bus.write64(spmManageAddr(cacheLine(set, w)), infos[w]);
+                }
+            }
+        }
+    }
+    /**
+     * @brief 指定されたブロックがSPMキャッシュ上にあればそのSPMアドレスを返す (ロードは行わない)
+     * @return SPM上のアドレス。存在しない場合は0
+     */
+    uint64_t lookupBlockInSpm(uint64_t block_addr) {
+        uint64_t set = (block_addr / 64) % Parameter::SPM_CACHE_SETS;
+        CacheSetInfo infos;
+        readCacheSet(set, infos);
+        for (uint64_t w = 0; w < Parameter::SPM_CACHE_WAYS; ++w) {
+            if (isValidTag(infos[w], block_addr)) {
+                updateReplacementState(set, infos, w, replState(infos[w]), true);
+                markLineInUse(cacheLine(set, w));
+                return spmLineAddr(cacheLine(set, w));
+            }
+        }
+        return 0;
+    }
+    /**
+     * @brief lookupBlockInSpmと同様だが、置換状態の更新も使用中の記録も行わない
+     */
+    uint64_t peekBlockInSpm(uint64_t block_addr) {
+        uint64_t set = (block_addr / 64) % Parameter::SPM_CACHE_SETS;
+        CacheSetInfo infos;
+        readCacheSet(set, infos);
+        for (uint64_t w = 0; w < Parameter::SPM_CACHE_WAYS; ++w) {
+            if (isValidTag(infos[w], block_addr)) return spmLineAddr(cacheLine(set, w));
+        }
+        return 0;
+    }
     /**
      * @brief 指定されたブロックがSPMに存在することを確認し、なければロードする
      * @param required_block_addr DRAM上の必要なブロックの先頭アドレス
-     * @param spm_block_addr SPM上の格納先アドレス
-     * @param spm_management_addr SPM上の管理情報のアドレス
      * @param block_name ログ表示用のブロック名
+     * @return ブロックを格納しているSPM上のアドレス
      */
-    void ensureBlockInSpm(uint64_t required_block_addr, uint64_t spm_block_addr, uint64_t spm_management_addr, const std::string& block_name) {
-        uint64_t current_block_info = m_bus.read64(spm_management_addr);
-        bool is_valid = (current_block_info & 1) != 0;
-        bool is_dirty = (current_block_info & 2) != 0;
-        uint64_t current_block_addr = (current_block_info >> 6) << 6;
-        // SPM上のブロックが目的のブロックと違う場合、入れ替え処理を行う
-        if (!is_valid || current_block_addr != required_block_addr) {
-            std::cout << "[Core FW] " << block_name << " block miss in SPM. Required: 0x" << std::hex << required_block_addr << std::dec << "\n";
-            // Dirtyビットが立っていれば、現在のブロックをDRAMに書き戻す
-            if (is_valid && is_dirty) {
-                std::cout << "[Core FW] Writing back dirty " << block_name << " block (0x" << std::hex << current_block_addr << std::dec << ").\n";
-                startSpmDma(current_block_addr, spm_block_addr, 64, 1); // 1: SPM -> DRAM
-                pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
+    uint64_t ensureBlockInSpm(uint64_t required_block_addr, const std::string& block_name) {
+        TimelineTrace::Scope scope(m_timeline, TimelineTrace::Track::FIRMWARE, "SPM hit", block_name);
+        uint64_t load_slot;
+        uint64_t spm_block_addr = requestBlockInSpm(required_block_addr, block_name, true, load_slot);
+        if (load_slot != Parameter::SPM_DMA_RING_SIZE) {
+            scope.setName("SPM miss");
+            waitSpmDma(load_slot);
+        }
+        return spm_block_addr;
+    }
+    /**
+     * @brief パス上の階層first_level以下のノードを、まとめてSPMにロードする
+     * @details ミスしたノードのロード(と追い出すブロックの書き戻し)を1つのスキャッター・ギャザーのリストにまとめ、
+     *          1回のコマンドで転送する。遅延更新で追い出すブロックがDirtyなツリーノードの場合は、
+     *          その書き戻しが祖先(まだ検証していない、このパス上のノードの場合がある)を更新するため、そこで打ち切る。
+     *          リストのエントリが足りなくなった場合も打ち切る。
+     * @param spm_addrs ロードした各階層のSPMアドレス
+     * @return ロードした階層の次の階層 (これ以降はensureBlockInSpmで1つずつロードする)
+     */
+    uint64_t prefetchTreePath(const PathIndices& path_indices, uint64_t first_level, PathIndices& spm_addrs) {
+        TimelineTrace::Scope scope(m_timeline, TimelineTrace::Track::FIRMWARE, "prefetch");
+        uint64_t level = first_level;
+        GatherList gather;
+        for (; level < Parameter::HEIGHT; ++level) {
+            if (gather.count + 2 > Parameter::SPM_DMA_SG_ENTRIES) break; // 書き戻しとロードの2エントリが入らない
+            uint64_t load_slot;
+            spm_addrs[level] = requestBlockInSpm(treeNodeAddr(level, path_indices[level]), "Tree Level " + std::to_string(level + 1), false, load_slot, &gather);
+            if (spm_addrs[level] == 0) break;
+        }
+        if (gather.count != 0) runSpmGather(gather);
+        return level;
+    }
+    /**
+     * @brief 指定されたブロックのSPMキャッシュ上の位置を決め、ミスならロードをDMAリングに投入する (完了は待たない)
+     * @details 追い出すブロックがDirtyなら、その書き戻しをロードより先に投入する (SPM-DMAが同じラインの順序を保つ)。
+     *          遅延更新で追い出すブロックがDirtyなツリーノードの場合は、その場で祖先を更新して書き戻す。
+     * @param allow_tree_writeback falseなら、ツリーノードの書き戻しが必要な場合に何もせず0を返す
+     * @param load_slot ロードのディスクリプタのスロット。ヒットした場合はParameter::SPM_DMA_RING_SIZE
+     * @param gather 指定した場合は、転送をDMAリングに投入せずこのリストに追加する (load_slotはヒットと同じ値になる)
+     * @return ブロックを格納するSPM上のアドレス
+     */
+    uint64_t requestBlockInSpm(uint64_t required_block_addr, std::string_view block_name, bool allow_tree_writeback, uint64_t& load_slot,
+                               GatherList* gather = nullptr) {
+        load_slot = Parameter::SPM_DMA_RING_SIZE;
+        uint64_t set = (required_block_addr / 64) % Parameter::SPM_CACHE_SETS;
+        CacheSetInfo infos;
+        readCacheSet(set, infos);
+        for (uint64_t w = 0; w < Parameter::SPM_CACHE_WAYS; ++w) {
+            if (isValidTag(infos[w], required_block_addr)) {
+                SIM_LOG(CORE, TRACE, "[Core FW] " << block_name << " block hit in SPM (set " << set << ", way " << w << ").");
+                m_cache_stats.hits++;
+                countSpmLookup(required_block_addr, true);
+                updateReplacementState(set, infos, w, replState(infos[w]), true);
+                markLineInUse(cacheLine(set, w));
+                return spmLineAddr(cacheLine(set, w));
             }
-            // 新しいブロックをDRAMからSPMに読み込む
-            std::cout << "[Core FW] Loading new " << block_name << " block into SPM.\n";
-            startSpmDma(required_block_addr, spm_block_addr, 64, 0); // 0: DRAM -> SPM
-            pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
-            // 管理情報を更新 (Valid=1, Dirty=0)
-            clearBlockdirty(spm_management_addr, required_block_addr);
+        }
+        uint64_t way = selectVictimWay(set, infos);
+        uint64_t line = cacheLine(set, way);
+        uint64_t spm_block_addr = spmLineAddr(line);
+        uint64_t victim_info = infos[way];
+        bool is_valid = (victim_info & MemoryMap::SpmManage::VALID) != 0;
+        bool is_dirty = (victim_info & MemoryMap::SpmManage::DIRTY) != 0;
+        uint64_t victim_block_addr = (victim_info >> 6) << 6;
+        bool is_tree_writeback = Parameter::SPM_TREE_UPDATE == Parameter::TreeUpdate::LAZY && is_valid && is_dirty && isTreeNodeAddr(victim_block_addr);
+        if (is_tree_writeback && !allow_tree_writeback) return 0;
+        SIM_LOG(CORE, TRACE, "[Core FW] " << block_name << " block miss in SPM. Required: 0x" << std::hex << required_block_addr);
+        m_cache_stats.misses++;
+        countSpmLookup(required_block_addr, false);
+        // Dirtyビットが立っていれば、追い出すブロックをDRAMに書き戻す
+        if (is_valid && is_dirty) {
+            SIM_LOG(CORE, TRACE, "[Core FW] Writing back dirty block (0x" << std::hex << victim_block_addr << ").");
+            m_cache_stats.evictions++;
+            if (m_perf) m_perf->add(MemoryMap::PerfCounter::SPM_WRITEBACKS);
+            if (is_tree_writeback) {
+                writeBackTreeNode(spm_block_addr, victim_block_addr);
+                // 祖先の更新で同じセットの管理ワード(Dirtyビット)が変わっている可能性があるので読み直す
+                readCacheSet(set, infos);
+                victim_info = infos[way];
+            } else if (gather) {
+                gather->add(victim_block_addr, spm_block_addr, 1); // 1: SPM -> DRAM
+            } else {
+                postSpmDma(victim_block_addr, spm_block_addr, 64, 1, false); // 1: SPM -> DRAM (完了を待たない)
+            }
+        }
+        // 新しいブロックをDRAMからSPMに読み込む (優先して転送する)
+        SIM_LOG(CORE, TRACE, "[Core FW] Loading new " << block_name << " block into SPM (set " << set << ", way " << way << ").");
+        if (gather) {
+            gather->add(required_block_addr, spm_block_addr, 0); // 0: DRAM -> SPM
+        } else {
+            load_slot = postSpmDma(required_block_addr, spm_block_addr, 64, 0, true); // 0: DRAM -> SPM
+        }
+        // 管理情報を更新 (Valid=1, Dirty=0, 未検証)
+        uint64_t lru_old_age = is_valid ? replState(victim_info) : Parameter::SPM_CACHE_WAYS;
+        infos[way] = ((required_block_addr >> 6) << 6) | MemoryMap::SpmManage::VALID;
+        updateReplacementState(set, infos, way, lru_old_age, false);
+        markLineInUse(line);
+        return spm_block_addr;
+    }
+    // SPMキャッシュの参照をブロックの種類(データタグ・カウンター・ツリーの階層)ごとに数える
+    void countSpmLookup(uint64_t block_addr, bool is_hit) {
+        if (!m_perf) return;
+        uint64_t counter;
+        if (!isTreeNodeAddr(block_addr)) {
+            counter = is_hit ? MemoryMap::PerfCounter::SPM_HIT_TAG : MemoryMap::PerfCounter::SPM_MISS_TAG;
+        } else if (treeLevelOf(block_addr) == Parameter::HEIGHT - 1) {
+            counter = is_hit ? MemoryMap::PerfCounter::SPM_HIT_COUNTER : MemoryMap::PerfCounter::SPM_MISS_COUNTER;
         } else {
-            std::cout << "[Core FW] " << block_name << " block hit in SPM.\n";
+            counter = (is_hit ? MemoryMap::PerfCounter::SPM_HIT_TREE : MemoryMap::PerfCounter::SPM_MISS_TREE) + 2 * treeLevelOf(block_addr);
         }
+        m_perf->add(counter);
     }
     // --- 3. ハードウェア制御を抽象化 ---
+    /**
+     * @brief 条件が成立するまでコアを停止させる
+     * @details ホスト上で空回りせず、成立するまでスケジューラのイベント(各モジュールの完了)を時刻順に処理する。
+     *          条件が成立しないままイベントが尽きた場合はデッドロックとして中断する。
+     */
+    template <class Predicate>
+    void waitUntil(Predicate done) {
+        if (!m_scheduler.runUntil(done)) {
+            SIM_LOG(CORE, ERROR, "[Core] Deadlock: waiting for hardware with no pending events (cycle " << m_scheduler.now() << ").");
+            exit(1);
+        }
+    }
     void pollUntilReady(uint64_t status_addr) {
-        while(m_bus.read64(status_addr) != 0) {}
+        waitUntil([this, status_addr] { return m_bus.read64(status_addr) == 0; });
+    }
+    /**
+     * @brief SPM上のブロックがツリー検証済みであるかを確認する
+     * @details 検証済みノードはオンチップのSPMにあるため、以降の検証では信頼できるものとして扱う
+     */
+    bool isBlockVerified(uint64_t spm_management_addr) {
+        uint64_t current_block_info = m_bus.read64(spm_management_addr);
+        return (current_block_info & MemoryMap::SpmManage::VALID) && (current_block_info & MemoryMap::SpmManage::VERIFIED);
+    }
+    /**
+     * @brief 指定されたSPM管理アドレスの管理情報に検証済みビットを立てる
+     */
+    void setBlockVerified(uint64_t spm_management_addr) {
+        uint64_t current_block_info = m_bus.read64(spm_management_addr);
+        m_bus.write64(spm_management_addr, current_block_info | MemoryMap::SpmManage::VERIFIED);
+    }
+    bool isZeroBlock(uint64_t spm_addr) {
+        std::array<uint8_t, Bus::BURST_SIZE> line;
+        m_bus.readBurst(spm_addr, line.data());
+        return std::all_of(line.begin(), line.end(), [](uint8_t b) { return b == 0; });
+    }
+    /**
+     * @brief 一度も書き戻されていないツリーノードか (全て0で、親のカウンターも0)
+     * @details マイナーカウンターはオーバーフローでも0に戻るため、親のメジャーカウンターも0であることを確かめる。
+     *          この判定は親の最初の繰り上げまでしか成り立たない (繰り上げ時にinitUnwrittenChildrenで子をDRAMに用意する)。
+     * @param level ノードの階層 (0ではparent_spm_addrはルート)
+     */
+    bool isNeverWrittenNode(uint64_t spm_addr, uint64_t level, uint64_t parent_spm_addr, uint64_t parent_entry) {
+        if (m_bus.read64(parent_spm_addr) != 0) return false; // ルート、または親のメジャーカウンター
+        if (level > 0 && readMinorCounter(parent_spm_addr, parent_entry) != 0) return false;
+        return isZeroBlock(spm_addr);
     }
     bool tag_check(uint64_t spm_management_addr, uint64_t block_addr) {
         uint64_t current_block_info = m_bus.read64(spm_management_addr);
@@ -113,232 +542,511 @@ private:
         m_bus.write64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::DIRECTION, direction);
         m_bus.write64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START, 1);
     }
-    /*
-     * @brief 指定されたSPM管理アドレスの管理情報を更新し、指定されたブロックをDirtyに設定する
-    */
-    void setBlockdirty(uint64_t spm_management_addr, uint64_t block_addr) {
-        uint64_t new_info = ((block_addr >> 6) << 6) | 0x3; // ValidとDirtyをセット
-        m_bus.write64(spm_management_addr, new_info);
-        // uint64_t updated_info = m_bus.read64(spm_management_addr);
-        // bool is_valid = (updated_info & 1) != 0;
-        // bool is_dirty = (updated_info & 2) != 0;
-        // uint64_t current_block_addr = (updated_info >> 6) << 6;
+    /**
+     * @brief DMA転送をディスクリプタリングに投入する (完了は待たない)
+     * @details リングが満杯なら空くまで待つ
+     * @param high_priority trueなら先に投入された通常の転送より優先する
+     * @return 投入したディスクリプタのスロット (完了ビットマップのビット番号)
+     */
+    uint64_t postSpmDma(uint64_t dram_addr, uint64_t spm_addr, uint64_t size, uint64_t direction, bool high_priority) {
+        waitSpmDmaRingSlot();
+        m_bus.write64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::DRAM_ADDR, dram_addr);
+        m_bus.write64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::SPM_ADDR, spm_addr);
+        m_bus.write64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::SIZE, size);
+        m_bus.write64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::DIRECTION, direction);
+        m_bus.write64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::RING_PUSH, high_priority ? 1 : 0);
+        // 待っている間に他の投入でスロットが変わり得るため、実際に使われたスロットを読む
+        return m_bus.read64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::RING_LAST_SLOT);
     }
     /**
-     * @brief 指定されたSPM管理アドレスの管理情報を更新し、指定されたブロックのDirtyをクリアする またはValidのみセットする
+     * @brief ディスクリプタリングに空きができるまで待つ
+     * @return RING_STATUSの値
+     */
+    uint64_t waitSpmDmaRingSlot() {
+        uint64_t status;
+        waitUntil([this, &status] {
+            status = m_bus.read64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::RING_STATUS);
+            return (status & 0xff) < Parameter::SPM_DMA_RING_SIZE;
+        });
+        return status;
+    }
+    /**
+     * @brief スキャッター・ギャザーのコマンドでリストの全ラインを転送し、完了を待つ
+     * @details リストは4エントリ(64B)ずつバーストで書き込むため、MMIOアクセスはライン数によらずわずかで済む
+     */
+    void runSpmGather(const GatherList& gather) {
+        waitSpmDmaRingSlot();
+        for (uint64_t i = 0; i < gather.count; i += 4) {
+            m_bus.writeBurst(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::SG_LIST + i * 16,
+                             reinterpret_cast<const uint8_t*>(&gather.words[2 * i]));
+        }
+        m_bus.write64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::SG_START, gather.count);
+        pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::SG_START);
+    }
+    /**
+     * @brief ディスクリプタリングのslotの転送の完了を待つ
+     */
+    void waitSpmDma(uint64_t slot) {
+        waitUntil([this, slot] {
+            return (m_bus.read64(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::RING_DONE) >> slot) & 1;
+        });
+    }
+    /*
+     * @brief 指定されたSPM管理アドレスの管理情報を更新し、ブロックをDirtyに設定する
+     * @details タグ・置換状態・検証済みビットは保持する
     */
-    void clearBlockdirty(uint64_t spm_management_addr, uint64_t block_addr) {
-        uint64_t new_info = ((block_addr >> 6) << 6) | 0x1; // Validのみセット
-        m_bus.write64(spm_management_addr, new_info);
+    void setBlockdirty(uint64_t spm_management_addr) {
+        uint64_t current_block_info = m_bus.read64(spm_management_addr);
+        m_bus.write64(spm_management_addr, current_block_info | MemoryMap::SpmManage::VALID | MemoryMap::SpmManage::DIRTY);
     }
     /*
      * @brief MACモジュールのバッファにデータをセットし、計算を指示する
     */
     void setMacBuffer(uint64_t spm_addr, uint64_t start_bit, uint64_t end_bit){
         // busy wait
-        while(m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS) != 0) {}
+        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
         // SPMから暗号文をコピー
         m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::SPM_ADDR, spm_addr);
         m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::SPM_START, 1); // 先頭から
-        while(m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::SPM_START) != 0) {}
+        // コピーの完了はSTATUSで確認する (SPM_STARTの読み出しは常に0)
+        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
         // MAC計算を開始
         m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::START_BIT,start_bit);
         m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::END_BIT,end_bit);
         m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 2); // 2: MAC Update
-        while(m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS) != 0) {}
+        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
     }
-    
-    bool verifyTreePath(const std::array<uint64_t, 4>& path_indices) {
-        std::cout << "[Core FW] --- Verifying Merkle Tree Path ---\n";
-        for (uint64_t i = 0; i < Parameter::HEIGHT; ++i) {
+    /**
+     * @brief SPM上のノードの指定ビット位置からwidthビットを読み出す (64bit境界をまたいでもよい)
+     */
+    uint64_t readNodeBits(uint64_t spm_addr, uint64_t bit, uint64_t width) {
+        uint64_t word_addr = spm_addr + bit / 64 * 8;
+        uint64_t shift = bit % 64;
+        uint64_t value = m_bus.read64(word_addr) >> shift;
+        if (shift + width > 64) value |= m_bus.read64(word_addr + 8) << (64 - shift);
+        return value & ((1ULL << width) - 1);
+    }
+    /**
+     * @brief SPM上のノードの指定ビット位置にwidthビットを書き込む (他のビットは保持する)
+     */
+    void writeNodeBits(uint64_t spm_addr, uint64_t bit, uint64_t width, uint64_t value) {
+        uint64_t word_addr = spm_addr + bit / 64 * 8;
+        uint64_t shift = bit % 64;
+        uint64_t mask = (1ULL << width) - 1;
+        uint64_t word = m_bus.read64(word_addr);
+        m_bus.write64(word_addr, (word & ~(mask << shift)) | ((value & mask) << shift));
+        if (shift + width > 64) {
+            uint64_t next = m_bus.read64(word_addr + 8);
+            m_bus.write64(word_addr + 8, (next & ~(mask >> (64 - shift))) | ((value & mask) >> (64 - shift)));
+        }
+    }
+    /**
+     * @brief ノード内のエントリに対応するマイナーカウンターを読み出す
+     */
+    uint64_t readMinorCounter(uint64_t spm_addr, uint64_t entry) {
+        return readNodeBits(spm_addr, Geometry::minorBit(entry), Geometry::MINOR_BITS);
+    }
+    /**
+     * @brief ノード内のエントリに対応するマイナーカウンターをインクリメントする
+     * @details オーバーフロー時はメジャーカウンターを繰り上げ、マイナーカウンターを0に戻す。
+     *          カウンターブロック(リーフ)ではメジャーカウンターが全データラインのOTPに使われるため、他のラインを再暗号化する
+     * @param counter_block spm_addrがカウンターブロックか (entryはデータラインの番号)
+     * @return 更新後のマイナーカウンター
+     */
+    uint64_t incrementMinorCounter(uint64_t spm_addr, uint64_t entry, bool counter_block = false) {
+        uint64_t minor_counter_value = readMinorCounter(spm_addr, entry);
+        uint64_t new_minor_counter = 0;
+        if (minor_counter_value == Geometry::MINOR_MAX){
+            if (counter_block) reencryptCounterBlock(spm_addr, entry);
+            m_bus.write64(spm_addr, (m_bus.read64(spm_addr) + 1) & Geometry::MAJOR_MASK);
+            new_minor_counter = 0; // minor counterは0に戻す
+            SIM_LOG(CORE, TRACE, "[Core FW] Minor counter overflow. Incrementing major counter.");
+        } else {
+            new_minor_counter = minor_counter_value + 1;
+        }
+        writeNodeBits(spm_addr, Geometry::minorBit(entry), Geometry::MINOR_BITS, new_minor_counter);
+        return new_minor_counter;
+    }
+    /**
+     * @brief 次のインクリメントでノードのメジャーカウンターが初めて繰り上がるか
+     */
+    bool isFirstCarry(uint64_t spm_addr, uint64_t entry) {
+        return m_bus.read64(spm_addr) == 0 && readMinorCounter(spm_addr, entry) == Geometry::MINOR_MAX;
+    }
+    /**
+     * @brief ツリーノードのメジャーカウンターが初めて繰り上がった後に、一度も書き戻されていない子ノードをDRAMに用意する
+     * @details 繰り上げ後は子を未書き込みと判定できなくなるため(isNeverWrittenNode)、マイナーカウンターが0の子
+     *          (skip_entry以外、常駐しない階層のみ)のDRAMに、全て0のノードとそのMACを書き込む。
+     * @param level spm_addrのノードの階層
+     * @param scratch 作業に使うSPMライン (内容は壊れる)
+     */
+    void initUnwrittenChildren(uint64_t spm_addr, uint64_t level, uint64_t skip_entry, uint64_t scratch) {
+        if (isPinnedLevel(level + 1)) return; // 常駐階層はオンチップのノードが正
+        uint64_t first_entry = skip_entry / Geometry::ARITY * Geometry::ARITY;
+        uint64_t last_entry = std::min(first_entry + Geometry::ARITY, Geometry::levelNodes(level + 1));
+        SIM_LOG(CORE, DEBUG, "[Core FW] First major carry at level " << level + 1 << ". Initializing unwritten children.");
+        std::array<uint8_t, Bus::BURST_SIZE> zero{};
+        m_bus.writeBurst(scratch, zero.data());
+        for (uint64_t entry = first_entry; entry < last_entry; ++entry) {
+            if (entry == skip_entry || readMinorCounter(spm_addr, entry) != 0) continue;
+            m_bus.write64(scratch + 56, computeNodeMac(scratch, level + 1, spm_addr, entry)); // 56BにMACがある
+            uint64_t dram_addr = treeNodeAddr(level + 1, entry * Geometry::ARITY);
+            startSpmDma(dram_addr, scratch, 64, 1); // 1: SPM -> DRAM
+            pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
+            // SPMキャッシュ上の未書き込みのコピーにもMACを入れておく
+            uint64_t cached_addr = peekBlockInSpm(dram_addr);
+            if (cached_addr != 0 && isZeroBlock(cached_addr)) m_bus.write64(cached_addr + 56, m_bus.read64(scratch + 56));
+        }
+    }
+    /**
+     * @brief カウンターブロックが覆うデータラインを、繰り上げ後のメジャーカウンターで暗号化し直す
+     * @details skip_line以外の書き込み済みのラインごとに、DRAMの暗号文をSPMに読み込んでMACを検証し、
+     *          旧カウンター(メジャー, マイナー)のOTPで復号、新カウンター(メジャー+1, 0)のOTPで暗号化して、
+     *          マイナーカウンターを0にしたうえでMACを更新しDRAMに書き戻す。
+     *          書き込みリクエストの処理中に呼ばれるため、Read Bufferと暗号文用のSPMラインを作業領域に使う。
+     */
+    void reencryptCounterBlock(uint64_t spm_counter_block, uint64_t skip_line) {
+        uint64_t old_major = m_bus.read64(spm_counter_block);
+        uint64_t new_major = (old_major + 1) & Geometry::MAJOR_MASK;
+        uint64_t spm_data = spmLineAddr(Parameter::SPM_DATA_LINE);
+        uint64_t first_line = skip_line / Geometry::ARITY * Geometry::ARITY;
+        SIM_LOG(CORE, DEBUG, "[Core FW] Minor counter overflow. Re-encrypting lines " << first_line << "-" << first_line + Geometry::ARITY - 1);
+        for (uint64_t line = first_line; line < first_line + Geometry::ARITY; ++line) {
+            uint64_t minor = readMinorCounter(spm_counter_block, line);
+            if (line == skip_line || (old_major == 0 && minor == 0)) continue; // 一度も書き込まれていないライン
+            uint64_t addr = MemoryMap::PROTECTION_BASE_ADDR + line * 64;
+            uint64_t bit_offset = Geometry::minorBit(line);
+            uint64_t tag_addr = MemoryMap::DATA_TAG_BASE_ADDR + line / Geometry::TAGS_PER_LINE * 64;
+            uint64_t tag_offset = line % Geometry::TAGS_PER_LINE * 8;
+            // データタグのブロックはこのラインの処理中のみ使用中とする
+            uint64_t saved_request_lines = m_request_lines;
+            // 前回の繰り上げ以降に書き込まれていないライン (タグが0) は暗号文が無いので飛ばす
+            uint64_t spm_tag_block = ensureBlockInSpm(tag_addr, "MAC");
+            uint64_t expected_mac = m_bus.read64(spm_tag_block + tag_offset);
+            if (minor == 0 && expected_mac == 0) {
+                m_request_lines = saved_request_lines;
+                continue;
+            }
+            // 暗号文を読み込み、旧カウンターでMACを検証
+            startSpmDma(addr, spm_data, 64, 0); // 0: DRAM -> SPM
+            pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
+            if (computeDataMac(spm_data, spm_counter_block, bit_offset) != expected_mac) {
+                SIM_LOG(CORE, ERROR, "[Core FW] MAC verification failed while re-encrypting 0x" << std::hex << addr << ". Aborting.");
+                exit(1);
+            }
+            // 旧カウンターのOTPで復号 (Read Buffer上に平文)
+            makeseed_otp(addr, old_major, minor);
+            pollUntilReady(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY);
+            m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::SPM_ADDR, spm_data);
+            m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::COMMAND, 2); // 2: SPM -> R Buffer
+            pollUntilReady(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::START);
+            pollUntilReady(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY);
+            m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::COMMAND, 8); // 8: XOR OTP
+            // 新カウンターのOTPで暗号化し、SPMに書き戻す
+            makeseed_otp(addr, new_major, 0);
+            pollUntilReady(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::START);
+            pollUntilReady(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY);
+            m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::COMMAND, 8 | 64); // 8: XOR OTP, 64: R Buffer -> SPM
+            pollUntilReady(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY);
+            // マイナーカウンターを0にしてMACを更新
+            writeNodeBits(spm_counter_block, bit_offset, Geometry::MINOR_BITS, 0);
+            m_bus.write64(spm_tag_block + tag_offset, computeDataMac(spm_data, spm_counter_block, bit_offset));
+            setBlockdirty(manageAddrOf(spm_tag_block));
+            startSpmDma(addr, spm_data, 64, 1); // 1: SPM -> DRAM
+            pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
+            m_request_lines = saved_request_lines;
+        }
+    }
+    /**
+     * @brief SPM上の暗号文と、カウンターブロック中のマイナーカウンター(bit_offsetから)を元にデータのMACを計算する
+     */
+    uint64_t computeDataMac(uint64_t spm_data, uint64_t spm_counter_block, uint64_t bit_offset) {
+        // ハッシュ関数の内部状態を初期化
+        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
+        m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 1); // 1: Initialize
+        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
+        // SPMから暗号文をコピーし、update
+        setMacBuffer(spm_data, 0, 511);
+        // SPMからカウンターブロックをコピー
+        setMacBuffer(spm_counter_block, bit_offset, bit_offset + Geometry::MINOR_BITS - 1);
+        // MAC計算完了
+        m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 4); // 4: MAC Finalize
+        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
+        return m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::MAC_RESULT);
+    }
+    /**
+     * @brief ツリーノードのMACを計算する
+     * @details ノード本体(先頭448bit)と、親ノード中のこのノードに対応するマイナーカウンターをハッシュする
+     * @param spm_addr SPM上のノードのアドレス
+     * @param level ノードの階層 (0: 最上位。親はルート)
+     * @param parent_spm_addr SPM上の親ノードのアドレス (level == 0の場合はルート)
+     * @param parent_entry 親ノード内でのこのノードのエントリ番号
+     */
+    uint64_t computeNodeMac(uint64_t spm_addr, uint64_t level, uint64_t parent_spm_addr, uint64_t parent_entry) {
+        // MACを初期化
+        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
+        m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 1); // INIT
+        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
+        // 現在のノードデータをハッシュ入力に設定
+        setMacBuffer(spm_addr, 0, 448 - 1); // 448bit
+        // 親ノードのカウンターをハッシュ入力に設定
+        if (level == 0) { // 最上位ノードの場合、親はルート
+            setMacBuffer(parent_spm_addr, 0, 63);
+        } else {
+            uint64_t parent_bit = Geometry::minorBit(parent_entry);
+            setMacBuffer(parent_spm_addr, parent_bit, parent_bit + Geometry::MINOR_BITS - 1);
+        }
+        // MAC計算を完了
+        m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 4); // FINALIZE
+        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
+        return m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::MAC_RESULT);
+    }
+
+    /**
+     * @brief リーフからルートへのパスを検証する
+     * @details リーフ側から辿り、SPM上に検証済みで存在する最初の祖先で検証を打ち切る。
+     *          それより下の階層のみを上から順にMAC検証し、成功した階層に検証済みビットを立てる。
+     *          一度も書き戻されていないノード(isNeverWrittenNode)はMACを持たないので、検証せずに正当とする。
+     * @param full_path trueなら打ち切らず、常駐階層の直下からリーフまでの全ノードを検証済みにする
+     *                  (即時更新はパス上の全ノードのMACを再計算するため、未検証のノードが残ってはならない)
+     */
+    bool verifyTreePath(const PathIndices& path_indices, bool full_path = false) {
+        SIM_LOG(CORE, DEBUG, "[Core FW] --- Verifying Merkle Tree Path ---");
+        // 検証が必要な最上位の階層を求める (これより上は信頼済み)
+        // 常駐階層は起動時に検証済みなので、その直下から探せばよい
+        uint64_t first_level = Parameter::SPM_PINNED_LEVELS;
+        uint64_t parent_spm_addr = first_level > 0 ? pinnedNodeAddr(first_level - 1, path_indices[first_level - 1])
+                                                   : spmLineAddr(Parameter::SPM_ROOT_LINE);
+        for (uint64_t i = Parameter::HEIGHT; !full_path && i-- > Parameter::SPM_PINNED_LEVELS;) {
+            uint64_t spm_addr = lookupBlockInSpm(treeNodeAddr(i, path_indices[i]));
+            if (spm_addr != 0 && isBlockVerified(manageAddrOf(spm_addr))) {
+                first_level = i + 1;
+                parent_spm_addr = spm_addr;
+                break;
+            }
+        }
+        if (first_level == Parameter::HEIGHT) {
+            SIM_LOG(CORE, DEBUG, "[Core FW] Counter block already verified in SPM. Skipping tree walk.");
+            return true;
+        }
+        if (first_level > Parameter::SPM_PINNED_LEVELS) {
+            SIM_LOG(CORE, DEBUG, "[Core FW] Trusted ancestor found at level " << first_level << " in SPM.");
+        }
+        // 検証する階層のノードをまとめてロードしておく
+        PathIndices spm_addrs{};
+        uint64_t prefetched = prefetchTreePath(path_indices, first_level, spm_addrs);
+        for (uint64_t i = first_level; i < Parameter::HEIGHT; ++i) {
             uint64_t height = i + 1;
-            uint64_t spm_addr = MemoryMap::SPM_BASE_ADDR + (6 - i) * 64;
-            uint64_t spm_manage = MemoryMap::SPM_BASE_ADDR + 56 * 64 + (6 - i) * 8;
+            std::string block_name = "Tree Level " + std::to_string(height);
+            TimelineTrace::Scope scope(m_timeline, TimelineTrace::Track::FIRMWARE, "verify", block_name);
             // DRAM上のノードアドレスを計算
-            uint64_t dram_addr = MemoryMap::COUNTER_BASE_ADDR + path_indices[i] / 32 * 64;
-            dram_addr += level_base_addr[i];
-            // 必要なノードをSPMにロード
-            ensureBlockInSpm(dram_addr, spm_addr, spm_manage, "Tree Level " + std::to_string(height));
+            uint64_t dram_addr = treeNodeAddr(i, path_indices[i]);
+            // 必要なノードをSPMにロード (先読みできなかった階層のみ)
+            uint64_t spm_addr = i < prefetched ? spm_addrs[i] : ensureBlockInSpm(dram_addr, block_name);
+            uint64_t spm_manage = manageAddrOf(spm_addr);
+            // 全体を検証する場合、検証済みのノードは親として使うだけでよい
+            if (isBlockVerified(spm_manage)) {
+                parent_spm_addr = spm_addr;
+                continue;
+            }
+            if (isNeverWrittenNode(spm_addr, i, parent_spm_addr, i == 0 ? 0 : path_indices[i - 1])) {
+                SIM_LOG(CORE, TRACE, "[Core FW] Level " << height << " - Never written.");
+            } else {
+                // --- MAC計算 ---
+                uint64_t computed_mac = computeNodeMac(spm_addr, i, parent_spm_addr, i == 0 ? 0 : path_indices[i - 1]);
 
-            // --- MAC計算 ---
-            // MACを初期化
-            pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
-            m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 1); // INIT
-            pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
+                // --- MAC検証 ---
+                uint64_t expected_mac = m_bus.read64(spm_addr + 56); // 56Byte目にMACがある
 
-            // 現在のノードデータをハッシュ入力に設定
-            setMacBuffer(spm_addr, 0, 448 - 1); // 448bit
+                SIM_LOG(CORE, TRACE, "[Core FW] Level " << height << " - Computed MAC: 0x" << std::hex << computed_mac
+                          << ", Expected MAC: 0x" << expected_mac);
 
-            // 親ノードのハッシュをハッシュ入力に設定
-            if (i == 0) { // 最下層ノードの場合、親はルート
-                setMacBuffer(MemoryMap::SPM_BASE_ADDR, 0, 63);
+                if (computed_mac != expected_mac) {
+                    SIM_LOG(CORE, ERROR, "[Core FW] Verification failed at level " << height << ". Aborting.");
+                    return false; // 検証失敗
+                }
+            }
+            setBlockVerified(spm_manage);
+            parent_spm_addr = spm_addr;
+        }
+        SIM_LOG(CORE, DEBUG, "[Core FW] --- Merkle Tree Path Verified Successfully ---");
+        return true; // 全ての階層で検証成功
+    }
+    /**
+     * @brief 遅延更新モードで、追い出すDirtyなツリーノードをDRAMに書き戻す
+     * @details 親のカウンターをインクリメントしてからノードのMACを再計算して書き戻す。
+     *          SPMキャッシュに無い祖先はステージングラインに読み込んで検証し、同様に更新して書き戻す。
+     *          SPMキャッシュ上の祖先・常駐階層・ルートのいずれかに到達したら、それを更新して終わる。
+     *          キャッシュへのロードは行わないため、書き戻し中に別のラインが追い出されることはない。
+     * @param spm_addr 追い出すノードのSPMアドレス
+     * @param dram_addr 追い出すノードのDRAMアドレス
+     */
+    void writeBackTreeNode(uint64_t spm_addr, uint64_t dram_addr) {
+        TimelineTrace::Scope scope(m_timeline, TimelineTrace::Track::FIRMWARE, "tree writeback");
+        uint64_t level = treeLevelOf(dram_addr);
+        // ルートまでのパス (verifyTreePathと同じ形式。ノード内のエントリ番号は任意でよい)
+        PathIndices path{};
+        path[level] = (dram_addr - MemoryMap::COUNTER_BASE_ADDR - Geometry::levelBase(level)) / 64 * Geometry::ARITY;
+        for (uint64_t i = level; i-- > 0;) path[i] = path[i + 1] / Geometry::ARITY;
+        // SPMキャッシュ上にある最も近い祖先を探す。無ければ常駐階層の最下位、またはルートまで辿る
+        uint64_t first_staged = level;
+        uint64_t anchor_spm_addr = 0;
+        while (first_staged > Parameter::SPM_PINNED_LEVELS) {
+            anchor_spm_addr = peekBlockInSpm(treeNodeAddr(first_staged - 1, path[first_staged - 1]));
+            if (anchor_spm_addr != 0) break;
+            --first_staged;
+        }
+        if (anchor_spm_addr == 0) {
+            anchor_spm_addr = first_staged == 0 ? spmLineAddr(Parameter::SPM_ROOT_LINE)
+                                                : pinnedNodeAddr(first_staged - 1, path[first_staged - 1]);
+        }
+        // SPMに無い祖先をステージングラインに読み込み、上から順に検証する
+        uint64_t parent_spm_addr = anchor_spm_addr;
+        for (uint64_t i = first_staged; i < level; ++i) {
+            uint64_t staged_addr = stagingNodeAddr(i);
+            startSpmDma(treeNodeAddr(i, path[i]), staged_addr, 64, 0); // 0: DRAM -> SPM
+            pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
+            // 一度も書き戻されていないノードはMACを持たない
+            bool never_written = isNeverWrittenNode(staged_addr, i, parent_spm_addr, i == 0 ? 0 : path[i - 1]);
+            if (!never_written && computeNodeMac(staged_addr, i, parent_spm_addr, i == 0 ? 0 : path[i - 1]) != m_bus.read64(staged_addr + 56)) {
+                SIM_LOG(CORE, ERROR, "[Core FW] Verification failed at level " << i + 1 << " during write-back. Aborting.");
+                exit(1);
+            }
+            parent_spm_addr = staged_addr;
+        }
+        // 下の階層から順に、親のカウンターをインクリメントしてMACを再計算し、DRAMに書き戻す
+        uint64_t node_spm_addr = spm_addr;
+        uint64_t first_carries = 0; // bit i: 階層iの親のメジャーカウンターが初めて繰り上がった
+        for (uint64_t i = level;; --i) {
+            parent_spm_addr = i == first_staged ? anchor_spm_addr : stagingNodeAddr(i - 1);
+            if (i == 0) {
+                m_bus.write64(parent_spm_addr, m_bus.read64(parent_spm_addr) + 1); // root update
             } else {
-                uint64_t parent_spm_addr = spm_addr + 64; // SPM上では直前の階層
-                uint64_t parent_offset_in_node = (path_indices[i - 1] % 32) * 8;
-                setMacBuffer(parent_spm_addr, 64 + parent_offset_in_node, 64 + parent_offset_in_node + 7);
+                if (isFirstCarry(parent_spm_addr, path[i - 1])) first_carries |= 1ULL << i;
+                incrementMinorCounter(parent_spm_addr, path[i - 1]);
             }
-
-            // MAC計算を完了
-            m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 4); // FINALIZE
-            pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
-            
-            // --- MAC検証 ---
-            uint64_t computed_mac = m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::MAC_RESULT);
-            uint64_t expected_mac = m_bus.read64(spm_addr + 56); // 56Byte目にMACがある
-            
-            std::cout << "[Core FW] Level " << height << " - Computed MAC: 0x" << std::hex << computed_mac
-                      << ", Expected MAC: 0x" << expected_mac << std::dec << "\n";
-
-            if (computed_mac != expected_mac) {
-                std::cout << "[Core FW] Verification failed at level " << height << ". Aborting.\n";
-                return false; // 検証失敗
+            uint64_t mac_result = computeNodeMac(node_spm_addr, i, parent_spm_addr, i == 0 ? 0 : path[i - 1]);
+            m_bus.write64(node_spm_addr + 56, mac_result); // 56BにMACがある
+            startSpmDma(treeNodeAddr(i, path[i]), node_spm_addr, 64, 1); // 1: SPM -> DRAM
+            pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
+            if (i == first_staged) break;
+            node_spm_addr = parent_spm_addr;
+        }
+        // 繰り上がった親の未書き込みの子を用意する (書き戻しの済んだ追い出すラインを作業領域に使う)
+        for (uint64_t i = first_staged; i <= level; ++i) {
+            if ((first_carries >> i) & 1) {
+                initUnwrittenChildren(i == first_staged ? anchor_spm_addr : stagingNodeAddr(i - 1), i - 1, path[i - 1], spm_addr);
             }
         }
-        std::cout << "[Core FW] --- Merkle Tree Path Verified Successfully ---\n";
-        return true; // 全ての階層で検証成功
+        // カウンターを更新した祖先はDirtyになる (ルートは常にオンチップ)
+        if (first_staged > 0) setBlockdirty(manageAddrOf(anchor_spm_addr));
     }
     /**
      * @brief メジャー・マイナーカウンターとアドレスを元にOTP用のシードを生成しAESアクセラレータに書き込む
      */
-    void makeseed_otp(uint64_t request_addr, uint64_t major_counter, uint8_t minor_counter){
-        std::cout << "[Core FW] Setting up AES seeds for OTP generation...\n";
-        std::cout << "[Core FW] Major Counter: " << major_counter << ", Minor Counter: " << static_cast<int>(minor_counter) << "\n";
-        uint64_t seed_0 = request_addr + major_counter;
-        uint64_t seed_1 = request_addr + static_cast<uint64_t>(minor_counter);
-        uint64_t seed_2 = request_addr + 16 + major_counter;
-        uint64_t seed_3 = request_addr + 16 + static_cast<uint64_t>(minor_counter);
-        uint64_t seed_4 = request_addr + 32 + major_counter;
-        uint64_t seed_5 = request_addr + 32 + static_cast<uint64_t>(minor_counter);
-        uint64_t seed_6 = request_addr + 48 + major_counter;
-        uint64_t seed_7 = request_addr + 48 + static_cast<uint64_t>(minor_counter);
-        m_bus.write64(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_0, seed_0);
-        m_bus.write64(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_1, seed_1);
-        m_bus.write64(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_2, seed_2);
-        m_bus.write64(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_3, seed_3);
-        m_bus.write64(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_4, seed_4);
-        m_bus.write64(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_5, seed_5);
-        m_bus.write64(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_6, seed_6);
-        m_bus.write64(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_7, seed_7);
+    void makeseed_otp(uint64_t request_addr, uint64_t major_counter, uint64_t minor_counter){
+        TimelineTrace::Scope scope(m_timeline, TimelineTrace::Track::FIRMWARE, "makeseed_otp");
+        SIM_LOG(CORE, TRACE, "[Core FW] Setting up AES seeds for OTP generation...");
+        SIM_LOG(CORE, TRACE, "[Core FW] Major Counter: " << major_counter << ", Minor Counter: " << minor_counter);
+        // 16Bの各カウンターブロックは (アドレス+オフセット+メジャー, アドレス+オフセット+マイナー)
+        std::array<uint64_t, 8> seeds;
+        for (uint64_t i = 0; i < 4; ++i) {
+            seeds[2 * i] = request_addr + 16 * i + major_counter;
+            seeds[2 * i + 1] = request_addr + 16 * i + minor_counter;
+        }
+        // INPUT_0〜INPUT_7を1回のバーストで書き込む
+        m_bus.writeBurst(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::INPUT_0, reinterpret_cast<const uint8_t*>(seeds.data()));
         m_bus.write64(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::START, 1); 
     }
     /**
      * @brief コア上で実行されるファームウェア/ドライバに相当する認証アルゴリズム
      */
     void runAuthentication() {
-        std::cout << "[Core FW] --- Authentication Start ---\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] --- Authentication Start ---");
+        beginRequest();
         // --- 手順0: AXI Managerのリクエスト内容を確認し、必要な初期化を実施 ---
         // アドレスを取得
         auto ctx = setupAddressContext();
-        std::cout << "[Core FW] Request Address: 0x" << std::hex << ctx.request_addr << std::dec << "\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] Request Address: 0x" << std::hex << ctx.request_addr);
 
         // --- 手順1: SPMからカウンターを読み取り、インクリメントしてSPMに書き戻し ---
         // 初めにspmにあるカウンターのアドレスを確認する
-        std::cout << "[Core FW] Step 1: Handling counter block in SPM...\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] Step 1: Handling counter block in SPM...");
         // bool hit = tag_check(ctx.spm_counter_manage, ctx.counterblock_addr);
         // まずは検証を行う
-        std::array<uint64_t,4> path_index; // 先頭は階層1
-        for (int i=0;i<4;i++){
-            path_index[3-i] = (ctx.request_addr / (64 * (1ULL << (5 * i))));
-        }
+        PathIndices path_index = pathIndices(ctx.request_addr); // 先頭は階層1
         // print path_index
-        std::cout << "[Core FW] Path Indices: ";
-        for (int i=0;i<4;i++){
-            std::cout << path_index[i] << " ";
-        }
-        std::cout << "\n";
+        SIM_LOG(CORE, TRACE, "[Core FW] Path Indices: " << [&] {
+            std::ostringstream os;
+            for (uint64_t i = 0; i < Parameter::HEIGHT; i++) os << path_index[i] << " ";
+            return os.str();
+        }());
         {
-            ensureBlockInSpm(ctx.counterblock_addr, ctx.spm_counter_block, ctx.spm_counter_manage, "Counter");
-            uint64_t major_counter = m_bus.read64(ctx.spm_counter_block);
-            uint64_t minor_counter_byte_address = ctx.spm_counter_block + (ctx.counter_bit_offset / 64) * 8;
-            uint64_t minor_counter = m_bus.read64(minor_counter_byte_address);
-            // ここから過去のminor counterを取り出す
-            uint8_t minor_counter_value = (minor_counter >> ((ctx.counter_bit_offset % 64) )) & 0xFF;
-            if (minor_counter_value != 0 || major_counter != 0){
-                // メジャーマイナー、どちらかが0でなければ検証を行う
-                // 1. パスの特定=親ノードの物理アドレスをルートまで計算していく。
-                bool verified = verifyTreePath(path_index);
-                if (verified == false){
-                    std::cout << "[Core FW] Authentication failed during counter verification. Aborting.\n";
-                    exit(1);
-                }
+            // カウンターブロックはこのリクエスト中は使用中として扱われ、追い出されない
+            ctx.spm_counter_block = ensureBlockInSpm(ctx.counterblock_addr, "Counter");
+            // 自分のカウンターが0でも、同じブロックの他のカウンターを改ざんされていないか検証する
+            // (一度も書き込まれていないブロックはverifyTreePathで正当と判定する)
+            // 即時更新ではパス上の全ノードのMACを再計算するため、全ノードを検証しておく
+            bool verified = verifyTreePath(path_index, Parameter::SPM_TREE_UPDATE == Parameter::TreeUpdate::EAGER);
+            if (verified == false){
+                SIM_LOG(CORE, ERROR, "[Core FW] Authentication failed during counter verification. Aborting.");
+                exit(1);
             }
         }
         // 手順1.1 : カウンターを読み取り、インクリメントして書き戻しツリーの認証を行う
-        std::cout << "[Core FW] Incrementing minor counter and updating major counter and tree\n";
-        // root update
-        uint64_t spm_root_addr = MemoryMap::SPM_BASE_ADDR + 0 * 64;
-        uint64_t root = m_bus.read64(spm_root_addr);
-        uint64_t new_root = root + 1;
-        m_bus.write64(spm_root_addr, new_root);
-        uint64_t height = 1;
-        for (uint64_t i=0;i<Parameter::HEIGHT;i++){
-            std::cout << "[Core FW] Processing Counter Level " << height << "\n";
-            uint64_t spm_addr = MemoryMap::SPM_BASE_ADDR + (6-i) * 64;
-            uint64_t spm_manage = MemoryMap::SPM_BASE_ADDR + 56 * 64 + (6-i) * 8;
-            uint64_t dram_addr = MemoryMap::COUNTER_BASE_ADDR + path_index[i] / 32 * 64;
-            dram_addr += level_base_addr[i];
-            ensureBlockInSpm(dram_addr, spm_addr, spm_manage, "Counter Level " + std::to_string(height));
-            height += 1;
-            // ここから過去のmajor, minor counterを取り出す
-            uint64_t major_counter = m_bus.read64(spm_addr);
-            uint64_t minor_counter_byte_address = spm_addr + 8 + (path_index[i] % 32) / 8 * 8;
-            uint64_t minor_counter = m_bus.read64(minor_counter_byte_address);
-            // ここから過去のminor counterを取り出す
-            uint8_t minor_counter_value = (minor_counter >> ((path_index[i] % 8) * 8)) & 0xFF;
-            uint8_t new_minor_counter = 0;
-            if (minor_counter_value == 0xFF){
-                uint64_t new_major_counter = major_counter + 1;
-                m_bus.write64(spm_addr, new_major_counter);
-                new_minor_counter = 0; // minor counterは0に戻す
-                std::cout << "[Core FW] Minor counter overflow at level " << height-1 << ". Incrementing major counter.\n";
-                // exit(1); // 今回はエラーにする
-            } else {
-                new_minor_counter = minor_counter_value + 1;
-            }
-            uint64_t shift_amount = (path_index[i] % 8) * 8;
-            uint64_t clear_mask = ~(0xFFULL << shift_amount);
-            uint64_t cleared_minor_counter = minor_counter & clear_mask;
-            // --- 新しい値を正しい位置へシフトする ---
-            uint64_t shifted_new_value = static_cast<uint64_t>(new_minor_counter) << shift_amount;
-            uint64_t final_word = cleared_minor_counter | shifted_new_value;
-            // カウンターをprint
-            std::cout << "[Core FW] Loaded Counter - Major: " << major_counter << ", Minor: " << static_cast<uint32_t>(new_minor_counter) << "\n";
-            // 書き戻し
-            m_bus.write64(minor_counter_byte_address, final_word);
-            // ブロックをdirtyに設定する
-            setBlockdirty(spm_manage, dram_addr);
-            // MAC計算を実行
-            // Hash関数を初期化してから当該ブロックをMAC
-            while(m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS) != 0) {}
-            m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 1); // 1: Initialize
-            // busy wait
-            while(m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS) != 0) {}
-            // SPMからこの階層のブロックをコピーし、update
-            setMacBuffer(spm_addr, 0, 448-1); // 448
-            // 親ノードのヘッダーをMACの内部バッファにセット
-            if (i == 0){
-                // 最上位層はrootノードを使う
-                setMacBuffer(MemoryMap::SPM_BASE_ADDR, 0, 63);
-            } else {
-                uint64_t parent_offset = path_index[i-1] % 32 * 8;
-                setMacBuffer(spm_addr + 64, 64 + parent_offset ,64 + parent_offset + 7); 
+        enterPhase(Phase::COUNTER_UPDATE);
+        SIM_LOG(CORE, DEBUG, "[Core FW] Incrementing minor counter and updating major counter and tree");
+        if constexpr (Parameter::SPM_TREE_UPDATE == Parameter::TreeUpdate::LAZY) {
+            // リーフ(カウンターブロック)のカウンターのみ更新する。
+            // 祖先のカウンターとMACは、Dirtyなノードが追い出される時に更新する (writeBackTreeNode)
+            uint64_t new_minor_counter = incrementMinorCounter(ctx.spm_counter_block, path_index[Parameter::HEIGHT - 1], true);
+            SIM_LOG(CORE, TRACE, "[Core FW] Loaded Counter - Major: " << m_bus.read64(ctx.spm_counter_block) << ", Minor: " << static_cast<uint32_t>(new_minor_counter));
+            uint64_t spm_manage = manageAddrOf(ctx.spm_counter_block);
+            // 検証済みのブロックを更新したので、MACは書き戻し時に再計算する
+            setBlockdirty(spm_manage);
+        } else {
+            // root update
+            uint64_t spm_root_addr = spmLineAddr(Parameter::SPM_ROOT_LINE);
+            uint64_t root = m_bus.read64(spm_root_addr);
+            uint64_t new_root = root + 1;
+            m_bus.write64(spm_root_addr, new_root);
+            uint64_t height = 1;
+            uint64_t parent_spm_addr = spm_root_addr;
+            for (uint64_t i=0;i<Parameter::HEIGHT;i++){
+                SIM_LOG(CORE, TRACE, "[Core FW] Processing Counter Level " << height);
+                uint64_t dram_addr = treeNodeAddr(i, path_index[i]);
+                uint64_t spm_addr = isPinnedLevel(i) ? pinnedNodeAddr(i, path_index[i])
+                                                     : ensureBlockInSpm(dram_addr, "Counter Level " + std::to_string(height));
+                uint64_t spm_manage = manageAddrOf(spm_addr);
+                height += 1;
+                // カウンターをインクリメントしてSPMに書き戻す
+                bool first_carry = i + 1 < Parameter::HEIGHT && isFirstCarry(spm_addr, path_index[i]);
+                uint64_t new_minor_counter = incrementMinorCounter(spm_addr, path_index[i], i == Parameter::HEIGHT - 1);
+                // 繰り上がったら未書き込みの子を用意する (データ用のラインは手順4まで空いている)
+                if (first_carry) initUnwrittenChildren(spm_addr, i, path_index[i], ctx.spm_data);
+                // カウンターをprint
+                SIM_LOG(CORE, TRACE, "[Core FW] Loaded Counter - Major: " << m_bus.read64(spm_addr) << ", Minor: " << static_cast<uint32_t>(new_minor_counter));
+                // ブロックをdirtyに設定する
+                setBlockdirty(spm_manage);
+                // 常駐階層はオンチップで信頼できるため、MACの再計算は不要
+                if (isPinnedLevel(i)) {
+                    parent_spm_addr = spm_addr;
+                    continue;
+                }
+                // MAC計算を実行 (親ノードはこの時点で更新済み)
+                uint64_t mac_result = computeNodeMac(spm_addr, i, parent_spm_addr, i == 0 ? 0 : path_index[i-1]);
+                m_bus.write64(spm_addr + 56, mac_result); // 56BにMACがある (ノードはverifyTreePathで検証済み)
+                parent_spm_addr = spm_addr;
             }
-            // MAC計算完了
-            m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 4); // 4: MAC Finalize
-            while(m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS) != 0) {}
-            uint64_t mac_result = m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::MAC_RESULT);
-            m_bus.write64(spm_addr + 56, mac_result); // 56BにMACがある
         }
         uint64_t major_counter = m_bus.read64(ctx.spm_counter_block);
-        // minor_counterのload
-        // bitオフセットを元にアドレスを8Bにアライメントして、minor counterを含む64ビットを読み出す.
-        uint64_t minor_counter_byte_address = ctx.spm_counter_block + (ctx.counter_bit_offset / 64) * 8;
-        uint64_t minor_counter = m_bus.read64(minor_counter_byte_address);
-        uint8_t minor_counter_value = (minor_counter >> ((ctx.counter_bit_offset % 64))) & 0xFF;
+        // minor_counterのload (ビットオフセットから読み出す)
+        uint64_t minor_counter_value = readNodeBits(ctx.spm_counter_block, ctx.counter_bit_offset, Geometry::MINOR_BITS);
         // --- 手順2: アドレスとカウンター値を元にSeed値を計算し、AES_moduleに書き込み起動する ---
+        enterPhase(Phase::OTP);
         makeseed_otp(ctx.request_addr, major_counter, minor_counter_value);
         // --- 手順3: AXI ManagerにOTPとともにXORを実行し、暗号化を指示 ---
-        std::cout << "[Core FW] Step 3: Commanding AXI Manager to encrypt data...\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] Step 3: Commanding AXI Manager to encrypt data...");
         // busy wait AESモジュールの計算完了を待つ
         pollUntilReady(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::START);
         m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::COMMAND, 4); // 8: Encrypt
@@ -347,77 +1055,69 @@ private:
         // --- 手順4: AXI Managerに暗号文をSPMにwrite backするよう指示 ---
         m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::SPM_ADDR, ctx.spm_data);
         m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::COMMAND, 1); // 4: Write Back to SPM
+        pollUntilReady(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY);
         // --- 手順5: HashモジュールにSPM上の暗号文と書き込んだカウンターを元にMAC計算を指示 ---
-        std::cout << "[Core FW] Step 5: Commanding Hash module to compute MAC...\n";
-        // ハッシュ関数の内部状態を初期化
-        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
-        m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 1); // 1: Initialize
-        // busy wait
-        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
-        // SPMから暗号文をコピーし、update
-        setMacBuffer(ctx.spm_data, 0, 511);
-        // SPMからカウンターブロックをコピー
-        setMacBuffer(ctx.spm_counter_block, ctx.counter_bit_offset, ctx.counter_bit_offset + 7); // todo: correct end bit length
-        // MAC計算完了
-        m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 4); // 4: MAC Finalize
+        enterPhase(Phase::MAC);
+        SIM_LOG(CORE, DEBUG, "[Core FW] Step 5: Commanding Hash module to compute MAC...");
         // --- 手順6: Hashモジュールの計算完了を待ち、結果をSPMに保存 ---
         // SPMに当該MACブロックがあればそのままmodify,なければ今あるブロックをDRAMにwrite backしてから適切なブロックをSPMにDRAMコピー
-        ensureBlockInSpm(ctx.datamacblock_addr, ctx.spm_mac_block, ctx.spm_mac_manage, "MAC");
-        pollUntilReady(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS);
-        uint64_t computed_mac = m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::MAC_RESULT);
+        // (MACブロックのロード時の追い出しでツリーノードのMAC計算が走る場合があるため、先に結果を取得しておく)
+        uint64_t computed_mac = computeDataMac(ctx.spm_data, ctx.spm_counter_block, ctx.counter_bit_offset);
+        ctx.spm_mac_block = ensureBlockInSpm(ctx.datamacblock_addr, "MAC");
         m_bus.write64(ctx.spm_mac_block + ctx.dmac_byte_offset, computed_mac);
-        std::cout << "[Core FW] Computed MAC: 0x" << std::hex << computed_mac << std::dec << "\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] Computed MAC: 0x" << std::hex << computed_mac);
         // SPM上のMACブロックをDirtyに設定する
-        setBlockdirty(ctx.spm_mac_manage, ctx.datamacblock_addr);
+        setBlockdirty(manageAddrOf(ctx.spm_mac_block));
         // --- 手順7: SPM DMAを起動し、SPMからDRAMへ暗号文をwrite back ---
+        enterPhase(Phase::WRITEBACK);
         startSpmDma(ctx.request_addr, ctx.spm_data, 64, 1); // 1: SPM -> DRAM
         pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
         // --- 手順8: AXI managerに対し、write ackの完了を通知 ---
         // busy wait
-        while(m_bus.read64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY) != 0) {}
+        pollUntilReady(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY);
         m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::COMMAND, 32); // 32: Write Ack
 
-        std::cout << "[Core FW] --- Authentication Finished ---\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] --- Authentication Finished ---");
     }
     /**
      * @brief コア上で実行されるファームウェア/ドライバに相当する検証アルゴリズム
      */
     void runVerification() {
-        std::cout << "[Core FW] --- Verification Start ---\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] --- Verification Start ---");
+        beginRequest();
         // uint64_t request_addr = m_bus.read64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::REQ_ADDR);
         auto ctx = setupAddressContext();
-        std::cout << "[Core FW] Request Address: 0x" << std::hex << ctx.request_addr << std::dec << "\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] Request Address: 0x" << std::hex << ctx.request_addr);
         // --- 手順1: SPMからカウンターをload ---
         // 初めにspmにあるカウンターのアドレスを確認する
-        std::cout << "[Core FW] Step 1: Handling counter block in SPM...\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] Step 1: Handling counter block in SPM...");
         // --- 手順1.1 : ツリー検証 ---
         {
             // missの場合、カウンターブロックの検証が必要
             // 1. パスの特定=親ノードの物理アドレスをルートまで計算していく。
-            std::array<uint64_t,4> path_index; // 先頭は階層1
-            for (int i=0;i<4;i++){
-                path_index[3-i] = (ctx.request_addr / (64 * (1ULL << (5 * i))));
-            }
+            PathIndices path_index = pathIndices(ctx.request_addr); // 先頭は階層1
             bool verified = verifyTreePath(path_index);
             if (verified == false){
-                std::cout << "[Core FW] Verification failed during counter verification. Aborting.\n";
+                SIM_LOG(CORE, ERROR, "[Core FW] Verification failed during counter verification. Aborting.");
                 exit(1);
             }
         }
         // --- 手順1.2 : ツリーの検証は終了、カウンターのload ---
+        ctx.spm_counter_block = ensureBlockInSpm(ctx.counterblock_addr, "Counter");
         uint64_t major_counter = m_bus.read64(ctx.spm_counter_block);
-        // minor_counterのload
-        // bitオフセットを元にアドレスを8Bにアライメントして、minor counterを含む64ビットを読み出す.
-        uint64_t minor_counter_byte_address = ctx.spm_counter_block + (ctx.counter_bit_offset / 64) * 8;
-        uint64_t minor_counter = m_bus.read64(minor_counter_byte_address);
-        uint8_t minor_counter_value = (minor_counter >> ((ctx.counter_bit_offset % 64) )) & 0xFF;
-        std::cout << "[Core FW] Loaded Counter - Major: " << major_counter << ", Minor: " << static_cast<uint32_t>(minor_counter_value) << "\n";
+        // minor_counterのload (ビットオフセットから読み出す)
+        uint64_t minor_counter_value = readNodeBits(ctx.spm_counter_block, ctx.counter_bit_offset, Geometry::MINOR_BITS);
+        SIM_LOG(CORE, TRACE, "[Core FW] Loaded Counter - Major: " << major_counter << ", Minor: " << static_cast<uint32_t>(minor_counter_value));
         // --- 手順2: アドレスとカウンター値を元にSeed値を計算し、AES_moduleに書き込み起動する ---
+        enterPhase(Phase::OTP);
         makeseed_otp(ctx.request_addr, major_counter, minor_counter_value);
         // --- 手順3: SPM DMAを起動し、DRAMから暗号文をSPMにコピー ---
-        std::cout << "[Core FW] Step 3: Commanding SPM DMA to copy ciphertext from DRAM to SPM...\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] Step 3: Commanding SPM DMA to copy ciphertext from DRAM to SPM...");
+        enterPhase(Phase::DATA_LOAD);
         startSpmDma(ctx.request_addr, ctx.spm_data, 64, 0); // 0: DRAM -> SPM
-        std::cout << "[Core FW] Ciphertext loaded from DRAM to SPM.\n";
+        pollUntilReady(MemoryMap::MMIO_SPM_DMA_BASE_ADDR + MemoryMap::SPM_Reg::START);
+        SIM_LOG(CORE, DEBUG, "[Core FW] Ciphertext loaded from DRAM to SPM.");
+        enterPhase(Phase::OTP);
         // --- 手順3: AXI ManagerにOTPとともにXORを実行し、復号化を指示 ---
         // SPMからAXI Managerへ暗号文をコピー
         pollUntilReady(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY);
@@ -426,45 +1126,45 @@ private:
         // AESの完了を待つ
         pollUntilReady(MemoryMap::MMIO_AES_ACCEL_BASE_ADDR + MemoryMap::AesReg::START);
         // 復号化を指示
-        std::cout << "[Core FW] Step 4: Commanding AXI Manager to decrypt ciphertext in SPM...\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] Step 4: Commanding AXI Manager to decrypt ciphertext in SPM...");
         // busy wait
         pollUntilReady(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY);
         m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::COMMAND, 8); // 8: Decrypt Data in SPM
 
         // --- 手順5: HashモジュールにSPM上の暗号文と書き込んだカウンターを元にMAC計算を指示 ---
-        std::cout << "[Core FW] Step 5: Commanding Hash module to compute MAC...\n";
-        // ハッシュ関数の内部状態を初期化
-        while(m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS) != 0) {}
-        m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 1); // 1: Initialize
-        // busy wait
-        while(m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS) != 0) {}
-        // SPMから暗号文をコピーし、update
-        setMacBuffer(ctx.spm_data, 0, 511);
-        // SPMからカウンターブロックをコピー
-        setMacBuffer(ctx.spm_counter_block, ctx.counter_bit_offset, ctx.counter_bit_offset + 7); // todo: correct end bit length
-        // MAC計算完了
-        m_bus.write64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::COMMAND, 4); // 4: MAC Finalize
-        while(m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::STATUS) != 0) {}
+        enterPhase(Phase::MAC);
+        SIM_LOG(CORE, DEBUG, "[Core FW] Step 5: Commanding Hash module to compute MAC...");
+        uint64_t mac_result = computeDataMac(ctx.spm_data, ctx.spm_counter_block, ctx.counter_bit_offset);
 
         // --- 手順6: Hashモジュールの計算完了を待ち、結果を取得しSPMから正しい結果をload ---
-        uint64_t mac_result = m_bus.read64(MemoryMap::MMIO_MAC_BASE_ADDR + MemoryMap::MacReg::MAC_RESULT);
         // SPMに当該MACブロックがあるかを確認。なければコピー。
-        ensureBlockInSpm(ctx.datamacblock_addr, ctx.spm_mac_block, ctx.spm_mac_manage, "MAC");
+        ctx.spm_mac_block = ensureBlockInSpm(ctx.datamacblock_addr, "MAC");
         uint64_t expected_mac = m_bus.read64(ctx.spm_mac_block + ctx.dmac_byte_offset);
         if (mac_result != expected_mac) {
-            std::cout << "[Core FW] MAC verification failed. Aborting operation.\n";
+            SIM_LOG(CORE, ERROR, "[Core FW] MAC verification failed. Aborting operation.");
             // エラー処理: MAC不一致
             exit(1);
         }
         
         // --- 手順7: AXI managerに対し、read bufferにあるデータをリターンするように指示 ---
-        std::cout << "[Core FW] Step 7: Commanding AXI manager to return data in read buffer...\n";
+        enterPhase(Phase::WRITEBACK);
+        SIM_LOG(CORE, DEBUG, "[Core FW] Step 7: Commanding AXI manager to return data in read buffer...");
         // busy wait
-        while(m_bus.read64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY) != 0) {}
+        pollUntilReady(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::BUSY);
         m_bus.write64(MemoryMap::MMIO_AXI_MGR_BASE_ADDR + MemoryMap::AxiManagerReg::COMMAND, 16); // 1: Return Data
-        std::cout << "[Core FW] --- Verification Finished ---\n";
+        SIM_LOG(CORE, DEBUG, "[Core FW] --- Verification Finished ---");
     }
 
 private:
     Bus& m_bus;
+    EventScheduler& m_scheduler;
+    RequestProfile m_profile;
+    uint64_t m_request_addr = 0; // 処理中のリクエストのアドレス (受け付け時にREQ_ADDRから読む)
+    SpmCacheStats m_cache_stats;
+    PerfCounters* m_perf = nullptr;
+    TrafficStats* m_traffic = nullptr;
+    TimelineTrace* m_timeline = nullptr;
+    Phase m_phase = Phase::TREE_VERIFY;
+    EventScheduler::Cycle m_phase_start = 0;
+    uint64_t m_request_lines = 0; // 現在のリクエストで使用中のSPMライン (bit = ライン番号)
 };
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cstring>
 #include "memory_map.hpp"
+#include "logger.hpp"
 class Spm {
 public:
     static constexpr size_t SPM_SIZE = MemoryMap::SPM_SIZE; // 4KB
@@ -28,6 +29,19 @@ public:
             exit(1);
         }
     }
+
+    /**
+     * @brief [addr, addr + size)の記憶領域を直接指すポインタを返す
+     * @details DMAがDramとの間で一時バッファを介さずにコピーするために使う。ポインタはSpmの寿命の間有効
+     */
+    uint8_t* view(uint64_t addr, uint64_t size) {
+        uint64_t local_addr = addr - MemoryMap::SPM_BASE_ADDR;
+        if (local_addr + size > SPM_SIZE) {
+            std::cerr << "SPM: Access out of bounds! Addr: 0x" << std::hex << addr << ", Size: " << std::dec << size << "\n";
+            exit(1);
+        }
+        return &m_memory[local_addr];
+    }
     
         // // 32ビット単位のアクセス
         // void write32(uint32_t addr, uint32_t data) {
@@ -53,7 +67,7 @@ public:
     void write64(uint64_t addr, uint64_t data) {
         // アドレスが8バイトの書き込み範囲内にあるかチェック
         uint64_t local_addr = addr - MemoryMap::SPM_BASE_ADDR;
-        std::cout << "[SPM] Write64 to address 0x" << std::hex << addr << " data 0x" << data << std::dec << "\n";
+        SIM_LOG(SPM, TRACE, "[SPM] Write64 to address 0x" << std::hex << addr << " data 0x" << data);
         if (local_addr + 8 <= SPM_SIZE) {
             // 指定アドレスをuint64_t型ポインタとして解釈し、データを一括で書き込む
             *reinterpret_cast<uint64_t*>(&m_memory[local_addr]) = data;
@@ -69,7 +83,7 @@ public:
         // アドレスが8バイトの読み出し範囲内にあるかチェック
         uint64_t local_addr = addr - MemoryMap::SPM_BASE_ADDR;
         if (local_addr + 8 <= SPM_SIZE) {
-            std::cout << "[SPM] Read64 from address 0x" << std::hex << addr << std::dec << "\n";    
+            SIM_LOG(SPM, TRACE, "[SPM] Read64 from address 0x" << std::hex << addr);
             // 指定アドレスをuint64_t型ポインタとして解釈し、データを一括で読み出す
             return *reinterpret_cast<uint64_t*>(&m_memory[local_addr]);
         } else {
@@ -2,9 +2,16 @@
 #include "memory_map.hpp"
 #include "dram.hpp"
 #include "spm.hpp"
+#include "logger.hpp"
+#include "event_scheduler.hpp"
+#include "perf_counters.hpp"
+#include "timeline_trace.hpp"
 #include <iostream>
+#include <algorithm>
+#include <array>
 #include <vector>
 #include <cstdint>
+#include <cstdio>
 
 class SpmModule {
 public:
@@ -12,9 +19,10 @@ public:
      * @brief コンストラクタ
      * @param dram データ転送の相手となるDramオブジェクトへの参照
      * @param spm データ転送の相手となるSpmオブジェクトへの参照
+     * @param scheduler 転送完了イベントを登録するスケジューラ
      */
-    SpmModule(Dram& dram, Spm& spm) 
-        : m_dram(dram), m_spm(spm), m_start_reg(0) {}
+    SpmModule(Dram& dram, Spm& spm, EventScheduler& scheduler) 
+        : m_dram(dram), m_spm(spm), m_scheduler(scheduler), m_start_reg(0) {}
 
     /**
      * @brief 64bitのMMIO書き込みを処理
@@ -22,7 +30,7 @@ public:
     void mmioWrite64(uint32_t offset, uint64_t value) {
         // STARTレジスタが1(Busy)の場合、新たなコマンドを受け付けない
         if (m_start_reg == 1) {
-            std::cout << "  [SPM-DMA HW] Ignored write while busy.\n";
+            SIM_LOG(DMA, WARN, "  [SPM-DMA HW] Ignored write while busy.");
             return;
         }
 
@@ -45,6 +53,19 @@ public:
                     executeTransfer();
                 }
                 break;
+            case MemoryMap::SPM_Reg::RING_PUSH:
+                if (!pushRegisterDescriptor((value & 1) != 0, false)) {
+                    SIM_LOG(DMA, WARN, "  [SPM-DMA HW] Descriptor ring full. Ignored.");
+                }
+                break;
+            case MemoryMap::SPM_Reg::SG_START:
+                startGather(value);
+                break;
+            default:
+                if (offset >= MemoryMap::SPM_Reg::SG_LIST && offset < MemoryMap::SPM_Reg::SG_LIST + SG_ENTRIES * 16) {
+                    m_sg_list[(offset - MemoryMap::SPM_Reg::SG_LIST) / 8] = value;
+                }
+                break;
         }
     }
 
@@ -52,63 +73,291 @@ public:
      * @brief 64bitのMMIO読み出しを処理
      */
     uint64_t mmioRead64(uint32_t offset) {
-        // STARTレジスタのみ読み出し可能
-        if (offset == MemoryMap::SPM_Reg::START) {
-            return m_start_reg;
+        switch (offset) {
+            case MemoryMap::SPM_Reg::START:
+                return m_start_reg;
+            case MemoryMap::SPM_Reg::RING_STATUS:
+                return pendingCount() | (freeSlot() << 8);
+            case MemoryMap::SPM_Reg::RING_DONE:
+                return m_done_bitmap;
+            case MemoryMap::SPM_Reg::RING_LAST_SLOT:
+                return m_last_slot;
+            case MemoryMap::SPM_Reg::SG_START:
+                return m_sg_busy ? 1 : 0;
+            case MemoryMap::SPM_Reg::SG_LINES:
+                return m_sg_lines;
         }
         return 0;
     }
 
+    /**
+     * @brief 性能カウンターを接続する (接続しない場合は数えない)
+     */
+    void attachPerfCounters(PerfCounters& perf) { m_perf = &perf; }
+    /**
+     * @brief タイムラインを接続する (転送ごとの区間を記録する)
+     */
+    void attachTimeline(TimelineTrace& timeline) { m_timeline = &timeline; }
+
 private:
+    static constexpr uint64_t RING_SIZE = Parameter::SPM_DMA_RING_SIZE;
+    static constexpr uint64_t SG_ENTRIES = Parameter::SPM_DMA_SG_ENTRIES;
+
+    // ディスクリプタリングの1スロット
+    struct Descriptor {
+        enum class State { FREE, QUEUED, ACTIVE };
+        uint64_t dram_addr = 0;
+        uint64_t spm_addr = 0;
+        uint64_t size = 0;
+        uint64_t direction = 0;     // 0: DRAM -> SPM, 1: SPM -> DRAM
+        bool high_priority = false;
+        bool single = false;        // STARTレジスタによる単発の転送
+        bool gather = false;        // スキャッター・ギャザー (転送するラインはm_sg_activeにある)
+        uint64_t seq = 0;           // 投入順
+        State state = State::FREE;
+    };
+
     /**
-     * @brief DMA転送を実行する
+     * @brief STARTレジスタによる単発の転送
+     * @details ディスクリプタリングに1つ投入し、その完了でSTARTレジスタをクリアする。
+     *          リングが空いていれば投入と同時に開始し、転送サイズに応じた処理時間(Parameter::dmaCycles)後に完了する。
+     *          リングが満杯なら、STARTをBusyのまま(レジスタの書き込みも受け付けない)スロットが空くのを待って投入する。
      */
     void executeTransfer() {
         m_start_reg = 1; // 1: Busy
-        std::cout << "  [SPM-DMA HW] Transfer Started.\n"
-                  << "    DRAM Addr: 0x" << std::hex << m_dram_addr_reg
-                  << ", SPM Addr: 0x" << m_spm_addr_reg
-                  << ", Size: " << std::dec << m_size_reg
-                  << ", Direction: " << (m_direction_reg == 0 ? "DRAM->SPM" : "SPM->DRAM") << "\n";
-        
         // 転送サイズが0の場合は何もしない
         if (m_size_reg == 0) {
              m_start_reg = 0; // 0: Idle
              return;
         }
+        if (!pushRegisterDescriptor(false, true)) m_start_deferred = true;
+    }
+
+    /**
+     * @brief レジスタの内容をディスクリプタとしてリングに投入する
+     * @return リングが満杯で投入できなかった場合はfalse
+     */
+    bool pushRegisterDescriptor(bool high_priority, bool single) {
+        Descriptor d;
+        d.dram_addr = m_dram_addr_reg;
+        d.spm_addr = m_spm_addr_reg;
+        d.size = m_size_reg;
+        d.direction = m_direction_reg;
+        d.high_priority = high_priority;
+        d.single = single;
+        return pushDescriptor(d);
+    }
 
-        // 一時的なバッファを使ってデータを転送
-        std::vector<uint8_t> buffer(m_size_reg);
+    /**
+     * @brief スキャッター・ギャザーのコマンドを開始する
+     * @details SG_LISTの先頭count個のエントリを取り込み、1つのディスクリプタとしてリングに投入する。
+     *          エントリはリストの順に実行する(追い出すブロックの書き戻しを、同じラインへのロードより前に置く)。
+     *          全ラインを1回の起動で連続して転送するため、DRAMのレイテンシは1回分で済む。
+     *          このディスクリプタは、先に投入された転送が全て完了してから開始し、完了するまで後の転送を開始しない。
+     *          リングが満杯なら、実行中(SG_STARTが1)のままスロットが空くのを待って投入する。
+     */
+    void startGather(uint64_t count) {
+        if (m_sg_busy) {
+            SIM_LOG(DMA, WARN, "  [SPM-DMA HW] Scatter-gather already running. Ignored.");
+            return;
+        }
+        if (count == 0 || count > SG_ENTRIES) {
+            SIM_LOG(DMA, WARN, "  [SPM-DMA HW] Invalid scatter-gather entry count: " << count);
+            return;
+        }
+        std::copy(m_sg_list.begin(), m_sg_list.begin() + 2 * count, m_sg_active.begin());
+        m_sg_busy = true;
+        m_sg_deferred_lines = pushGatherDescriptor(count) ? 0 : count;
+    }
+    /**
+     * @brief m_sg_activeの先頭lines個のラインを転送するディスクリプタを投入する
+     * @return リングが満杯で投入できなかった場合はfalse
+     */
+    bool pushGatherDescriptor(uint64_t lines) {
+        Descriptor d;
+        d.size = lines * LINE_SIZE;
+        d.gather = true;
+        return pushDescriptor(d);
+    }
 
-        if (m_direction_reg == 0) { // 0: コピー (DRAMからSPM)
-            // Dramから一時バッファへ読み出し
-            m_dram.read(m_dram_addr_reg, buffer.data(), m_size_reg);
-                    std::cout << "    Data: ";
-        for (size_t i = 0; i < m_size_reg; ++i) {
-            std::cout << std::hex << static_cast<int>(buffer[i]) << " ";
+    /**
+     * @brief ディスクリプタをリングに投入し、使ったスロットをRING_LAST_SLOTに残す
+     * @return リングが満杯で投入できなかった場合はfalse (RING_LAST_SLOTはRING_SIZE)
+     */
+    bool pushDescriptor(const Descriptor& desc) {
+        uint64_t slot = freeSlot();
+        m_last_slot = slot;
+        if (slot == RING_SIZE) return false;
+        m_done_bitmap &= ~(1ULL << slot);
+        if (desc.size == 0) { // 転送サイズが0の場合は即座に完了
+            m_done_bitmap |= 1ULL << slot;
+            return true;
         }
-        std::cout << std::dec << "\n";  
-            // 一時バッファからSpmへ書き込み
-            m_spm.write(m_spm_addr_reg, buffer.data(), m_size_reg);
+        Descriptor& d = m_ring[slot];
+        d = desc;
+        d.seq = m_next_seq++;
+        d.state = Descriptor::State::QUEUED;
+        m_next_slot = (slot + 1) % RING_SIZE;
+        issue();
+        return true;
+    }
+
+    /**
+     * @brief チャネルが空いていれば、開始できるディスクリプタを1つ開始する
+     * @details 優先度の高いものを先に、同じ優先度では投入順に選ぶ。ただし、先に投入された未開始の転送と
+     *          SPMまたはDRAMの範囲が重なる転送や、転送中のSPMへのロードと範囲が重なる転送は追い越さない
+     *          (追い出すブロックの書き戻しと、同じラインへのロードの順序を保つ)。
+     *          1つの転送がチャネルを占有するのは起動とデータ転送の間(Parameter::dmaIssueCycles)だけで、DRAMのレイテンシは次の転送と重なる。
+     */
+    void issue() {
+        if (m_issue_pending) return;
+        uint64_t slot = selectDescriptor();
+        if (slot == RING_SIZE) return;
+        if (m_scheduler.now() < m_channel_free_at) {
+            m_issue_pending = true;
+            m_scheduler.schedule(m_channel_free_at - m_scheduler.now(), [this] {
+                m_issue_pending = false;
+                issue();
+            });
+            return;
+        }
+        startDescriptor(slot);
+        issue(); // 続けて開始できるものがあれば、チャネルが空いた時点で開始する
+    }
+
+    uint64_t selectDescriptor() const {
+        uint64_t best = RING_SIZE;
+        for (uint64_t s = 0; s < RING_SIZE; ++s) {
+            const Descriptor& d = m_ring[s];
+            if (d.state != Descriptor::State::QUEUED || isBlocked(d)) continue;
+            if (best == RING_SIZE || d.high_priority > m_ring[best].high_priority ||
+                (d.high_priority == m_ring[best].high_priority && d.seq < m_ring[best].seq)) {
+                best = s;
+            }
+        }
+        return best;
+    }
+
+    bool isBlocked(const Descriptor& d) const {
+        for (const Descriptor& e : m_ring) {
+            if (e.state == Descriptor::State::FREE || e.seq >= d.seq) continue;
+            if (d.gather || e.gather) return true; // スキャッター・ギャザーの前後は追い越さない
+            bool spm_overlap = overlaps(e.spm_addr, e.size, d.spm_addr, d.size);
+            if (e.state == Descriptor::State::QUEUED && (spm_overlap || overlaps(e.dram_addr, e.size, d.dram_addr, d.size))) return true;
+            if (e.state == Descriptor::State::ACTIVE && e.direction == 0 && spm_overlap) return true;
+        }
+        return false;
+    }
+    static bool overlaps(uint64_t a, uint64_t a_size, uint64_t b, uint64_t b_size) {
+        return a < b + b_size && b < a + a_size;
+    }
+
+    /**
+     * @brief DMA転送を開始する
+     * @details データは開始時にDramとSpmの記憶領域の間で直接コピーし(一時バッファもヒープ確保も使わない)、
+     *          処理時間(Parameter::dmaCycles)後の完了イベントで完了ビットを立てる。
+     */
+    void startDescriptor(uint64_t slot) {
+        Descriptor& d = m_ring[slot];
+        d.state = Descriptor::State::ACTIVE;
+        m_channel_free_at = m_scheduler.now() + Parameter::dmaIssueCycles(d.size);
+        if (d.gather) {
+            startGatherDescriptor(slot);
+            return;
+        }
+        SIM_LOG(DMA, TRACE, "  [SPM-DMA HW] Transfer Started (slot " << slot << ").\n"
+                  << "    DRAM Addr: 0x" << std::hex << d.dram_addr
+                  << ", SPM Addr: 0x" << d.spm_addr
+                  << ", Size: " << std::dec << d.size
+                  << ", Direction: " << (d.direction == 0 ? "DRAM->SPM" : "SPM->DRAM"));
+        if (m_perf) {
+            m_perf->add(d.direction == 0 ? MemoryMap::PerfCounter::DMA_BYTES_TO_SPM : MemoryMap::PerfCounter::DMA_BYTES_TO_DRAM, d.size);
+        }
+
+        // SPMの記憶領域をDramの読み書きの相手として直接渡す
+        uint8_t* spm_data = m_spm.view(d.spm_addr, d.size);
+        if (d.direction == 0) { // 0: コピー (DRAMからSPM)
+            m_dram.read(d.dram_addr, spm_data, d.size);
         } else { // 1: ライトバック (SPMからDRAM)
-            // Spmから一時バッファへ読み出し
-            m_spm.read(m_spm_addr_reg, buffer.data(), m_size_reg);
-                    std::cout << "    Data: ";
-        for (size_t i = 0; i < m_size_reg; ++i) {
-            std::cout << std::hex << static_cast<int>(buffer[i]) << " ";
+            m_dram.write(d.dram_addr, spm_data, d.size);
+        }
+        SIM_LOG(DMA, TRACE, "    Data: " << Log::hexBytes(spm_data, d.size));
+
+        if (m_timeline && m_timeline->enabled()) {
+            char detail[32];
+            std::snprintf(detail, sizeof(detail), "0x%llx", static_cast<unsigned long long>(d.dram_addr));
+            m_timeline->complete(TimelineTrace::Track::SPM_DMA, d.direction == 0 ? "load" : "writeback",
+                                 m_scheduler.now(), m_scheduler.now() + Parameter::dmaCycles(d.size), detail);
+        }
+        m_scheduler.schedule(Parameter::dmaCycles(d.size), [this, slot] { completeDescriptor(slot); });
+    }
+
+    /**
+     * @brief スキャッター・ギャザーのディスクリプタを開始する
+     * @details 各ラインを開始時にリストの順にコピーし、全体の処理時間(Parameter::dmaCycles)後に完了する
+     */
+    void startGatherDescriptor(uint64_t slot) {
+        const Descriptor& d = m_ring[slot];
+        uint64_t lines = d.size / LINE_SIZE;
+        SIM_LOG(DMA, TRACE, "  [SPM-DMA HW] Scatter-gather Started (slot " << slot << ", " << lines << " lines).");
+        for (uint64_t i = 0; i < lines; ++i) {
+            uint64_t dram_addr = m_sg_active[2 * i] & ~(LINE_SIZE - 1);
+            uint64_t direction = m_sg_active[2 * i] & 1;
+            uint8_t* spm_data = m_spm.view(m_sg_active[2 * i + 1], LINE_SIZE);
+            SIM_LOG(DMA, TRACE, "    DRAM Addr: 0x" << std::hex << dram_addr << ", SPM Addr: 0x" << m_sg_active[2 * i + 1]
+                      << std::dec << ", Direction: " << (direction == 0 ? "DRAM->SPM" : "SPM->DRAM"));
+            if (direction == 0) {
+                m_dram.read(dram_addr, spm_data, LINE_SIZE);
+            } else {
+                m_dram.write(dram_addr, spm_data, LINE_SIZE);
+            }
+            if (m_perf) {
+                m_perf->add(direction == 0 ? MemoryMap::PerfCounter::DMA_BYTES_TO_SPM : MemoryMap::PerfCounter::DMA_BYTES_TO_DRAM, LINE_SIZE);
+            }
         }
-        std::cout << std::dec << "\n";  
-            // 一時バッファからDramへ書き込み
-            m_dram.write(m_dram_addr_reg, buffer.data(), m_size_reg);
+        if (m_timeline && m_timeline->enabled()) {
+            char detail[32];
+            std::snprintf(detail, sizeof(detail), "%llu lines", static_cast<unsigned long long>(lines));
+            m_timeline->complete(TimelineTrace::Track::SPM_DMA, "gather", m_scheduler.now(), m_scheduler.now() + Parameter::dmaCycles(d.size), detail);
         }
+        m_scheduler.schedule(Parameter::dmaCycles(d.size), [this, slot] { completeDescriptor(slot); });
+    }
+
+    void completeDescriptor(uint64_t slot) {
+        Descriptor& d = m_ring[slot];
+        SIM_LOG(DMA, TRACE, "  [SPM-DMA HW] Transfer Finished (slot " << slot << ").");
+        d.state = Descriptor::State::FREE;
+        m_done_bitmap |= 1ULL << slot;
+        if (d.single) m_start_reg = 0; // 0: Idle
+        if (d.gather) {
+            m_sg_busy = false;
+            m_sg_lines = d.size / LINE_SIZE;
+        }
+        // リングが満杯で待たせていたSTART・スキャッター・ギャザーを、空いたスロットに投入する
+        if (m_start_deferred && pushRegisterDescriptor(false, true)) m_start_deferred = false;
+        if (m_sg_deferred_lines != 0 && pushGatherDescriptor(m_sg_deferred_lines)) m_sg_deferred_lines = 0;
+        issue(); // 範囲が重なって待っていた転送を開始する
+    }
 
-        std::cout << "  [SPM-DMA HW] Transfer Finished.\n";
-        m_start_reg = 0; // 0: Idle
+    uint64_t pendingCount() const {
+        return static_cast<uint64_t>(std::count_if(m_ring.begin(), m_ring.end(),
+            [](const Descriptor& d) { return d.state != Descriptor::State::FREE; }));
+    }
+    // 次に投入するディスクリプタのスロット (満杯ならRING_SIZE)
+    uint64_t freeSlot() const {
+        for (uint64_t i = 0; i < RING_SIZE; ++i) {
+            uint64_t slot = (m_next_slot + i) % RING_SIZE;
+            if (m_ring[slot].state == Descriptor::State::FREE) return slot;
+        }
+        return RING_SIZE;
     }
 
     // --- 依存モジュール ---
     Dram& m_dram;
     Spm& m_spm;
+    EventScheduler& m_scheduler;
+    PerfCounters* m_perf = nullptr;
+    TimelineTrace* m_timeline = nullptr;
     
     // --- MMIOレジスタの状態 ---
     uint64_t m_dram_addr_reg = 0;
@@ -116,4 +365,22 @@ private:
     uint64_t m_size_reg = 0;
     uint64_t m_direction_reg = 0;
     uint64_t m_start_reg = 0; // 0: Idle, 1: Busy
+    bool m_start_deferred = false; // STARTの転送をリングの空き待ちにしている (レジスタはBusyの間変わらない)
+
+    // --- ディスクリプタリング ---
+    std::array<Descriptor, RING_SIZE> m_ring{};
+    uint64_t m_next_slot = 0;
+    uint64_t m_next_seq = 0;
+    uint64_t m_done_bitmap = 0;
+    uint64_t m_last_slot = RING_SIZE; // RING_LAST_SLOT: 最後に投入したディスクリプタのスロット
+    EventScheduler::Cycle m_channel_free_at = 0; // チャネルが次の転送を開始できる時刻
+    bool m_issue_pending = false;                // チャネルが空く時刻に開始処理を登録済み
+
+    // --- スキャッター・ギャザー ---
+    static constexpr uint64_t LINE_SIZE = 64;
+    std::array<uint64_t, 2 * SG_ENTRIES> m_sg_list{};   // SG_LISTレジスタ (エントリごとにDRAM側・SPM側の2ワード)
+    std::array<uint64_t, 2 * SG_ENTRIES> m_sg_active{}; // 実行中のコマンドが取り込んだリスト
+    bool m_sg_busy = false;
+    uint64_t m_sg_deferred_lines = 0; // リングの空き待ちにしているコマンドのライン数 (0: 無し)
+    uint64_t m_sg_lines = 0;
 };
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+#include "event_scheduler.hpp"
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief リクエスト処理のタイムライン (Chrome trace形式のJSON)
+ * @details コアのファームウェアの段階(SPMキャッシュのヒット・ミス、ツリーの各階層の検証、OTPのシード設定)と、
+ *          各モジュール(SPM-DMA・MAC・AES・AXIM)の処理を、モジュールごとのトラック上の区間として書き出す。
+ *          Perfetto (ui.perfetto.dev) またはchrome://tracingで読み込み、処理の重なる余地を確認するのに使う。
+ *          時刻はシミュレーションのサイクルで、1サイクル=1nsとして出力する。
+ *          イベントは発生した時点でファイルに書き出し、メモリには保持しない (長い実行でもメモリ使用量は一定)。
+ *          max_requestsを指定すると、その数のリクエストを処理した後は記録しない。
+ */
+class TimelineTrace {
+public:
+    using Cycle = EventScheduler::Cycle;
+
+    // トラック (Chrome traceのスレッドに対応する)
+    enum class Track { REQUEST = 1, PHASE, FIRMWARE, SPM_DMA, MAC, AES, AXIM };
+
+    explicit TimelineTrace(const EventScheduler& scheduler) : m_scheduler(scheduler) {}
+    TimelineTrace(const TimelineTrace&) = delete;
+    TimelineTrace& operator=(const TimelineTrace&) = delete;
+
+    bool open(const std::string& path, uint64_t max_requests = UINT64_MAX) {
+        m_fp = std::fopen(path.c_str(), "w");
+        if (!m_fp) {
+            std::cerr << "Timeline: cannot create " << path << "\n";
+            return false;
+        }
+        m_max_requests = max_requests;
+        std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", m_fp);
+        std::fputs("{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"simulator\"}}", m_fp);
+        static const char* const track_names[] = {"Core: request", "Core: phase", "Core: firmware", "SPM-DMA", "MAC", "AES", "AXIM"};
+        for (int tid = 1; tid <= static_cast<int>(Track::AXIM); ++tid) {
+            std::fprintf(m_fp, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}", tid, track_names[tid - 1]);
+            std::fprintf(m_fp, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":%d}}", tid, tid);
+        }
+        m_enabled = true;
+        return true;
+    }
+
+    ~TimelineTrace() {
+        if (!m_fp) return;
+        std::fputs("\n]}\n", m_fp);
+        std::fclose(m_fp);
+    }
+
+    bool enabled() const { return m_enabled; }
+
+    /**
+     * @brief リクエストの処理開始時に呼ぶ (記録するリクエスト数の上限の判定)
+     */
+    void beginRequest() {
+        if (m_enabled && m_requests++ >= m_max_requests) m_enabled = false;
+    }
+
+    /**
+     * @brief 区間[start, end)のイベント。detailは引数として表示される
+     */
+    void complete(Track track, std::string_view name, Cycle start, Cycle end, std::string_view detail = {}) {
+        if (!m_enabled) return;
+        std::fprintf(m_fp, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":\"%.*s\",\"ts\":%" PRIu64 ".%03" PRIu64 ",\"dur\":%" PRIu64 ".%03" PRIu64,
+                     static_cast<int>(track), static_cast<int>(name.size()), name.data(),
+                     start / 1000, start % 1000, (end - start) / 1000, (end - start) % 1000);
+        writeDetail(detail);
+    }
+
+    /**
+     * @brief 時刻atの瞬間のイベント (応答の返却など)
+     */
+    void instant(Track track, std::string_view name, Cycle at, std::string_view detail = {}) {
+        if (!m_enabled) return;
+        std::fprintf(m_fp, ",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"name\":\"%.*s\",\"ts\":%" PRIu64 ".%03" PRIu64,
+                     static_cast<int>(track), static_cast<int>(name.size()), name.data(), at / 1000, at % 1000);
+        writeDetail(detail);
+    }
+
+    /**
+     * @brief 生成から破棄までを1つの区間として記録する
+     * @details 終了時に名前が決まる場合(SPMキャッシュのヒット・ミスなど)はsetNameで変更する
+     */
+    class Scope {
+    public:
+        Scope(TimelineTrace* trace, Track track, std::string_view name, std::string_view detail = {})
+            : m_trace(trace && trace->enabled() ? trace : nullptr), m_track(track), m_name(name), m_detail(detail),
+              m_start(m_trace ? m_trace->m_scheduler.now() : 0) {}
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope() {
+            if (m_trace) m_trace->complete(m_track, m_name, m_start, m_trace->m_scheduler.now(), m_detail);
+        }
+        void setName(std::string_view name) { m_name = name; }
+
+    private:
+        TimelineTrace* m_trace;
+        Track m_track;
+        std::string_view m_name;
+        std::string_view m_detail;
+        Cycle m_start;
+    };
+
+private:
+    void writeDetail(std::string_view detail) {
+        if (detail.empty()) {
+            std::fputc('}', m_fp);
+        } else {
+            std::fprintf(m_fp, ",\"args\":{\"detail\":\"%.*s\"}}", static_cast<int>(detail.size()), detail.data());
+        }
+    }
+
+    const EventScheduler& m_scheduler;
+    std::FILE* m_fp = nullptr;
+    bool m_enabled = false;
+    uint64_t m_requests = 0;
+    uint64_t m_max_requests = UINT64_MAX;
+};
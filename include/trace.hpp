@@ -0,0 +1,321 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef SIM_TRACE_ZLIB
+#include <zlib.h>
+#endif
+
+/**
+ * @brief LLCミス(64Bライン単位)のメモリアクセストレース
+ * @details バイナリ形式: ヘッダ16B (MAGIC 8B, flags 4B, レコード長 4B) の後に固定長のレコードが並ぶ。
+ *          レコード: 時刻(サイクル) 8B, アドレス 8B (64Bアライン、bit0: 1ならWrite)、
+ *          flagsにFLAG_DATAがあれば続けて64Bのデータ (Writeは書き込みデータ、Readは未使用)。
+ *          値はすべてリトルエンディアン。
+ *
+ *          読み出しはファイルをmmapして先頭から順に読み、読み終えた範囲は随時解放するため、
+ *          数GBのトレースでもメモリ使用量は一定に保たれる。SIM_TRACE_ZLIB付きでビルドした場合はgzip圧縮されたファイルも読める。
+ */
+namespace Trace {
+    constexpr char MAGIC[8] = {'S', 'I', 'M', 'T', 'R', 'C', '1', '\0'};
+    constexpr uint32_t FLAG_DATA = 1;
+    constexpr uint64_t HEADER_SIZE = 16;
+    constexpr uint64_t BASE_RECORD_SIZE = 16;
+    constexpr uint64_t DATA_SIZE = 64;
+
+    struct Entry {
+        uint64_t cycle = 0;
+        bool is_write = false;
+        uint64_t addr = 0;
+        bool has_data = false;
+        std::array<uint8_t, DATA_SIZE> data{};
+    };
+
+    /**
+     * @brief バイナリトレースの書き出し
+     */
+    class Writer {
+    public:
+        bool open(const std::string& path, bool with_data) {
+            m_fp = std::fopen(path.c_str(), "wb");
+            if (!m_fp) {
+                std::cerr << "Trace: cannot create " << path << "\n";
+                return false;
+            }
+            m_with_data = with_data;
+            uint32_t flags = with_data ? FLAG_DATA : 0;
+            uint32_t record_size = static_cast<uint32_t>(BASE_RECORD_SIZE + (with_data ? DATA_SIZE : 0));
+            std::fwrite(MAGIC, 1, sizeof(MAGIC), m_fp);
+            std::fwrite(&flags, sizeof(flags), 1, m_fp);
+            std::fwrite(&record_size, sizeof(record_size), 1, m_fp);
+            return true;
+        }
+
+        void write(const Entry& entry) {
+            uint64_t addr_op = (entry.addr & ~63ULL) | (entry.is_write ? 1 : 0);
+            std::fwrite(&entry.cycle, sizeof(entry.cycle), 1, m_fp);
+            std::fwrite(&addr_op, sizeof(addr_op), 1, m_fp);
+            if (m_with_data) std::fwrite(entry.data.data(), 1, DATA_SIZE, m_fp);
+            m_count++;
+        }
+
+        uint64_t count() const { return m_count; }
+
+        ~Writer() {
+            if (m_fp) std::fclose(m_fp);
+        }
+
+    private:
+        std::FILE* m_fp = nullptr;
+        bool m_with_data = false;
+        uint64_t m_count = 0;
+    };
+
+    /**
+     * @brief バイナリトレースの読み出し (mmap、またはgzipのストリーム展開)
+     */
+    class Reader {
+    public:
+        Reader() = default;
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        bool open(const std::string& path) {
+            uint8_t magic[2] = {0, 0};
+            if (std::FILE* fp = std::fopen(path.c_str(), "rb")) {
+                size_t n = std::fread(magic, 1, sizeof(magic), fp);
+                std::fclose(fp);
+                if (n != sizeof(magic)) magic[0] = 0;
+            } else {
+                std::cerr << "Trace: cannot open " << path << "\n";
+                return false;
+            }
+            bool ok = (magic[0] == 0x1f && magic[1] == 0x8b) ? openGzip(path) : openMapped(path);
+            return ok && readHeader(path);
+        }
+
+        /**
+         * @brief 次のレコードを読む
+         * @return 終端ならfalse
+         */
+        bool next(Entry& entry) {
+            const uint8_t* record = fetch(m_record_size);
+            if (!record) return false;
+            uint64_t addr_op;
+            std::memcpy(&entry.cycle, record, 8);
+            std::memcpy(&addr_op, record + 8, 8);
+            entry.is_write = addr_op & 1;
+            entry.addr = addr_op & ~63ULL;
+            entry.has_data = m_flags & FLAG_DATA;
+            if (entry.has_data) std::memcpy(entry.data.data(), record + BASE_RECORD_SIZE, DATA_SIZE);
+            return true;
+        }
+
+        ~Reader() {
+            if (m_map) munmap(m_map, m_map_size);
+#ifdef SIM_TRACE_ZLIB
+            if (m_gz) gzclose(m_gz);
+#endif
+        }
+
+    private:
+        static constexpr uint64_t RELEASE_CHUNK = 64ULL << 20; // 読み終えた範囲をこの単位で解放する
+        static constexpr uint64_t GZ_BUFFER_SIZE = 1 << 20;
+
+        bool openMapped(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0) {
+                std::cerr << "Trace: cannot open " << path << "\n";
+                if (fd >= 0) ::close(fd);
+                return false;
+            }
+            m_map_size = static_cast<uint64_t>(st.st_size);
+            if (m_map_size > 0) {
+                void* map = mmap(nullptr, m_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map == MAP_FAILED) {
+                    std::cerr << "Trace: mmap failed for " << path << "\n";
+                    ::close(fd);
+                    return false;
+                }
+                m_map = static_cast<uint8_t*>(map);
+                madvise(m_map, m_map_size, MADV_SEQUENTIAL);
+            }
+            ::close(fd);
+            return true;
+        }
+
+        bool openGzip(const std::string& path) {
+#ifdef SIM_TRACE_ZLIB
+            m_gz = gzopen(path.c_str(), "rb");
+            if (!m_gz) {
+                std::cerr << "Trace: cannot open " << path << "\n";
+                return false;
+            }
+            m_buffer.resize(GZ_BUFFER_SIZE);
+            return true;
+#else
+            std::cerr << "Trace: " << path << " is gzip-compressed; rebuild with ZLIB=1\n";
+            return false;
+#endif
+        }
+
+        bool readHeader(const std::string& path) {
+            const uint8_t* header = fetch(HEADER_SIZE);
+            if (!header || std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0) {
+                std::cerr << "Trace: " << path << " is not a trace file\n";
+                return false;
+            }
+            uint32_t record_size;
+            std::memcpy(&m_flags, header + 8, 4);
+            std::memcpy(&record_size, header + 12, 4);
+            m_record_size = record_size;
+            if (m_record_size != BASE_RECORD_SIZE + ((m_flags & FLAG_DATA) ? DATA_SIZE : 0)) {
+                std::cerr << "Trace: " << path << " has an unsupported record size " << m_record_size << "\n";
+                return false;
+            }
+            return true;
+        }
+
+        // 次のsizeバイトを返す (終端ならnullptr)
+        const uint8_t* fetch(uint64_t size) {
+#ifdef SIM_TRACE_ZLIB
+            if (m_gz) return fetchGzip(size);
+#endif
+            if (m_pos + size > m_map_size) return nullptr;
+            const uint8_t* p = m_map + m_pos;
+            m_pos += size;
+            // 読み終えたページはページキャッシュに任せ、プロセスのメモリからは外す
+            if (m_pos - m_released >= RELEASE_CHUNK) {
+                uint64_t end = m_pos / RELEASE_CHUNK * RELEASE_CHUNK - RELEASE_CHUNK / 2; // 直前のレコードは残す
+                if (end > m_released) {
+                    madvise(m_map + m_released, end - m_released, MADV_DONTNEED);
+                    m_released = end;
+                }
+            }
+            return p;
+        }
+
+#ifdef SIM_TRACE_ZLIB
+        const uint8_t* fetchGzip(uint64_t size) {
+            if (m_buffer_pos + size > m_buffer_end) {
+                // 残りを先頭に寄せて補充する
+                std::memmove(m_buffer.data(), m_buffer.data() + m_buffer_pos, m_buffer_end - m_buffer_pos);
+                m_buffer_end -= m_buffer_pos;
+                m_buffer_pos = 0;
+                int n = gzread(m_gz, m_buffer.data() + m_buffer_end, static_cast<unsigned>(m_buffer.size() - m_buffer_end));
+                if (n > 0) m_buffer_end += static_cast<uint64_t>(n);
+                if (m_buffer_pos + size > m_buffer_end) return nullptr;
+            }
+            const uint8_t* p = m_buffer.data() + m_buffer_pos;
+            m_buffer_pos += size;
+            return p;
+        }
+#endif
+
+        uint32_t m_flags = 0;
+        uint64_t m_record_size = BASE_RECORD_SIZE;
+        // mmap
+        uint8_t* m_map = nullptr;
+        uint64_t m_map_size = 0;
+        uint64_t m_pos = 0;
+        uint64_t m_released = 0;
+#ifdef SIM_TRACE_ZLIB
+        // gzip
+        gzFile m_gz = nullptr;
+        std::vector<uint8_t> m_buffer;
+        uint64_t m_buffer_pos = 0;
+        uint64_t m_buffer_end = 0;
+#endif
+    };
+
+    /**
+     * @brief テキスト形式のトレースを1行解釈する
+     * @details 対応形式 ('#'で始まる行と空行は無視。アドレスは0x付き16進または10進):
+     *          - simple   : "<R|W> <addr> [cycle]"
+     *          - dramsim  : "<addr> <READ|WRITE|P_MEM_RD|P_MEM_WR|P_FETCH> <cycle>" (DRAMSim2のtrace)
+     *          - ramulator: "<addr> <R|W>" (Ramulatorのメモリトレース、時刻は行番号)
+     *          - csv      : "<cycle>,<R|W>,<addr>"
+     * @return 解釈できた場合true (index: データ行の通し番号。時刻の無い形式で使う)
+     */
+    inline bool parseTextLine(const std::string& format, const std::string& line, uint64_t index, Entry& entry) {
+        if (line.empty() || line[0] == '#') return false;
+        std::string text = line;
+        if (format == "csv") {
+            for (char& c : text) if (c == ',') c = ' ';
+        }
+        std::istringstream is(text);
+        std::string a, b, c;
+        is >> a >> b >> c;
+        auto isWriteOp = [](const std::string& op) {
+            return op == "W" || op == "w" || op == "WRITE" || op == "P_MEM_WR";
+        };
+        try {
+            if (format == "simple") {
+                entry.is_write = isWriteOp(a);
+                entry.addr = std::stoull(b, nullptr, 0);
+                entry.cycle = c.empty() ? index : std::stoull(c, nullptr, 0);
+            } else if (format == "dramsim") {
+                entry.addr = std::stoull(a, nullptr, 0);
+                entry.is_write = isWriteOp(b);
+                entry.cycle = std::stoull(c, nullptr, 0);
+            } else if (format == "ramulator") {
+                entry.addr = std::stoull(a, nullptr, 0);
+                entry.is_write = isWriteOp(b);
+                entry.cycle = index;
+            } else if (format == "csv") {
+                entry.cycle = std::stoull(a, nullptr, 0);
+                entry.is_write = isWriteOp(b);
+                entry.addr = std::stoull(c, nullptr, 0);
+            } else {
+                return false;
+            }
+        } catch (const std::exception&) {
+            return false;
+        }
+        entry.addr &= ~63ULL;
+        entry.has_data = false;
+        return true;
+    }
+
+    /**
+     * @brief テキスト形式のトレースをバイナリ形式に変換する
+     * @return 変換したレコード数 (失敗時は-1)
+     */
+    inline int64_t convertText(const std::string& format, const std::string& in_path, const std::string& out_path) {
+        if (format != "simple" && format != "dramsim" && format != "ramulator" && format != "csv") {
+            std::cerr << "Trace: unknown text format " << format << "\n";
+            return -1;
+        }
+        std::ifstream in(in_path);
+        if (!in) {
+            std::cerr << "Trace: cannot open " << in_path << "\n";
+            return -1;
+        }
+        Writer writer;
+        if (!writer.open(out_path, false)) return -1;
+        std::string line;
+        uint64_t skipped = 0;
+        Entry entry;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (parseTextLine(format, line, writer.count(), entry)) {
+                writer.write(entry);
+            } else if (!line.empty() && line[0] != '#') {
+                skipped++;
+            }
+        }
+        if (skipped) std::cerr << "Trace: skipped " << skipped << " unparsable lines\n";
+        return static_cast<int64_t>(writer.count());
+    }
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include "memory_map.hpp"
+#include "event_scheduler.hpp"
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief DRAMトラフィックの内訳 (メタデータによる増幅率の計測)
+ * @details Dramへの全てのアクセスを領域(データ・データタグ・カウンター・ツリーの各階層)に振り分け、
+ *          処理中のリクエストの種類(Read/Write)ごとに集計する。リクエストの処理外のアクセス(起動時の常駐階層のロードなど)は
+ *          backgroundとして別に数える。
+ *          増幅率は、そのリクエストの種類のDRAMトラフィックの合計を、データ本体(64B/リクエスト)で割った値。
+ *          時間窓(window_cycles)ごとのリクエスト数とバイト数も記録し、実行中の変化(キャッシュのウォームアップなど)を見られるようにする。
+ */
+class TrafficStats {
+public:
+    // 領域: 0 データ, 1 データタグ, 2 カウンター(最下位の階層), 3〜 ツリーの階層(0: 最上位), 最後 その他
+    static constexpr uint64_t TREE_LEVELS = Parameter::Geometry::HEIGHT - 1;
+    static constexpr uint64_t REGION_DATA = 0;
+    static constexpr uint64_t REGION_DATA_TAG = 1;
+    static constexpr uint64_t REGION_COUNTER = 2;
+    static constexpr uint64_t REGION_TREE = 3;
+    static constexpr uint64_t REGION_OTHER = REGION_TREE + TREE_LEVELS;
+    static constexpr uint64_t REGION_COUNT = REGION_OTHER + 1;
+
+    // リクエストの種類
+    enum class Kind { READ, WRITE, BACKGROUND, COUNT };
+    static constexpr size_t KIND_COUNT = static_cast<size_t>(Kind::COUNT);
+
+    static constexpr uint64_t DEFAULT_WINDOW_CYCLES = 1000000;
+
+    explicit TrafficStats(const EventScheduler& scheduler, uint64_t window_cycles = DEFAULT_WINDOW_CYCLES)
+        : m_scheduler(scheduler), m_window_cycles(window_cycles ? window_cycles : DEFAULT_WINDOW_CYCLES) {}
+
+    /**
+     * @brief DRAMアドレスが属する領域
+     */
+    static uint64_t regionOf(uint64_t addr) {
+        using Geometry = Parameter::Geometry;
+        if (addr < MemoryMap::DATA_TAG_BASE_ADDR) return REGION_DATA;
+        if (addr < MemoryMap::COUNTER_BASE_ADDR) return REGION_DATA_TAG;
+        if (addr >= MemoryMap::COUNTER_BASE_ADDR + MemoryMap::COUNTER_SIZE) return REGION_OTHER;
+        // 各階層はカウンター領域の先頭から最下位の階層の順に並ぶ
+        uint64_t offset = addr - MemoryMap::COUNTER_BASE_ADDR;
+        uint64_t level = 0;
+        while (offset < Geometry::levelBase(level)) ++level;
+        return level == Parameter::HEIGHT - 1 ? REGION_COUNTER : REGION_TREE + level;
+    }
+
+    static std::string regionName(uint64_t region) {
+        static const char* const names[] = {"data", "data_tag", "counter"};
+        if (region < REGION_TREE) return names[region];
+        if (region == REGION_OTHER) return "other";
+        return "tree_level" + std::to_string(region - REGION_TREE + 1);
+    }
+
+    /**
+     * @brief リクエストの処理の開始・終了 (コアが呼ぶ)。この間のアクセスはそのリクエストの種類に数える
+     */
+    void beginRequest(bool is_write) {
+        m_kind = is_write ? Kind::WRITE : Kind::READ;
+        m_totals[kindIndex()].requests++;
+        currentWindow().requests[kindIndex()]++;
+    }
+    void endRequest() { m_kind = Kind::BACKGROUND; }
+
+    /**
+     * @brief DRAMへのアクセスを記録する (Dramが呼ぶ)
+     */
+    void record(uint64_t addr, uint64_t size, bool is_write) {
+        uint64_t region = regionOf(addr);
+        Totals& totals = m_totals[kindIndex()];
+        (is_write ? totals.write_bytes : totals.read_bytes)[region] += size;
+        currentWindow().bytes[kindIndex()] += size;
+    }
+
+    /**
+     * @brief 種類ごとの内訳と時間窓ごとの推移をJSONで書き出す
+     */
+    void writeJson(std::ostream& os) const {
+        static const char* const kind_names[] = {"read", "write", "background"};
+        os << "{\n  \"window_cycles\": " << m_window_cycles << ",\n";
+        for (size_t k = 0; k < KIND_COUNT; ++k) {
+            const Totals& totals = m_totals[k];
+            uint64_t total = 0;
+            os << "  \"" << kind_names[k] << "\": {\n    \"requests\": " << totals.requests << ",\n    \"regions\": {\n";
+            for (uint64_t r = 0; r < REGION_COUNT; ++r) {
+                total += totals.read_bytes[r] + totals.write_bytes[r];
+                os << "      \"" << regionName(r) << "\": {\"read_bytes\": " << totals.read_bytes[r]
+                   << ", \"write_bytes\": " << totals.write_bytes[r] << "}" << (r + 1 < REGION_COUNT ? ",\n" : "\n");
+            }
+            uint64_t metadata = total - totals.read_bytes[REGION_DATA] - totals.write_bytes[REGION_DATA];
+            os << "    },\n    \"total_bytes\": " << total
+               << ",\n    \"bytes_per_request\": " << ratio(total, totals.requests)
+               << ",\n    \"metadata_bytes_per_request\": " << ratio(metadata, totals.requests)
+               << ",\n    \"amplification\": " << ratio(total, totals.requests * DATA_BYTES) << "\n  },\n";
+        }
+        os << "  \"windows\": [";
+        for (size_t w = 0; w < m_windows.size(); ++w) {
+            const Window& window = m_windows[w];
+            os << (w ? ",\n" : "\n") << "    {\"start_cycle\": " << w * m_window_cycles;
+            for (size_t k = 0; k < KIND_COUNT; ++k) {
+                if (static_cast<Kind>(k) != Kind::BACKGROUND) os << ", \"" << kind_names[k] << "_requests\": " << window.requests[k];
+                os << ", \"" << kind_names[k] << "_bytes\": " << window.bytes[k];
+            }
+            uint64_t requests = window.requests[0] + window.requests[1];
+            os << ", \"amplification\": " << ratio(window.bytes[0] + window.bytes[1], requests * DATA_BYTES) << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+    /**
+     * @brief Read/Writeごとの1リクエストあたりのバイト数と増幅率を表示する
+     */
+    void printSummary(std::ostream& os) const {
+        static const char* const kind_names[] = {"Read ", "Write"};
+        for (size_t k = 0; k < 2; ++k) {
+            const Totals& totals = m_totals[k];
+            uint64_t total = 0;
+            for (uint64_t r = 0; r < REGION_COUNT; ++r) total += totals.read_bytes[r] + totals.write_bytes[r];
+            os << "DRAM traffic " << kind_names[k] << ": " << ratio(total, totals.requests) << " B/req (amplification x"
+               << ratio(total, totals.requests * DATA_BYTES) << ")\n";
+        }
+    }
+
+private:
+    static constexpr uint64_t DATA_BYTES = 64; // 1リクエストのデータ本体
+    struct Totals {
+        uint64_t requests = 0;
+        std::array<uint64_t, REGION_COUNT> read_bytes{};  // DRAMからの読み出し
+        std::array<uint64_t, REGION_COUNT> write_bytes{}; // DRAMへの書き込み
+    };
+    struct Window {
+        std::array<uint64_t, KIND_COUNT> requests{};
+        std::array<uint64_t, KIND_COUNT> bytes{};
+    };
+
+    size_t kindIndex() const { return static_cast<size_t>(m_kind); }
+    Window& currentWindow() {
+        size_t index = m_scheduler.now() / m_window_cycles;
+        if (index >= m_windows.size()) m_windows.resize(index + 1);
+        return m_windows[index];
+    }
+    static double ratio(uint64_t numerator, uint64_t denominator) {
+        return denominator ? static_cast<double>(numerator) / denominator : 0.0;
+    }
+
+    const EventScheduler& m_scheduler;
+    uint64_t m_window_cycles;
+    Kind m_kind = Kind::BACKGROUND;
+    std::array<Totals, KIND_COUNT> m_totals{};
+    std::vector<Window> m_windows;
+};
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+
+/**
+ * @brief カウンターツリーの形状を表すコンパイル時記述子
+ * @details 分岐数・保護領域サイズ・カウンターのビット幅から、ツリーの高さ・各階層のノード数・
+ *          DRAM上の配置・ノード内のカウンター位置を全て導出する。
+ *
+ *          ノード(64B)の構成:
+ *          | メジャーカウンター(64bit, 下位MajorBitsを使用) | マイナーカウンター(MinorBits x Arity) | 未使用 | MAC(64bit) |
+ *          ノードのMACは先頭448bit(56B)と、親ノード中の対応するマイナーカウンター(最上位ノードはルート)から計算する。
+ *          DRAM上では階層ごとに連続して配置し、リーフ(カウンターブロック)が先頭、最上位ノードが末尾となる。
+ * @tparam Arity 1ノードあたりのカウンター数(=分岐数)。8〜128の2の冪
+ * @tparam ProtectedSize 保護領域のサイズ(B)。64MB〜16GBの2の冪
+ * @tparam MajorBits メジャーカウンターのビット幅
+ * @tparam MinorBits マイナーカウンターのビット幅
+ */
+template <uint64_t Arity, uint64_t ProtectedSize, uint64_t MajorBits, uint64_t MinorBits>
+struct TreeGeometry {
+    static constexpr uint64_t ARITY = Arity;
+    static constexpr uint64_t PROTECTED_SIZE = ProtectedSize;
+    static constexpr uint64_t MAJOR_BITS = MajorBits;
+    static constexpr uint64_t MINOR_BITS = MinorBits;
+
+    static constexpr uint64_t LINE_SIZE = 64;
+    static constexpr uint64_t DATA_LINES = PROTECTED_SIZE / LINE_SIZE;
+    static constexpr uint64_t TAGS_PER_LINE = 8; // データタグ(MAC)は8B/データライン
+    static constexpr uint64_t DATA_TAG_SIZE = DATA_LINES / TAGS_PER_LINE * LINE_SIZE;
+
+    // --- ノード内の配置 ---
+    static constexpr uint64_t MINOR_BASE_BIT = 64;
+    static constexpr uint64_t NODE_MAC_INPUT_BITS = 448; // MACの計算対象 (先頭56B)
+    static constexpr uint64_t NODE_MAC_OFFSET = 56;      // MACのバイトオフセット
+    static constexpr uint64_t MAJOR_MASK = MAJOR_BITS == 64 ? ~0ULL : (1ULL << MAJOR_BITS) - 1;
+    static constexpr uint64_t MINOR_MAX = (1ULL << MINOR_BITS) - 1;
+
+    /**
+     * @brief ノード内のエントリ(entry % ARITY)のマイナーカウンターの先頭ビット位置
+     */
+    static constexpr uint64_t minorBit(uint64_t entry) {
+        return MINOR_BASE_BIT + (entry % ARITY) * MINOR_BITS;
+    }
+
+    // --- ツリーの高さと各階層のノード数 ---
+    static constexpr uint64_t power(uint64_t exp) {
+        uint64_t v = 1;
+        for (uint64_t i = 0; i < exp; ++i) v *= ARITY;
+        return v;
+    }
+    /**
+     * @brief 最上位ノード1つで全データラインを覆える最小の高さ
+     */
+    static constexpr uint64_t computeHeight() {
+        uint64_t h = 1;
+        while (power(h) < DATA_LINES) ++h;
+        return h;
+    }
+    static constexpr uint64_t HEIGHT = computeHeight();
+
+    /**
+     * @brief 階層i(0: 最上位)のエントリ1つが覆うデータライン数
+     * @details request_addr / 64 / entrySpan(i) が階層iのパスインデックスとなる
+     */
+    static constexpr uint64_t entrySpan(uint64_t i) {
+        return power(HEIGHT - 1 - i);
+    }
+    /**
+     * @brief 階層iのノード数
+     */
+    static constexpr uint64_t levelNodes(uint64_t i) {
+        return (DATA_LINES + power(HEIGHT - i) - 1) / power(HEIGHT - i);
+    }
+    /**
+     * @brief カウンター領域の先頭から階層iの先頭ノードまでのオフセット
+     */
+    static constexpr uint64_t levelBase(uint64_t i) {
+        uint64_t base = 0;
+        for (uint64_t j = i + 1; j < HEIGHT; ++j) base += levelNodes(j) * LINE_SIZE;
+        return base;
+    }
+    static constexpr uint64_t TREE_SIZE = levelBase(0) + levelNodes(0) * LINE_SIZE;
+
+    static_assert(ARITY >= 8 && ARITY <= 128 && (ARITY & (ARITY - 1)) == 0, "tree arity must be a power of two in [8, 128]");
+    static_assert(PROTECTED_SIZE >= (64ULL << 20) && PROTECTED_SIZE <= (16ULL << 30) && (PROTECTED_SIZE & (PROTECTED_SIZE - 1)) == 0,
+                  "protected size must be a power of two in [64MB, 16GB]");
+    static_assert(MAJOR_BITS >= 1 && MAJOR_BITS <= 64, "major counter must fit in the first word of a node");
+    static_assert(MINOR_BITS >= 1 && MINOR_BITS <= 32, "minor counter width must be in [1, 32]");
+    static_assert(MINOR_BASE_BIT + ARITY * MINOR_BITS <= NODE_MAC_INPUT_BITS, "minor counters do not fit in a 64B node next to the MAC");
+};
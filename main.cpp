@@ -4,9 +4,27 @@
 #include <cstring>
 #include <random>
 #include <map>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <fstream>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 // すべてのハードウェアコンポーネントの定義をインクルード
 #include "memory_map.hpp"
+#include "logger.hpp"
+#include "event_scheduler.hpp"
+#include "latency_histogram.hpp"
+#include "load_generator.hpp"
+#include "trace.hpp"
+#include "perf_counters.hpp"
+#include "traffic_stats.hpp"
+#include "timeline_trace.hpp"
 #include "dram.hpp"
 #include "spm.hpp"
 #include "bus.hpp"
@@ -15,15 +33,31 @@
 #include "hash_module.hpp"
 #include "aes_module.hpp"
 #include "axi_manager_module.hpp"
+#include "axi_ingress.hpp"
 
 // =================================================================
 // テストベンチクラス
 // =================================================================
 class Testbench {
 public:
+    // 開ループ負荷の1リクエスト
+    struct Arrival {
+        uint64_t delay = 0;    // 前の到着からの間隔 (サイクル)
+        bool is_write = false;
+        uint64_t addr = 0;     // 64Bアラインされたアドレス
+        bool has_data = false; // trueなら書き込みデータにdataを使う (falseなら生成する)
+        AxiManagerModule::DataBlock data{};
+    };
+    // 次の到着を返す (尽きたらfalse)。負荷生成器やトレースから作る
+    using ArrivalSource = std::function<bool(Arrival&)>;
+
     // テスト対象のハードウェアコンポーネントへの参照を受け取る
-    Testbench(AxiManagerModule& axi_mgr, RiscVCore& core)
-        : m_axi_mgr(axi_mgr), m_core(core) {}
+    // 発行中のリクエストの情報はAXI Managerのスロットと同数の固定の領域に置き、その番号をリクエストのidにする
+    Testbench(AxiManagerModule& axi_mgr, RiscVCore& core, EventScheduler& scheduler)
+        : m_axi_mgr(axi_mgr), m_core(core), m_scheduler(scheduler), m_contexts(axi_mgr.freeSlots()) {
+        m_free_contexts.reserve(m_contexts.size());
+        for (size_t i = m_contexts.size(); i-- > 0;) m_free_contexts.push_back(static_cast<uint32_t>(i));
+    }
 
     // テストシナリオをキューに追加
     void addWriteTest(uint64_t addr, const AxiManagerModule::DataBlock& data) {
@@ -33,21 +67,84 @@ public:
         m_test_queue.push({ TestOp::Type::Read, addr, expected_data });
     }
 
-    // 全てのテストを実行
-    void run() {
-        while (!m_test_queue.empty() || !m_outstanding_requests.empty()) {
+    /**
+     * @brief 全てのテストを実行
+     * @param outstanding コアが受け付ける前のリクエストを、AXI Managerに最大いくつ積んでおくか
+     *        (1なら1つずつ発行する。大きくすると、キューでの待ち時間がレイテンシに含まれる)
+     */
+    void run(uint64_t outstanding = 1) {
+        while (!m_test_queue.empty() || inFlight() > 0) {
             // 新しいリクエストを発行できる状態なら、キューからテストを取り出して実行
-            if (!m_test_queue.empty()) {
-                issueNextRequest();
+            if (!m_test_queue.empty() || m_axi_mgr.queuedRequests() > 0) {
+                while (!m_test_queue.empty() && m_axi_mgr.queuedRequests() < outstanding && issueNextRequest()) {}
+                // コアに処理を実行させる (応答は完了イベントで完了リングに入る)
+                m_core.runMainLoop();
+                recordProfile(m_core.lastProfile());
+            } else if (!m_scheduler.runNext()) {
+                // 発行済みのリクエストの応答イベントが残っていない
+                break;
             }
-            // コアに処理を実行させる (これによりコールバックがトリガーされる可能性がある)
-            m_core.runMainLoop();
+            pollCompletions();
         }
         
         // --- 最終結果の表示 ---
+        uint64_t requests = m_next_req_id - 1;
         std::cout << "\n--- Test Suite Finished ---\n";
         std::cout << "Total Passed: " << m_passed_count << "\n";
         std::cout << "Total Failed: " << m_failed_count << "\n";
+        std::cout << "Simulated Cycles: " << m_scheduler.now()
+                  << " (" << (requests ? m_scheduler.now() / requests : 0) << " cycles/request)\n";
+        printForwardingReport();
+        printLatencyReport(false);
+    }
+
+    /**
+     * @brief 開ループ負荷を実行する
+     * @details リクエストはsourceが決めた時刻に到着し、処理の完了を待たずにAXI Managerのキューに積まれる。
+     *          sourceは1件ずつ読み出すため、トレースの長さによらずメモリ使用量は変わらない。
+     *          レイテンシは到着から応答までで、キューでの待ち時間を含む。
+     *          まだ書き込んでいないアドレスへのReadは、検証できるデータが無いためWriteとして発行する。
+     *          AXI Managerのスロットが全て使用中の間に到着したリクエストは、応答を取り出して空きができるまで待ち
+     *          (待ち時間はレイテンシに含む)、その間は次の到着を生成しない。
+     */
+    void runOpenLoop(ArrivalSource source, const std::string& title) {
+        m_source = std::move(source);
+        scheduleArrival();
+        // 到着が残っているか、キューにリクエストがある間はコアに処理させる
+        while (m_arrival_pending || (m_axi_mgr.mmioRead64(MemoryMap::AxiManagerReg::STATUS) & 1)) {
+            if (m_stalled && m_axi_mgr.queuedRequests() == 0) {
+                // コアが処理するリクエストが無い: 応答イベントを進めてスロットが空くのを待つ
+                if (!m_scheduler.runNext()) {
+                    SIM_LOG(TB, ERROR, "[TB] No free request slot and no pending response.");
+                    break;
+                }
+            } else {
+                m_core.runMainLoop();
+                recordProfile(m_core.lastProfile());
+            }
+            pollCompletions();
+            retryStalledArrival();
+        }
+        // 残りの応答イベントを処理
+        m_scheduler.runAll();
+        pollCompletions();
+
+        uint64_t completed = m_passed_count + m_failed_count;
+        uint64_t elapsed = m_last_response > m_first_arrival ? m_last_response - m_first_arrival : 0;
+        uint64_t arrival_span = m_last_arrival > m_first_arrival ? m_last_arrival - m_first_arrival : 0;
+        std::cout << "\n--- " << title << " Finished ---\n";
+        std::cout << "Total Passed: " << m_passed_count << "\n";
+        std::cout << "Total Failed: " << m_failed_count << "\n";
+        std::cout << "Read-to-write conversions (unwritten address): " << m_converted_reads << "\n";
+        std::cout << "Backpressure stalls (no free request slot): " << m_backpressure_stalls << "\n";
+        std::cout << std::fixed << std::setprecision(3)
+                  << "Offered load: " << (arrival_span ? 1000.0 * (m_arrivals - 1) / arrival_span : 0.0) << " req/kcycle"
+                  << " (" << m_arrivals << " arrivals in " << arrival_span << " cycles)\n"
+                  << "Throughput: " << (elapsed ? 1000.0 * completed / elapsed : 0.0) << " req/kcycle"
+                  << " (" << completed << " requests in " << elapsed << " cycles)\n";
+        std::cout.unsetf(std::ios_base::floatfield);
+        printForwardingReport();
+        printLatencyReport(true);
     }
 
 private:
@@ -57,102 +154,637 @@ private:
         Type type;
         uint64_t addr;
         AxiManagerModule::DataBlock data; // Write時は書き込みデータ, Read時は期待データ
+        uint64_t issue_cycle = 0;         // 発行した時刻 (開ループ負荷では到着した時刻)
+        uint64_t req_id = 0;              // 発行順の通し番号 (ログ用)
     };
 
-    // 次のリクエストを発行
-    void issueNextRequest() {
-        TestOp op = m_test_queue.front();
+    // リクエスト種別ごとのレイテンシの集計
+    struct LatencyStats {
+        LatencyHistogram histogram; // 発行から応答まで
+        uint64_t profiled = 0;      // 内訳を集計したリクエスト数
+        std::array<uint64_t, RiscVCore::PHASE_COUNT> phase_cycles{}; // コアの段階ごとの合計
+    };
+
+    LatencyStats& statsFor(bool is_write) { return m_latency[is_write ? 1 : 0]; }
+
+    void recordLatency(const TestOp& op, uint64_t response_cycle) {
+        statsFor(op.type == TestOp::Type::Write).histogram.record(response_cycle - op.issue_cycle);
+        m_last_response = response_cycle;
+    }
+
+    void recordProfile(const RiscVCore::RequestProfile& profile) {
+        LatencyStats& stats = statsFor(profile.is_write);
+        stats.profiled++;
+        for (size_t i = 0; i < RiscVCore::PHASE_COUNT; ++i) stats.phase_cycles[i] += profile.cycles[i];
+    }
+
+    // AXI Managerが到着時に応答したリクエスト (認証・検証を省いた回数)
+    void printForwardingReport() const {
+        uint64_t forwarded = m_axi_mgr.forwardedReads();
+        uint64_t coalesced = m_axi_mgr.coalescedWrites();
+        std::cout << "AXI forwarding: " << forwarded << " reads forwarded, " << coalesced
+                  << " writes coalesced (crypto passes saved: " << forwarded + coalesced << ")\n";
+    }
+
+    // レイテンシのパーセンタイルと段階ごとの平均の内訳を表示 (distribution: 2の冪ごとの分布も表示する)
+    void printLatencyReport(bool distribution) const {
+        // 保護なしでDRAMから64Bを読み書きする場合のレイテンシ (比較用)
+        const uint64_t plain_cycles = Parameter::DRAM_ACCESS_CYCLES + 64 / Parameter::DMA_BYTES_PER_CYCLE;
+        std::cout << "\n--- Latency (cycles/request) ---\n";
+        std::cout << "Plain DRAM access: " << plain_cycles << "\n";
+        const char* names[] = {"Read", "Write"};
+        LatencyHistogram all;
+        for (int t = 0; t < 2; ++t) {
+            const LatencyStats& stats = m_latency[t];
+            all.merge(stats.histogram);
+            if (stats.histogram.count() == 0) continue;
+            uint64_t avg = stats.histogram.mean();
+            std::cout << names[t] << ": n " << stats.histogram.count() << ", avg " << avg
+                      << " (+" << (avg > plain_cycles ? avg - plain_cycles : 0) << " over plain DRAM)\n";
+            printPercentiles(stats.histogram);
+            std::cout << " ";
+            for (size_t i = 0; i < RiscVCore::PHASE_COUNT; ++i) {
+                std::cout << " " << RiscVCore::phaseName(static_cast<RiscVCore::Phase>(i)) << " "
+                          << (stats.profiled ? stats.phase_cycles[i] / stats.profiled : 0);
+            }
+            std::cout << "\n";
+        }
+        if (distribution && all.count() > 0) {
+            std::cout << "All: n " << all.count() << ", avg " << all.mean() << "\n";
+            printPercentiles(all);
+            all.printDistribution(std::cout);
+        }
+    }
+
+    static void printPercentiles(const LatencyHistogram& histogram) {
+        std::cout << "  min " << histogram.min() << " p50 " << histogram.percentile(50) << " p95 " << histogram.percentile(95)
+                  << " p99 " << histogram.percentile(99) << " p99.9 " << histogram.percentile(99.9)
+                  << " max " << histogram.max() << "\n";
+    }
+
+    // 開ループ負荷: 次の到着イベントを登録する (到着は常に1件だけ先読みする)
+    void scheduleArrival() {
+        m_next_arrival = Arrival{};
+        m_arrival_pending = m_source(m_next_arrival);
+        if (!m_arrival_pending) return;
+        m_scheduler.schedule(m_next_arrival.delay, [this] {
+            m_arrivals++;
+            m_first_arrival = std::min(m_first_arrival, m_scheduler.now());
+            m_last_arrival = m_scheduler.now();
+            if (!issueLoadRequest(m_next_arrival, m_scheduler.now())) {
+                // スロットが空くまで待つ (retryStalledArrival)
+                m_stalled = true;
+                m_backpressure_stalls++;
+                return;
+            }
+            m_arrival_pending = false;
+            scheduleArrival();
+        });
+    }
+
+    // 開ループ負荷: スロットの空きを待っている到着を再び発行する (レイテンシは到着した時刻から数える)
+    void retryStalledArrival() {
+        if (!m_stalled || !issueLoadRequest(m_next_arrival, m_last_arrival)) return;
+        m_stalled = false;
+        scheduleArrival();
+    }
+
+    // 開ループ負荷: 到着したリクエストを発行する (期待データはアドレスごとの最新の書き込みデータ)
+    bool issueLoadRequest(const Arrival& arrival, uint64_t arrival_cycle) {
+        auto it = m_written_data.find(arrival.addr);
+        bool converted = !arrival.is_write && it == m_written_data.end();
+        if (arrival.is_write || converted) {
+            const AxiManagerModule::DataBlock data = arrival.has_data ? arrival.data : loadData(m_next_req_id);
+            if (!issueRequest({ TestOp::Type::Write, arrival.addr, data }, arrival_cycle)) return false;
+            m_written_data[arrival.addr] = data;
+        } else if (!issueRequest({ TestOp::Type::Read, arrival.addr, it->second }, arrival_cycle)) {
+            return false;
+        }
+        if (converted) m_converted_reads++;
+        return true;
+    }
+
+public:
+    // 書き込みごとに異なるデータパターン
+    static AxiManagerModule::DataBlock loadData(uint64_t version) {
+        AxiManagerModule::DataBlock data;
+        uint64_t x = version * 0x9E3779B97F4A7C15ULL;
+        for (size_t i = 0; i < data.size(); i += 8) {
+            x ^= x >> 29;
+            x *= 0xBF58476D1CE4E5B9ULL;
+            std::memcpy(&data[i], &x, sizeof(x));
+        }
+        return data;
+    }
+
+private:
+    // 次のリクエストを発行 (スロットが無ければ発行せずにfalse)
+    bool issueNextRequest() {
+        if (!issueRequest(m_test_queue.front(), m_scheduler.now())) return false;
         m_test_queue.pop();
-        uint64_t req_id = m_next_req_id++;
+        return true;
+    }
 
-        std::cout << "\n[TB] Issuing request ID " << req_id << " (Addr: 0x" << std::hex << op.addr << std::dec << ")...\n";
-        m_outstanding_requests[req_id] = op;
+    bool issueRequest(const TestOp& op, uint64_t issue_cycle) {
+        if (m_free_contexts.empty()) return false; // AXI Managerのスロットと同数なので、スロットも空いていない
+        uint32_t context = m_free_contexts.back();
+        bool accepted = op.type == TestOp::Type::Write ? m_axi_mgr.receiveLlcWriteRequest(op.addr, context, op.data)
+                                                       : m_axi_mgr.receiveLlcReadRequest(op.addr, context);
+        if (!accepted) return false;
+        m_free_contexts.pop_back();
+        TestOp& issued = m_contexts[context];
+        issued = op;
+        issued.issue_cycle = issue_cycle;
+        issued.req_id = m_next_req_id++;
+        SIM_LOG(TB, DEBUG, "\n[TB] Issued request ID " << issued.req_id << " (Addr: 0x" << std::hex << op.addr << ")...");
+        return true;
+    }
+
+    uint64_t inFlight() const { return m_contexts.size() - m_free_contexts.size(); }
 
-        if (op.type == TestOp::Type::Write) {
-            m_axi_mgr.receiveLlcWriteRequest(op.addr, req_id, op.data,
-                [this, req_id](bool success){ this->onWriteAck(req_id, success); }
-            );
-        } else { // Read
-            m_axi_mgr.receiveLlcReadRequest(op.addr, req_id,
-                [this, req_id](const AxiManagerModule::DataBlock& data){ this->onReadResponse(req_id, data); }
-            );
+    // 完了リングの応答を全て取り出して検証する
+    void pollCompletions() {
+        AxiManagerModule::Completion completion;
+        while (m_axi_mgr.peekCompletion(completion)) {
+            const TestOp& op = m_contexts[completion.id];
+            recordLatency(op, completion.cycle);
+            if (completion.is_write) {
+                onWriteAck(op, completion.success);
+            } else {
+                onReadResponse(op, *completion.data);
+            }
+            m_axi_mgr.popCompletion();
+            m_free_contexts.push_back(static_cast<uint32_t>(completion.id));
         }
     }
 
-    // Writeリクエストのコールバック
-    void onWriteAck(uint64_t req_id, bool success) {
-        std::cout << "[TB] Write Ack received for ID " << req_id << ".\n";
+    // Writeリクエストの応答
+    void onWriteAck(const TestOp& op, bool success) {
+        SIM_LOG(TB, DEBUG, "[TB] Write Ack received for ID " << op.req_id << ".");
         if (success) {
             m_passed_count++;
         } else {
             m_failed_count++;
         }
-        m_outstanding_requests.erase(req_id);
     }
 
-    // Readリクエストのコールバック
-    void onReadResponse(uint64_t req_id, const AxiManagerModule::DataBlock& received_data) {
-        std::cout << "[TB] Read Response received for ID " << req_id << ".\n";
-        auto it = m_outstanding_requests.find(req_id);
-        if (it != m_outstanding_requests.end()) {
-            if (it->second.data == received_data) {
-                std::cout << "  ✅ Data matches expected value.\n";
-                m_passed_count++;
-            } else {
-                std::cout << "  ❌ Data MISMATCH!\n";
-                m_failed_count++;
-                std::cout << "    Expected: ";
-                for (const auto& byte : it->second.data) { std::cout << std::hex << static_cast<int>(byte) << " "; }
-                std::cout << "\n    Received: ";
-                for (const auto& byte : received_data) { std::cout << std::hex << static_cast<int>(byte) << " "; }
-                std::cout << std::dec << "\n";
-                exit(1);
-            }
-            m_outstanding_requests.erase(it);
+    // Readリクエストの応答
+    void onReadResponse(const TestOp& op, const AxiManagerModule::DataBlock& received_data) {
+        SIM_LOG(TB, DEBUG, "[TB] Read Response received for ID " << op.req_id << ".");
+        if (op.data == received_data) {
+            SIM_LOG(TB, DEBUG, "  ✅ Data matches expected value.");
+            m_passed_count++;
+        } else {
+            m_failed_count++;
+            SIM_LOG(TB, ERROR, "  ❌ Data MISMATCH!"
+                    << "\n    Expected: " << Log::hexBytes(op.data.data(), op.data.size())
+                    << "\n    Received: " << Log::hexBytes(received_data.data(), received_data.size()));
+            exit(1);
         }
     }
 
     // メンバ変数
     AxiManagerModule& m_axi_mgr;
     RiscVCore& m_core;
+    EventScheduler& m_scheduler;
     std::queue<TestOp> m_test_queue;
-    std::map<uint64_t, TestOp> m_outstanding_requests;
+    std::vector<TestOp> m_contexts;        // 発行中のリクエスト (添字がAXI Managerに渡すid)
+    std::vector<uint32_t> m_free_contexts; // 空いているm_contextsの添字
     uint64_t m_next_req_id = 1;
     int m_passed_count = 0;
     int m_failed_count = 0;
+    LatencyStats m_latency[2]; // 0: Read, 1: Write
+    uint64_t m_last_response = 0;
+    // 開ループ負荷の状態
+    ArrivalSource m_source;
+    Arrival m_next_arrival;         // 先読みした次の到着
+    bool m_arrival_pending = false; // 次の到着をまだ発行していない (到着前、またはスロットの空き待ち)
+    bool m_stalled = false;         // 次の到着がスロットの空きを待っている
+    uint64_t m_backpressure_stalls = 0;
+    uint64_t m_arrivals = 0;
+    uint64_t m_first_arrival = UINT64_MAX;
+    uint64_t m_last_arrival = 0;
+    uint64_t m_converted_reads = 0;
+    std::unordered_map<uint64_t, AxiManagerModule::DataBlock> m_written_data; // アドレス -> 最新の書き込みデータ
+};
+
+// =================================================================
+// 複数スレッドからの受付のストレステスト
+// =================================================================
+struct StressConfig {
+    uint64_t threads = 4;                                      // リクエストを送るホストスレッド数 (AxiIngressのポート数)
+    uint64_t requests = 100000;                                // 全スレッドの合計
+    double write_ratio = 0.5;
+    uint64_t footprint = 4ULL << 20;                           // 保護領域の先頭からのバイト数
+    uint64_t seed = 1;
+    uint64_t depth = Parameter::AXIM_INGRESS_DEPTH;            // 受付キューの段数
+    uint64_t port_outstanding = Parameter::AXIM_PORT_OUTSTANDING;
+};
+
+/**
+ * @brief threads個のホストスレッドがAxiIngressの別々のポートから同時にリクエストを送り、応答を検証する
+ * @details 各スレッドは自分だけが使うライン(ライン番号 % threads == スレッド番号)にWriteとReadを送り、
+ *          Readの応答をそのスレッドが直前に送った同じラインへのWriteのデータと照合する
+ *          (同じポートのリクエストは送った順にAXI Managerに入る)。送信が拒否されたら応答を取り出してから送り直す。
+ *          シミュレーションはメインスレッドで進める。到着の順序と時刻はスレッドの実行順で変わるため、実行ごとに異なる。
+ */
+class StressTest {
+public:
+    StressTest(AxiManagerModule& axi_mgr, RiscVCore& core, EventScheduler& scheduler, const StressConfig& config)
+        : m_axi_mgr(axi_mgr), m_core(core), m_scheduler(scheduler), m_config(config),
+          m_ingress(axi_mgr, config.threads, config.depth, config.port_outstanding), m_results(config.threads) {}
+
+    // 全てのリクエストを検証できればtrue
+    bool run() {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> producers;
+        for (uint64_t port = 0; port < m_config.threads; ++port) {
+            uint64_t requests = m_config.requests / m_config.threads + (port < m_config.requests % m_config.threads ? 1 : 0);
+            producers.emplace_back([this, port, requests] { produce(port, requests); });
+        }
+        // シミュレーション: 到着したリクエストをAXI Managerに入れ、コアに処理させる
+        while (m_finished.load(std::memory_order_acquire) < m_config.threads) {
+            m_ingress.pump();
+            if (m_axi_mgr.queuedRequests() > 0) {
+                m_core.runMainLoop();
+            } else if (!m_scheduler.runNext()) {
+                std::this_thread::yield(); // 次のリクエストを待つ
+            }
+        }
+        for (std::thread& producer : producers) producer.join();
+        m_scheduler.runAll();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        Result total;
+        AxiIngress::Backpressure backpressure;
+        for (uint64_t port = 0; port < m_config.threads; ++port) {
+            total.passed += m_results[port].passed;
+            total.failed += m_results[port].failed;
+            AxiIngress::Backpressure b = m_ingress.backpressure(port);
+            backpressure.ingress_full += b.ingress_full;
+            backpressure.port_full += b.port_full;
+        }
+        std::cout << "\n--- Multi-Threaded Ingress Stress Finished ---\n";
+        std::cout << "Threads: " << m_config.threads << " (ingress depth " << m_config.depth
+                  << ", " << m_config.port_outstanding << " outstanding per thread)\n";
+        std::cout << "Total Passed: " << total.passed << "\n";
+        std::cout << "Total Failed: " << total.failed << "\n";
+        std::cout << "Backpressure: " << backpressure.ingress_full + backpressure.port_full << " rejected submissions (ingress full "
+                  << backpressure.ingress_full << ", port full " << backpressure.port_full << ")\n";
+        std::cout << "AXI forwarding: " << m_axi_mgr.forwardedReads() << " reads forwarded, " << m_axi_mgr.coalescedWrites()
+                  << " writes coalesced\n";
+        std::cout << "Simulated Cycles: " << m_scheduler.now() << "\n";
+        std::cout << std::fixed << std::setprecision(0)
+                  << "Host throughput: " << (elapsed.count() > 0 ? (total.passed + total.failed) / elapsed.count() : 0.0)
+                  << " req/s (" << std::setprecision(3) << elapsed.count() << " s)\n";
+        std::cout.unsetf(std::ios_base::floatfield);
+        return total.failed == 0 && total.passed == m_config.requests;
+    }
+
+private:
+    struct Result {
+        uint64_t passed = 0;
+        uint64_t failed = 0;
+    };
+    // 送信して応答を待っているリクエスト (スレッドごと)
+    struct Op {
+        bool is_write = false;
+        AxiManagerModule::DataBlock data{}; // Write時は書き込みデータ, Read時は期待データ
+    };
+
+    // ポートのスレッド: リクエストを送り、自分の応答を検証する
+    void produce(uint64_t port, uint64_t requests) {
+        const uint64_t threads = m_config.threads;
+        std::mt19937_64 gen(m_config.seed * 0x9E3779B97F4A7C15ULL + port);
+        std::uniform_int_distribution<uint64_t> line_dist(0, m_config.footprint / 64 / threads - 1);
+        std::bernoulli_distribution write_dist(m_config.write_ratio);
+        std::unordered_map<uint64_t, AxiManagerModule::DataBlock> written; // アドレス -> このスレッドの最新の書き込みデータ
+        // 応答待ちの上限より1つ多く持ち、上限での拒否もAxiIngressに数えさせる
+        std::vector<Op> ops(m_config.port_outstanding + 1);
+        std::vector<uint64_t> free_ids;
+        for (uint64_t id = ops.size(); id-- > 0;) free_ids.push_back(id);
+        Result& result = m_results[port];
+        AxiIngress::Completion completion;
+        auto drain = [&] {
+            while (m_ingress.pollCompletion(port, completion)) {
+                const Op& op = ops[completion.id];
+                bool ok = op.is_write ? completion.success : completion.data == op.data;
+                (ok ? result.passed : result.failed)++;
+                free_ids.push_back(completion.id);
+            }
+        };
+
+        for (uint64_t i = 0; i < requests; ++i) {
+            uint64_t addr = MemoryMap::PROTECTION_BASE_ADDR + (line_dist(gen) * threads + port) * 64;
+            auto it = written.find(addr);
+            Op op;
+            op.is_write = write_dist(gen) || it == written.end(); // まだ書き込んでいないラインはWriteにする
+            op.data = op.is_write ? Testbench::loadData((port << 40) + i + 1) : it->second;
+            // 応答待ちは上限以下なので、idは必ず空いている (送り直す間にdrainが他のidを戻しても、このidは変わらない)
+            uint64_t id = free_ids.back();
+            free_ids.pop_back();
+            ops[id] = op;
+            while (!(op.is_write ? m_ingress.submitWrite(port, addr, id, op.data) : m_ingress.submitRead(port, addr, id))) {
+                drain();
+                std::this_thread::yield();
+            }
+            if (op.is_write) written[addr] = op.data;
+            drain();
+        }
+        while (m_ingress.inFlight(port) > 0) {
+            drain();
+            std::this_thread::yield();
+        }
+        m_finished.fetch_add(1, std::memory_order_release);
+    }
+
+    AxiManagerModule& m_axi_mgr;
+    RiscVCore& m_core;
+    EventScheduler& m_scheduler;
+    StressConfig m_config;
+    AxiIngress m_ingress;
+    std::vector<Result> m_results; // ポートごと (各スレッドが自分の要素のみ更新し、joinの後に集計する)
+    std::atomic<uint64_t> m_finished{0};
 };
 
 // =================================================================
 // メイン関数
 // =================================================================
-int main() {
+void printUsage() {
+    std::cerr << "usage: simulator [seed=N] [outstanding=N] [perf=PATH] [traffic=PATH] [timeline=PATH] (write/read correctness suite)\n"
+              << "       simulator load [key=value...]             (open-loop load)\n"
+              << "  requests=N interval=CYCLES arrival=poisson|fixed write_ratio=R seed=N\n"
+              << "  dist=uniform|zipfian|sequential|strided|hotset footprint=BYTES\n"
+              << "  zipf_theta=T stride=BYTES hot_fraction=F hot_probability=P\n"
+              << "       simulator replay file=PATH [time_scale=X] [footprint=BYTES] [limit=N]\n"
+              << "                                                 (open-loop replay of a binary trace)\n"
+              << "       simulator trace-gen out=PATH [with_data=0|1] [load key=value...]\n"
+              << "                                                 (write a synthetic binary trace)\n"
+              << "       simulator trace-convert format=simple|dramsim|ramulator|csv in=PATH out=PATH\n"
+              << "                                                 (convert a text trace to binary)\n"
+              << "       simulator stress [threads=N requests=N write_ratio=R footprint=BYTES seed=N ingress=N port_outstanding=N]\n"
+              << "                                                 (N host threads submit requests concurrently)\n"
+              << "  outstanding=N: keep up to N requests queued in the AXI manager (correctness suite)\n"
+              << "  sched=fifo|read_first [write_high=N write_low=N write_max_age=CYCLES]: AXI manager request scheduling;\n"
+              << "    read_first serves reads first, drains writes from write_high down to write_low queued writes,\n"
+              << "    and serves a write that has waited write_max_age cycles before any read\n"
+              << "  perf=PATH: write the performance counters as JSON at the end of the run\n"
+              << "  traffic=PATH [traffic_window=CYCLES]: write the DRAM traffic breakdown as JSON\n"
+              << "  timeline=PATH [timeline_requests=N]: write a Chrome trace timeline (first N requests) for Perfetto\n";
+}
+
+// key=value 形式の引数をモードごとに解釈した結果
+struct Options {
+    uint64_t seed = 1;             // 正当性テストのアドレス系列
+    uint64_t outstanding = 1;      // 正当性テスト: AXI Managerに積んでおくリクエスト数
+    LoadConfig load;               // load / trace-gen
+    std::string file;              // replay: 入力トレース
+    double time_scale = 1.0;       // replay: 時刻の間隔に掛ける係数 (大きいほど負荷が軽い)
+    uint64_t footprint = MemoryMap::PROTECTION_SIZE; // replay: アドレスをこの範囲に折り返す
+    uint64_t limit = UINT64_MAX;   // replay: 再生するレコード数の上限
+    std::string out;               // trace-gen / trace-convert: 出力トレース
+    bool with_data = false;        // trace-gen: 書き込みデータを含める
+    std::string format;            // trace-convert: 入力の形式
+    std::string in;                // trace-convert: 入力ファイル
+    std::string perf;              // 正当性テスト / load / replay: 性能カウンターのJSONの出力先
+    std::string traffic;           // 正当性テスト / load / replay: DRAMトラフィックの内訳のJSONの出力先
+    uint64_t traffic_window = TrafficStats::DEFAULT_WINDOW_CYCLES; // トラフィックの時間窓 (サイクル)
+    std::string timeline;          // 正当性テスト / load / replay: タイムライン(Chrome trace)の出力先
+    uint64_t timeline_requests = UINT64_MAX; // タイムラインに記録するリクエスト数の上限
+    StressConfig stress;           // stress: 複数スレッドからの受付のストレステスト
+    AxiManagerModule::SchedulePolicy sched = AxiManagerModule::SchedulePolicy::FIFO; // AXI Managerのスケジューリング方針
+    uint64_t write_high = Parameter::AXIM_WRITE_HIGH_WATERMARK; // read_first: Writeを続けて処理し始める数
+    uint64_t write_low = Parameter::AXIM_WRITE_LOW_WATERMARK;   // read_first: Readの優先に戻る数
+    uint64_t write_max_age = Parameter::AXIM_WRITE_MAX_AGE;     // read_first: Readより先に選ぶWriteの待ちサイクル数
+
+    bool parse(const std::string& mode, const std::string& arg) {
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = arg.substr(0, eq);
+        std::string value = arg.substr(eq + 1);
+        try {
+            bool simulated = mode.empty() || mode == "load" || mode == "replay" || mode == "stress";
+            if (key == "perf" && simulated) perf = value;
+            else if (key == "traffic" && simulated) traffic = value;
+            else if (key == "traffic_window" && simulated) traffic_window = std::stoull(value);
+            else if (key == "timeline" && simulated) timeline = value;
+            else if (key == "timeline_requests" && simulated) timeline_requests = std::stoull(value);
+            else if (key == "sched" && simulated) {
+                if (value == "fifo") sched = AxiManagerModule::SchedulePolicy::FIFO;
+                else if (value == "read_first") sched = AxiManagerModule::SchedulePolicy::READ_FIRST;
+                else return false;
+            }
+            else if (key == "write_high" && simulated) write_high = std::stoull(value);
+            else if (key == "write_low" && simulated) write_low = std::stoull(value);
+            else if (key == "write_max_age" && simulated) write_max_age = std::stoull(value);
+            else if (mode.empty() && key == "seed") seed = std::stoull(value);
+            else if (mode.empty() && key == "outstanding") outstanding = std::stoull(value);
+            else if (mode == "load") return load.parse(arg);
+            else if (mode == "replay" && key == "file") file = value;
+            else if (mode == "replay" && key == "time_scale") time_scale = std::stod(value);
+            else if (mode == "replay" && key == "footprint") footprint = std::stoull(value, nullptr, 0);
+            else if (mode == "replay" && key == "limit") limit = std::stoull(value);
+            else if (mode == "trace-gen" && key == "out") out = value;
+            else if (mode == "trace-gen" && key == "with_data") with_data = std::stoull(value) != 0;
+            else if (mode == "trace-gen") return load.parse(arg);
+            else if (mode == "trace-convert" && key == "format") format = value;
+            else if (mode == "trace-convert" && key == "in") in = value;
+            else if (mode == "trace-convert" && key == "out") out = value;
+            else if (mode == "stress" && key == "threads") stress.threads = std::stoull(value);
+            else if (mode == "stress" && key == "requests") stress.requests = std::stoull(value);
+            else if (mode == "stress" && key == "write_ratio") stress.write_ratio = std::stod(value);
+            else if (mode == "stress" && key == "footprint") stress.footprint = std::stoull(value, nullptr, 0);
+            else if (mode == "stress" && key == "seed") stress.seed = std::stoull(value);
+            else if (mode == "stress" && key == "ingress") stress.depth = std::stoull(value);
+            else if (mode == "stress" && key == "port_outstanding") stress.port_outstanding = std::stoull(value);
+            else return false;
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    bool valid(const std::string& mode) const {
+        if (traffic_window == 0 || outstanding == 0 || outstanding > Parameter::AXIM_MAX_OUTSTANDING || write_low >= write_high) return false;
+        if (mode == "load") return load.valid();
+        if (mode == "replay") return !file.empty() && time_scale >= 0 && footprint >= 64 && footprint <= MemoryMap::PROTECTION_SIZE;
+        if (mode == "trace-gen") return !out.empty() && load.valid();
+        if (mode == "trace-convert") return !format.empty() && !in.empty() && !out.empty();
+        if (mode == "stress") {
+            return stress.threads > 0 && stress.depth > 0 && stress.port_outstanding > 0 && stress.write_ratio >= 0 && stress.write_ratio <= 1
+                && stress.footprint <= MemoryMap::PROTECTION_SIZE && stress.footprint / 64 >= stress.threads;
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief 負荷生成器の系列をバイナリトレースに書き出す (seedが同じなら同じトレースになる)
+ */
+int writeSyntheticTrace(const Options& options) {
+    Trace::Writer writer;
+    if (!writer.open(options.out, options.with_data)) return 1;
+    LoadGenerator generator(options.load);
+    Trace::Entry entry;
+    for (uint64_t i = 0; i < options.load.requests; ++i) {
+        LoadGenerator::Request req = generator.next();
+        entry.cycle += req.delay;
+        entry.is_write = req.is_write;
+        entry.addr = req.addr;
+        if (options.with_data) entry.data = Testbench::loadData(i + 1);
+        writer.write(entry);
+    }
+    std::cout << "Wrote " << writer.count() << " records to " << options.out << "\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // --- 0. 実行モードの選択 ---
+    std::string mode = (argc > 1 && std::string(argv[1]).find('=') == std::string::npos) ? argv[1] : "";
+    if (!mode.empty() && mode != "load" && mode != "replay" && mode != "trace-gen" && mode != "trace-convert" && mode != "stress") {
+        printUsage();
+        return 1;
+    }
+    Options options;
+    for (int i = mode.empty() ? 1 : 2; i < argc; ++i) {
+        if (!options.parse(mode, argv[i])) {
+            std::cerr << "Invalid argument: " << argv[i] << "\n";
+            printUsage();
+            return 1;
+        }
+    }
+    if (!options.valid(mode)) {
+        std::cerr << "Invalid " << (mode.empty() ? "test" : mode) << " configuration.\n";
+        printUsage();
+        return 1;
+    }
+
+    // ハードウェアを使わないモード
+    if (mode == "trace-gen") return writeSyntheticTrace(options);
+    if (mode == "trace-convert") {
+        int64_t records = Trace::convertText(options.format, options.in, options.out);
+        if (records < 0) return 1;
+        std::cout << "Converted " << records << " records to " << options.out << "\n";
+        return 0;
+    }
+
     // --- 1. ハードウェアのセットアップ ---
+    EventScheduler scheduler;
     Dram dram;
     Spm spm;
-    SpmModule spm_mod(dram, spm);
-    HashModule hash_mod(spm);
-    AxiManagerModule axi_mgr_mod(spm);
-    AesModule aes_mod(axi_mgr_mod);
-    Bus bus(dram, spm);
-    RiscVCore core(bus);
+    SpmModule spm_mod(dram, spm, scheduler);
+    HashModule hash_mod(spm, scheduler);
+    AxiManagerModule axi_mgr_mod(spm, scheduler);
+    AesModule aes_mod(axi_mgr_mod, scheduler);
+    Bus bus(dram, spm, scheduler);
+    RiscVCore core(bus, scheduler);
+    PerfCounters perf;
+    TrafficStats traffic(scheduler, options.traffic_window);
+    TimelineTrace timeline(scheduler);
+    if (!options.timeline.empty() && !timeline.open(options.timeline, options.timeline_requests)) return 1;
     bus.connectSpmModule(spm_mod);
     bus.connectHashModule(hash_mod);
     bus.connectAesModule(aes_mod);
     bus.connectAxiManagerModule(axi_mgr_mod);
+    bus.connectPerfCounters(perf);
+    spm_mod.attachPerfCounters(perf);
+    hash_mod.attachPerfCounters(perf);
+    aes_mod.attachPerfCounters(perf);
+    axi_mgr_mod.attachPerfCounters(perf);
+    core.attachPerfCounters(perf);
+    dram.attachTrafficStats(traffic);
+    core.attachTrafficStats(traffic);
+    spm_mod.attachTimeline(timeline);
+    hash_mod.attachTimeline(timeline);
+    aes_mod.attachTimeline(timeline);
+    axi_mgr_mod.attachTimeline(timeline);
+    axi_mgr_mod.setSchedulePolicy(options.sched, options.write_high, options.write_low, options.write_max_age);
+    core.attachTimeline(timeline);
+    core.boot();
     
-    std::cout << "--- System Initialized ---\n";
+    SIM_LOG(TB, INFO, "--- System Initialized ---");
+
+    // 実行の最後に表示・書き出しするもの
+    auto finish = [&] {
+        std::cout << "DRAM: Resident " << dram.residentBytes() / 1024 << " KB\n";
+        if (!options.perf.empty()) {
+            std::ofstream os(options.perf);
+            if (!os) {
+                std::cerr << "Cannot write performance counters to " << options.perf << "\n";
+                return 1;
+            }
+            perf.writeJson(os);
+        }
+        if (!options.traffic.empty()) {
+            std::ofstream os(options.traffic);
+            if (!os) {
+                std::cerr << "Cannot write the DRAM traffic breakdown to " << options.traffic << "\n";
+                return 1;
+            }
+            traffic.writeJson(os);
+            traffic.printSummary(std::cout);
+        }
+        return 0;
+    };
+
+    if (mode == "stress") {
+        StressTest stress(axi_mgr_mod, core, scheduler, options.stress);
+        if (!stress.run()) return 1;
+        return finish();
+    }
 
     // --- 2. テストベンチを初期化 ---
-    Testbench tb(axi_mgr_mod, core);
+    Testbench tb(axi_mgr_mod, core, scheduler);
+    if (mode == "load") {
+        LoadGenerator generator(options.load);
+        uint64_t remaining = options.load.requests;
+        tb.runOpenLoop([&generator, &remaining](Testbench::Arrival& arrival) {
+            if (remaining == 0) return false;
+            remaining--;
+            LoadGenerator::Request req = generator.next();
+            arrival.delay = req.delay;
+            arrival.is_write = req.is_write;
+            arrival.addr = req.addr;
+            return true;
+        }, "Open-Loop Load");
+        return finish();
+    }
+    if (mode == "replay") {
+        // トレースは1レコードずつ読み、時刻の差を到着間隔、アドレスを保護領域内に折り返したものを要求アドレスとする
+        Trace::Reader reader;
+        if (!reader.open(options.file)) return 1;
+        Trace::Entry entry;
+        uint64_t replayed = 0;
+        uint64_t last_cycle = 0;
+        double clock = 0;          // time_scaleを掛けた到着時刻 (端数を累積する)
+        uint64_t last_arrival = 0;
+        tb.runOpenLoop([&](Testbench::Arrival& arrival) {
+            if (replayed == options.limit || !reader.next(entry)) return false;
+            // 最初のレコードの時刻を0とし、時刻が戻るレコードは直前と同時に到着させる
+            uint64_t gap = (replayed == 0 || entry.cycle < last_cycle) ? 0 : entry.cycle - last_cycle;
+            if (replayed == 0 || entry.cycle > last_cycle) last_cycle = entry.cycle;
+            clock += gap * options.time_scale;
+            uint64_t now = static_cast<uint64_t>(clock);
+            arrival.delay = now - last_arrival;
+            last_arrival = now;
+            arrival.is_write = entry.is_write;
+            arrival.addr = MemoryMap::PROTECTION_BASE_ADDR + (entry.addr % options.footprint) / 64 * 64;
+            arrival.has_data = entry.has_data;
+            arrival.data = entry.data;
+            replayed++;
+            return true;
+        }, "Trace Replay");
+        return finish();
+    }
     
-    // --- 3. テストシナリオを生成 (40回のランダムなRead/Write) ---
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<uint32_t> addr_dist(0, 0x04000000 / 64 - 1); // 64Bアラインされたアドレス範囲
+    // --- 3. テストシナリオを生成 (40000回のランダムなWriteとRead) ---
+    // アドレス系列はseedで決まる (既定値固定のため、実行ごとに同じシナリオになる)
+    std::mt19937_64 gen(options.seed);
+    std::uniform_int_distribution<uint64_t> addr_dist(0, MemoryMap::PROTECTION_SIZE / 64 - 1); // 64Bアラインされたアドレス範囲
     std::vector<std::pair<uint64_t, AxiManagerModule::DataBlock>> test_plan;
     std::map<uint64_t, AxiManagerModule::DataBlock> final_memory_state;
     const int NUM_TESTS = 40000;
-    std::cout << "\n[TB] Generating " << NUM_TESTS << " test cases...\n";
+    SIM_LOG(TB, INFO, "\n[TB] Generating " << NUM_TESTS << " test cases (seed " << options.seed << ")...");
     for (int i = 0; i < NUM_TESTS; ++i) {
         uint64_t addr = addr_dist(gen) * 64;
         AxiManagerModule::DataBlock data;
@@ -169,7 +801,6 @@ int main() {
         tb.addReadTest(test_case.first, final_memory_state[test_case.first]);
     }
     // --- 4. テストスイートを実行 ---
-    tb.run();
-    
-    return 0;
+    tb.run(options.outstanding);
+    return finish();
 }
\ No newline at end of file
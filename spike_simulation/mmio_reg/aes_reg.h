@@ -1,7 +1,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "reg_map.h"
-void set_seed(const uint64_t major_counter, const uint8_t minor_counter, const uint64_t request_addr){
+void set_seed(const uint64_t major_counter, const uint64_t minor_counter, const uint64_t request_addr){
     uint64_t seed_0 = request_addr + major_counter;
     uint64_t seed_1 = request_addr + (minor_counter);
     uint64_t seed_2 = request_addr + 16 + major_counter;
@@ -21,6 +21,11 @@ void axim_decrypt(){
     while(AXIM_BUSY_REG); // busy待ち
     AXIM_COMMAND_REG = 8; // DECRYPT
 }
+void axim_decrypt_to_spm(const uint64_t spm_offset){
+    while(AXIM_BUSY_REG); // busy待ち
+    AXIM_SPM_ADDR_REG = spm_offset;
+    AXIM_COMMAND_REG = 8 | 64; // DECRYPT, READ_DATA_WRITE_BACK (R Buffer -> SPM)
+}
 void axim_read_return(){
     while(AXIM_BUSY_REG); // busy待ち
     AXIM_COMMAND_REG = 16; // READ_RETURN
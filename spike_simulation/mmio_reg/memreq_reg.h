@@ -4,6 +4,11 @@
 #include "reg_map.h"
 
 /* --- MEMREQ 操作用インライン関数 --- */
+/* アドレス系列の乱数シードを設定する (memreq_makeより前に呼ぶ。既定値は1) */
+static inline void memreq_seed(uint64_t seed) {
+    MEMREQ_SEED_REG = seed;
+}
+
 static inline void memreq_make(uint64_t size, uint64_t num) {
     MEMREQ_MEM_SIZE_REG = size;
   MEMREQ_NUM_REG  = num;
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+#include "reg_map.h"
+
+/* --- PERF 操作用インライン関数 --- */
+/* 全カウンターを0に戻す */
+static inline void perf_reset(void) {
+  PERF_CONTROL_REG = 1;
+}
+
+/* カウンターiを読む */
+static inline uint64_t perf_read(uint64_t i) {
+  return PERF_COUNTER_REG(i);
+}
+
+/* ファームウェアのイベントを通知する (カウンターiを1増やす) */
+static inline void perf_event(uint64_t i) {
+  PERF_EVENT_REG = i;
+}
+
+/* DRAMトラフィックの内訳に使う領域の配置を設定する
+ * level_base[i]: counter_baseから階層i(0: 最上位)の先頭までのオフセット, end: 最上位の階層の末尾 */
+static inline void perf_set_layout(uint64_t data_base, uint64_t tag_base, uint64_t counter_base, uint64_t end,
+                                   uint64_t levels, const uint64_t* level_base) {
+  PERF_REGION_REG(PERF_REGION_DATA_BASE) = data_base;
+  PERF_REGION_REG(PERF_REGION_TAG_BASE) = tag_base;
+  PERF_REGION_REG(PERF_REGION_COUNTER_BASE) = counter_base;
+  PERF_REGION_REG(PERF_REGION_END) = end;
+  PERF_REGION_REG(PERF_REGION_LEVELS) = levels;
+  for (uint64_t i = 0; i < levels; ++i) PERF_REGION_REG(PERF_REGION_LEVEL_BASE + i * 8) = level_base[i];
+}
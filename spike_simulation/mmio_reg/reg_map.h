@@ -19,6 +19,17 @@
 #define SPM_REG_DIRECTION    0x18ULL /* 0/1 */
 #define SPM_REG_START        0x20ULL /* write 1=start / read: busy */
 #define SPM_REG_STATUS       0x28ULL
+/* ディスクリプタリング */
+#define SPM_REG_RING_PUSH    0x30ULL /* write: DRAM_ADDR〜DIRECTIONを1つのディスクリプタとして投入 (値は優先度 0/1) */
+#define SPM_REG_RING_STATUS  0x38ULL /* read: [7:0] 未完了数, [15:8] 次に投入するスロット */
+#define SPM_REG_RING_DONE    0x40ULL /* read: 完了ビットマップ (ビットi = スロットi。投入時にクリア) */
+#define SPM_REG_RING_LAST_SLOT 0x58ULL /* read: 最後に投入したスロット (満杯で投入できなかった場合はSPM_DMA_RING_SIZE) */
+#define SPM_DMA_RING_SIZE    8
+/* スキャッター・ギャザー (複数の64Bラインの転送を1つのコマンドで実行する) */
+#define SPM_REG_SG_START     0x48ULL  /* write: SG_LISTの先頭から値の数のエントリを実行 / read: busy */
+#define SPM_REG_SG_LINES     0x50ULL  /* read: 最後のコマンドで転送したライン数 */
+#define SPM_REG_SG_LIST      0x100ULL /* エントリi: +16i DRAMアドレス | 方向(bit0), +16i+8 SPMデータ窓先頭からのオフセット */
+#define SPM_DMA_SG_ENTRIES   16
 
 /* データ窓のベース */
 #define SPM_MEM_BASE   (SPM_BASE + SPM_CTRL_SIZE)
@@ -33,6 +44,14 @@
 #define SPM_DIRECTION      SPM_REG64(SPM_REG_DIRECTION)
 #define SPM_START          SPM_REG64(SPM_REG_START)
 #define SPM_STATUS         SPM_REG64(SPM_REG_STATUS)
+#define SPM_RING_PUSH      SPM_REG64(SPM_REG_RING_PUSH)
+#define SPM_RING_STATUS    SPM_REG64(SPM_REG_RING_STATUS)
+#define SPM_RING_DONE      SPM_REG64(SPM_REG_RING_DONE)
+#define SPM_RING_LAST_SLOT SPM_REG64(SPM_REG_RING_LAST_SLOT)
+#define SPM_SG_START       SPM_REG64(SPM_REG_SG_START)
+#define SPM_SG_LINES       SPM_REG64(SPM_REG_SG_LINES)
+#define SPM_SG_DRAM(i)     SPM_REG64(SPM_REG_SG_LIST + (i) * 16)
+#define SPM_SG_LOCAL(i)    SPM_REG64(SPM_REG_SG_LIST + (i) * 16 + 8)
 #endif // SPM_ADDRMAP_H
 
 #ifndef MAC_ADDRMAP_H
@@ -127,8 +146,51 @@
 #define MEMREQ_CTRL_SIZE    0x00001000ULL
 #define MEMREQ_MEM_SIZE     0x00ULL
 #define MEMREQ_NUM          0x08ULL
+#define MEMREQ_SEED         0x10ULL
 
 /* 実際のレジスタアクセス */
 #define MEMREQ_MEM_SIZE_REG REG64(MEMREQ_BASE, MEMREQ_MEM_SIZE)
 #define MEMREQ_NUM_REG      REG64(MEMREQ_BASE, MEMREQ_NUM)
+#define MEMREQ_SEED_REG     REG64(MEMREQ_BASE, MEMREQ_SEED)
 #endif // MEMREQ_ADDRMAP_H
+
+#ifndef PERF_ADDRMAP_H
+#define PERF_ADDRMAP_H
+/* PERF (性能カウンター) */
+#define PERF_BASE           (MEMREQ_BASE + MEMREQ_CTRL_SIZE)
+#define PERF_CTRL_SIZE      0x00001000ULL
+#define PERF_CONTROL        0x00ULL /* W: 1で全カウンターを0に戻す / R: カウンター数 */
+#define PERF_EVENT          0x08ULL /* W: 書き込んだ番号のカウンターを1増やす */
+#define PERF_COUNTER_BASE   0x100ULL
+/* DRAMトラフィックを振り分ける領域の配置 (W) */
+#define PERF_REGION_DATA_BASE     0x10ULL
+#define PERF_REGION_TAG_BASE      0x18ULL
+#define PERF_REGION_COUNTER_BASE  0x20ULL
+#define PERF_REGION_END           0x28ULL /* ツリー(最上位の階層)の末尾 */
+#define PERF_REGION_LEVELS        0x30ULL /* ツリーの高さ (カウンターの階層を含む) */
+#define PERF_REGION_LEVEL_BASE    0x40ULL /* + 階層 * 8: COUNTER_BASEから階層の先頭までのオフセット */
+
+/* カウンター番号 (mmio_map.hのperf_addrmap_tと同じ並び) */
+#define PERF_READ_REQUESTS        0
+#define PERF_WRITE_REQUESTS       1
+#define PERF_READ_LATENCY_SUM     2
+#define PERF_WRITE_LATENCY_SUM    3
+#define PERF_DMA_BYTES_TO_SPM     4
+#define PERF_DMA_BYTES_TO_DRAM    5
+#define PERF_MAC_UPDATE_BYTES     6
+#define PERF_AES_BLOCKS           7
+#define PERF_OTP_FIFO_HIGH_WATER  8
+#define PERF_SPM_WRITEBACKS       9
+#define PERF_SPM_HIT_TAG          10
+#define PERF_SPM_MISS_TAG         11
+#define PERF_SPM_HIT_COUNTER      12
+#define PERF_SPM_MISS_COUNTER     13
+#define PERF_SPM_HIT_TREE(i)      (14 + 2 * (i)) /* 階層i (0: 最上位) */
+#define PERF_SPM_MISS_TREE(i)     (15 + 2 * (i))
+
+/* 実際のレジスタアクセス */
+#define PERF_CONTROL_REG    REG64(PERF_BASE, PERF_CONTROL)
+#define PERF_EVENT_REG      REG64(PERF_BASE, PERF_EVENT)
+#define PERF_COUNTER_REG(i) REG64(PERF_BASE, PERF_COUNTER_BASE + (i) * 8)
+#define PERF_REGION_REG(off) REG64(PERF_BASE, off)
+#endif // PERF_ADDRMAP_H
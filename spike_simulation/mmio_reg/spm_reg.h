@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "reg_map.h"
+#include "perf_reg.h"
+#include "tree_geometry.h"
 
 
 /* --- SPM 操作用インライン関数 --- */
@@ -32,6 +34,35 @@ static inline void spm_write_back(uint64_t local_off, uint64_t dram_pa, uint64_t
   spm_wait_idle();
 }
 
+/* ディスクリプタリングに転送を投入する (完了は待たない)。リングが満杯なら空くまで待つ
+ * high_priority: 先に投入された通常の転送より優先する。戻り値は完了ビットマップのビット番号 */
+static inline uint64_t spm_ring_post(uint64_t dram_pa, uint64_t local_off, uint64_t size, uint64_t direction, bool high_priority) {
+  while ((SPM_RING_STATUS & 0xff) >= SPM_DMA_RING_SIZE) { /* 満杯の間スピン */ }
+  SPM_DRAM_ADDRESS  = dram_pa;
+  SPM_LOCAL_ADDRESS = local_off;
+  SPM_SIZE_REG      = size;
+  SPM_DIRECTION     = direction;
+  SPM_RING_PUSH     = high_priority ? 1 : 0;
+  return SPM_RING_LAST_SLOT; // 投入までにスロットが変わり得るため、実際に使われたスロットを読む
+}
+/* slotのビットが全て立つまで待つ */
+static inline void spm_ring_wait(uint64_t slots) {
+  while ((SPM_RING_DONE & slots) != slots) { /* 未完了の間スピン */ }
+}
+
+/* スキャッター・ギャザーのリストの末尾にエントリを追加する (SG_LISTレジスタに直接書き込む) */
+static inline void spm_sg_add(uint64_t* count, uint64_t dram_pa, uint64_t local_off, uint64_t direction) {
+  SPM_SG_DRAM(*count)  = dram_pa | direction;
+  SPM_SG_LOCAL(*count) = local_off;
+  ++*count;
+}
+/* リストの先頭count個のエントリを1つのコマンドで転送し、完了を待つ */
+static inline void spm_sg_run(uint64_t count) {
+  if (count == 0) return;
+  SPM_SG_START = count;
+  while (SPM_SG_START) { /* 実行中はスピン */ }
+}
+
 /* データ窓の直接アクセス（必要なら 1/2/4 も追加） */
 static inline uint64_t spm_ld64(uint64_t off) {
   return *(volatile uint64_t *)((uintptr_t)(SPM_MEM_BASE + off));
@@ -40,33 +71,242 @@ static inline void spm_sd64(uint64_t off, uint64_t v) {
   *(volatile uint64_t *)((uintptr_t)(SPM_MEM_BASE + off)) = v;
 }
 
-static inline void setBlockdirty(uint64_t manage_addr, uint64_t block_addr){
-  uint64_t new_info = ((block_addr >> 6) << 6) | 0x3; // dirty | valid
-  spm_sd64(manage_addr, new_info);
+/* 管理ワード: | タグ(58bit) | 置換状態(3bit) | verified(1bit) | dirty(1bit) | valid(1bit) | */
+#define SPM_MANAGE_VALID    (1ULL << 0)
+#define SPM_MANAGE_DIRTY    (1ULL << 1)
+#define SPM_MANAGE_VERIFIED (1ULL << 2) /* ツリー検証済み(オンチップで信頼できる) */
+#define SPM_MANAGE_REPL_SHIFT 3         /* LRU: 経過順位 / RRIP: 再参照予測値 */
+#define SPM_MANAGE_REPL_MASK  (0x7ULL << SPM_MANAGE_REPL_SHIFT)
+
+/* --- SPMメタデータキャッシュ ---
+ * 0ライン目: ルート, 1ライン目: 暗号文, 2ライン目以降: 常駐ツリーノード, 書き戻し用ステージング, メタデータキャッシュ,
+ * 56-63ライン目: 管理領域(タグ配列)
+ * カウンター・データタグ・常駐しないツリーノードは全てこのキャッシュを共有する */
+#define SPM_CACHE_LRU  0
+#define SPM_CACHE_RRIP 1
+#ifndef SPM_CACHE_POLICY
+#define SPM_CACHE_POLICY SPM_CACHE_LRU
+#endif
+#define SPM_ROOT_LINE        0
+#define SPM_DATA_LINE        1
+#define SPM_MANAGE_LINE      56
+/* ツリーの上位SPM_PINNED_LEVELS階層は起動時に検証してSPMに常駐させ、追い出さない
+ * 0: 常駐なし, 1: 階層1のみ, 2: 階層1-2, ... */
+#define SPM_PINNED_FIRST_LINE 2
+/* 上位levels階層のノード数の合計 */
+#define SPM_PINNED_LINE_COUNT(levels) TREE_TOP_NODES(levels)
+/* 既定では、常駐させてもメタデータキャッシュに最小構成で2セット以上残る最大の階層数を選ぶ (32分木・64MBでは2)
+ * 8分木でも階層1-4は147ライン以上になり収まらないため、3階層までを調べればよい */
+#define SPM_PINNED_FITS(levels) ((levels) < TREE_HEIGHT && \
+  SPM_PINNED_FIRST_LINE + SPM_PINNED_LINE_COUNT(levels) + (TREE_HEIGHT - (levels) - 1) + 2 * (TREE_HEIGHT - (levels) + 1) <= SPM_MANAGE_LINE)
+#ifndef SPM_PINNED_LEVELS
+#define SPM_PINNED_LEVELS (SPM_PINNED_FITS(3) ? 3 : SPM_PINNED_FITS(2) ? 2 : SPM_PINNED_FITS(1) ? 1 : 0)
+#endif
+#ifndef SPM_CACHE_WAYS
+/* 連想度 (既定6、常駐しない階層が多い形状ではそれ以上) */
+#define SPM_CACHE_WAYS (TREE_HEIGHT - SPM_PINNED_LEVELS + 1 > 6 ? TREE_HEIGHT - SPM_PINNED_LEVELS + 1 : 6)
+#endif
+#define SPM_PINNED_LINES      SPM_PINNED_LINE_COUNT(SPM_PINNED_LEVELS)
+/* ツリー更新方式
+ * EAGER: 書き込みごとにパス上の全階層のカウンターをインクリメントし、MACを再計算する
+ * LAZY:  書き込みではリーフのカウンターのみ更新し、Dirtyなツリーノードの追い出し時に親の更新とMAC再計算を行う */
+#define SPM_TREE_EAGER 0
+#define SPM_TREE_LAZY  1
+#ifndef SPM_TREE_UPDATE
+#define SPM_TREE_UPDATE SPM_TREE_EAGER
+#endif
+/* 遅延更新の書き戻し時、SPMキャッシュに無い祖先(常駐階層とリーフの間)を一時的に置くライン */
+#define SPM_STAGING_FIRST_LINE (SPM_PINNED_FIRST_LINE + SPM_PINNED_LINES)
+#define SPM_STAGING_LINES      (SPM_TREE_UPDATE == SPM_TREE_LAZY ? TREE_HEIGHT - SPM_PINNED_LEVELS - 1 : 0)
+#define SPM_CACHE_FIRST_LINE  (SPM_STAGING_FIRST_LINE + SPM_STAGING_LINES)
+#define SPM_CACHE_SETS  ((SPM_MANAGE_LINE - SPM_CACHE_FIRST_LINE) / SPM_CACHE_WAYS)
+#define SPM_RRIP_MAX    3 /* 2bit RRPV */
+#define SPM_RRIP_INSERT 2 /* SRRIP: 挿入時は「遠い再参照」と予測 */
+#define SPM_LINE_OFF(line)   ((uint64_t)(line) * 64)
+#define SPM_MANAGE_OFF(line) (SPM_MANAGE_LINE * 64ULL + (uint64_t)(line) * 8)
+#define SPM_CACHE_LINE(set, way) (SPM_CACHE_FIRST_LINE + (set) * SPM_CACHE_WAYS + (way))
+/* 1リクエストは最大で常駐しないツリー階層(TREE_HEIGHT - SPM_PINNED_LEVELS) + データタグのラインを同時に使う */
+_Static_assert(SPM_PINNED_LEVELS < TREE_HEIGHT, "leaf counter level cannot be pinned");
+_Static_assert(SPM_CACHE_FIRST_LINE < SPM_MANAGE_LINE, "pinned tree levels and staging lines do not fit in SPM");
+_Static_assert(SPM_CACHE_WAYS >= TREE_HEIGHT - SPM_PINNED_LEVELS + 1, "SPM cache needs at least one way per unpinned level plus the data tag");
+_Static_assert(SPM_CACHE_SETS > 0, "SPM cache has no sets");
+_Static_assert(SPM_CACHE_WAYS <= 8, "SPM cache supports up to 8 ways");
+
+/* 現在のリクエストで使用中のSPMライン (bit = ライン番号)。処理中に追い出さない */
+static uint64_t spm_request_lines;
+
+static inline void spm_cache_begin_request(void){
+  spm_request_lines = 0;
+}
+static inline uint64_t spm_manage_of(uint64_t spm_offset){
+  return SPM_MANAGE_OFF(spm_offset / 64);
+}
+static inline uint64_t spm_repl_state(uint64_t info){
+  return (info & SPM_MANAGE_REPL_MASK) >> SPM_MANAGE_REPL_SHIFT;
 }
-static inline void clearBlockdirty(uint64_t manage_addr, uint64_t block_addr){
-  uint64_t new_info = ((block_addr >> 6) << 6) | 0x1; // valid
-  spm_sd64(manage_addr, new_info);
+static inline uint64_t spm_with_repl_state(uint64_t info, uint64_t state){
+  return (info & ~SPM_MANAGE_REPL_MASK) | (state << SPM_MANAGE_REPL_SHIFT);
+}
+
+/* Dirtyビットを立てる (タグ・置換状態・verifiedは保持) */
+static inline void setBlockdirty(uint64_t manage_addr){
+  spm_sd64(manage_addr, spm_ld64(manage_addr) | SPM_MANAGE_DIRTY | SPM_MANAGE_VALID);
+}
+/* 検証済みビットを立てる */
+static inline void setBlockVerified(uint64_t manage_addr){
+  spm_sd64(manage_addr, spm_ld64(manage_addr) | SPM_MANAGE_VERIFIED);
+}
+/* SPM上のブロックが検証済みか */
+static inline bool isBlockVerified(uint64_t manage_addr){
+  uint64_t info = spm_ld64(manage_addr);
+  return (info & SPM_MANAGE_VALID) && (info & SPM_MANAGE_VERIFIED);
+}
+
+#if SPM_TREE_UPDATE == SPM_TREE_LAZY
+/* Dirtyなブロックを追い出す。ツリーノードは親カウンターの更新とMAC再計算が必要なためファームウェア側で実装する */
+void spm_evict_dirty_block(uint64_t spm_offset, uint64_t block_addr);
+/* 追い出しでファームウェアが祖先を更新するか (ツリーノード) */
+bool spm_evict_updates_tree(uint64_t block_addr);
+#else
+/* 書き戻しはディスクリプタリングに投入し、完了を待たない (同じラインへのロードとの順序はSPM-DMAが保つ) */
+static inline void spm_evict_dirty_block(uint64_t spm_offset, uint64_t block_addr){
+  spm_ring_post(block_addr, spm_offset, 64, 1, false);
+}
+static inline bool spm_evict_updates_tree(uint64_t block_addr){
+  (void)block_addr;
+  return false;
+}
+#endif
+
+/* 置換状態を更新し、変化した管理ワードのみ書き戻す
+ * lru_old_age: LRU時、参照前のウェイの経過順位 (無効ウェイへの割り当てはSPM_CACHE_WAYS) */
+static inline void spm_cache_update(uint64_t set, uint64_t* infos, uint64_t way, uint64_t lru_old_age, bool is_hit){
+  uint64_t updated[SPM_CACHE_WAYS];
+  for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) updated[w] = infos[w];
+#if SPM_CACHE_POLICY == SPM_CACHE_LRU
+  for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) {
+    if (w != way && (updated[w] & SPM_MANAGE_VALID) && spm_repl_state(updated[w]) < lru_old_age)
+      updated[w] = spm_with_repl_state(updated[w], spm_repl_state(updated[w]) + 1);
+  }
+  updated[way] = spm_with_repl_state(updated[way], 0);
+#else
+  (void)lru_old_age;
+  updated[way] = spm_with_repl_state(updated[way], is_hit ? 0 : SPM_RRIP_INSERT);
+#endif
+  for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) {
+    /* 新規割り当て時は呼び出し側がタグを書き換えているので必ず書き込む */
+    if (updated[w] != infos[w] || (!is_hit && w == way))
+      spm_sd64(SPM_MANAGE_OFF(SPM_CACHE_LINE(set, w)), updated[w]);
+    infos[w] = updated[w];
+  }
+}
+
+/* 追い出し対象のウェイを選ぶ。現在のリクエストで使用中のラインは選ばない */
+static inline uint64_t spm_cache_select_victim(uint64_t set, uint64_t* infos){
+  for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) {
+    if (!(infos[w] & SPM_MANAGE_VALID)) return w;
+  }
+#if SPM_CACHE_POLICY == SPM_CACHE_LRU
+  uint64_t victim = SPM_CACHE_WAYS;
+  for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) {
+    if ((spm_request_lines >> SPM_CACHE_LINE(set, w)) & 1) continue;
+    if (victim == SPM_CACHE_WAYS || spm_repl_state(infos[w]) > spm_repl_state(infos[victim])) victim = w;
+  }
+  return victim;
+#else
+  /* SRRIP: 再参照予測値が最大のラインを探し、なければ全体を加齢して繰り返す */
+  for (;;) {
+    for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) {
+      if (!((spm_request_lines >> SPM_CACHE_LINE(set, w)) & 1) && spm_repl_state(infos[w]) == SPM_RRIP_MAX) return w;
+    }
+    for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) {
+      if ((spm_request_lines >> SPM_CACHE_LINE(set, w)) & 1) continue;
+      infos[w] = spm_with_repl_state(infos[w], spm_repl_state(infos[w]) + 1);
+      spm_sd64(SPM_MANAGE_OFF(SPM_CACHE_LINE(set, w)), infos[w]);
+    }
+  }
+#endif
+}
+
+/* 指定ブロックがSPMキャッシュ上にあればそのオフセットを返す (ロードは行わない)。なければ0 */
+static inline uint64_t lookupBlockInSpm(uint64_t block_addr){
+  uint64_t set = (block_addr / 64) % SPM_CACHE_SETS;
+  uint64_t infos[SPM_CACHE_WAYS];
+  for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) infos[w] = spm_ld64(SPM_MANAGE_OFF(SPM_CACHE_LINE(set, w)));
+  for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) {
+    if ((infos[w] & SPM_MANAGE_VALID) && ((infos[w] >> 6) << 6) == block_addr) {
+      spm_cache_update(set, infos, w, spm_repl_state(infos[w]), true);
+      spm_request_lines |= 1ULL << SPM_CACHE_LINE(set, w);
+      return SPM_LINE_OFF(SPM_CACHE_LINE(set, w));
+    }
+  }
+  return 0;
+}
+/* lookupBlockInSpmと同様だが、置換状態の更新も使用中の記録も行わない */
+static inline uint64_t peekBlockInSpm(uint64_t block_addr){
+  uint64_t set = (block_addr / 64) % SPM_CACHE_SETS;
+  for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) {
+    uint64_t info = spm_ld64(SPM_MANAGE_OFF(SPM_CACHE_LINE(set, w)));
+    if ((info & SPM_MANAGE_VALID) && ((info >> 6) << 6) == block_addr) return SPM_LINE_OFF(SPM_CACHE_LINE(set, w));
+  }
+  return 0;
+}
+/* SPMキャッシュの参照を性能カウンターに通知するフック。
+ * ブロックの種類(データタグ・カウンター・ツリーの階層)はアドレスマップを知るファームウェア側で判定するので、
+ * 使う場合はこのヘッダより前に定義する */
+#ifndef SPM_PERF_LOOKUP
+#define SPM_PERF_LOOKUP(block_addr, is_hit) ((void)0)
+#endif
+/**
+     * @brief 指定されたブロックのSPMキャッシュ上の位置を決め、ミスならロードをディスクリプタリングに投入する (完了は待たない)
+     * @param required_block_addr DRAM上の必要なブロックの先頭アドレス
+     * @param allow_tree_writeback falseなら、追い出しにツリーノードの書き戻し(祖先の更新)が必要な場合に何もせず0を返す
+     * @param load_slots ロードを投入したらそのスロットのビットを立てる
+     * @param sg_count NULLでなければ、転送をリングに投入せずスキャッター・ギャザーのリストに追加する (load_slotsは使わない)
+     * @return ブロックを格納するSPM上のオフセット
+*/
+static inline uint64_t requestBlockInSpm(uint64_t required_block_addr, bool allow_tree_writeback, uint64_t* load_slots, uint64_t* sg_count){
+  uint64_t hit = lookupBlockInSpm(required_block_addr);
+  if (hit) {
+    SPM_PERF_LOOKUP(required_block_addr, true);
+    return hit;
+  }
+  uint64_t set = (required_block_addr / 64) % SPM_CACHE_SETS;
+  uint64_t infos[SPM_CACHE_WAYS];
+  for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) infos[w] = spm_ld64(SPM_MANAGE_OFF(SPM_CACHE_LINE(set, w)));
+  uint64_t way = spm_cache_select_victim(set, infos);
+  uint64_t spm_offset = SPM_LINE_OFF(SPM_CACHE_LINE(set, way));
+  uint64_t info = infos[way];
+  bool valid = info & SPM_MANAGE_VALID;
+  bool dirty = info & SPM_MANAGE_DIRTY;
+  if (valid && dirty && !allow_tree_writeback && spm_evict_updates_tree((info >> 6) << 6)) return 0;
+  SPM_PERF_LOOKUP(required_block_addr, false);
+  // Dirtyビットが立っていれば、追い出すブロックをDRAMに書き戻す
+  if (valid && dirty) {
+    perf_event(PERF_SPM_WRITEBACKS);
+    if (sg_count) spm_sg_add(sg_count, (info >> 6) << 6, spm_offset, 1);
+    else spm_evict_dirty_block(spm_offset, (info >> 6) << 6);
+    /* 祖先の更新で同じセットの管理ワード(Dirtyビット)が変わっている可能性があるので読み直す */
+    for (uint64_t w = 0; w < SPM_CACHE_WAYS; ++w) infos[w] = spm_ld64(SPM_MANAGE_OFF(SPM_CACHE_LINE(set, w)));
+    info = infos[way];
+  }
+  // 新しいブロックをDRAMからSPMに読み込む (優先して転送する)
+  if (sg_count) spm_sg_add(sg_count, required_block_addr, spm_offset, 0);
+  else *load_slots |= 1ULL << spm_ring_post(required_block_addr, spm_offset, 64, 0, true);
+  // 管理情報を更新 (Valid=1, Dirty=0, 未検証)
+  infos[way] = ((required_block_addr >> 6) << 6) | SPM_MANAGE_VALID;
+  spm_cache_update(set, infos, way, valid ? spm_repl_state(info) : SPM_CACHE_WAYS, false);
+  spm_request_lines |= 1ULL << SPM_CACHE_LINE(set, way);
+  return spm_offset;
 }
 /**
      * @brief 指定されたブロックがSPMに存在することを確認し、なければロードする
      * @param required_block_addr DRAM上の必要なブロックの先頭アドレス
-     * @param spm_block_addr SPM上の格納先アドレス
-     * @param spm_management_addr SPM上の管理情報のアドレス
+     * @return ブロックを格納しているSPM上のオフセット
 */
-static inline void ensureBlockInSpm(uint64_t required_block_addr, uint64_t spm_offset, uint64_t manage_addr){
-  uint64_t info = spm_ld64(manage_addr);
-  bool valid = info & 1;
-  bool dirty = info & 2;
-  uint64_t current_block_addr = (info >> 6) << 6;
-  if (!valid || current_block_addr != required_block_addr) {
-      // Dirtyビットが立っていれば、現在のブロックをDRAMに書き戻す
-      if (valid && dirty) {
-        spm_write_back(spm_offset, current_block_addr, 64);
-      }
-      // 新しいブロックをDRAMからSPMに読み込む
-      spm_copy_to_local(required_block_addr, spm_offset, 64);
-      // 管理情報を更新 (Valid=1, Dirty=0)
-      clearBlockdirty(manage_addr, required_block_addr);
-  } 
-}
\ No newline at end of file
+static inline uint64_t ensureBlockInSpm(uint64_t required_block_addr){
+  uint64_t load_slots = 0;
+  uint64_t spm_offset = requestBlockInSpm(required_block_addr, true, &load_slots, NULL);
+  spm_ring_wait(load_slots);
+  return spm_offset;
+}
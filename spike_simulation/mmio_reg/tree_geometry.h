@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+
+/* --- カウンターツリーの形状 (include/tree_geometry.hpp と同じ導出) ---
+ * 分岐数・保護領域サイズ・カウンターのビット幅から、ツリーの高さ・各階層のノード数・配置を導出する。
+ * ノード(64B): | メジャーカウンター(64bit) | マイナーカウンター(TREE_MINOR_BITS x TREE_ARITY) | 未使用 | MAC(64bit) |
+ * 分岐数と保護領域サイズは2の冪のみ対応するため、log2で指定する。
+ * 例: 64分木なら TREE_ARITY_LOG2=6, TREE_MINOR_BITS=6 / 128分木なら TREE_ARITY_LOG2=7, TREE_MINOR_BITS=3 */
+#ifndef TREE_ARITY_LOG2
+#define TREE_ARITY_LOG2 5 /* 32分木 */
+#endif
+#ifndef PROTECTION_SIZE_LOG2
+#define PROTECTION_SIZE_LOG2 26 /* 64MB */
+#endif
+#ifndef TREE_MAJOR_BITS
+#define TREE_MAJOR_BITS 64
+#endif
+#ifndef TREE_MINOR_BITS
+#define TREE_MINOR_BITS 8
+#endif
+
+#define TREE_ARITY       (1ULL << TREE_ARITY_LOG2)
+#define PROTECTION_SIZE  (1ULL << PROTECTION_SIZE_LOG2)
+#define DATA_TAG_SIZE    (PROTECTION_SIZE / 8) /* データタグ(MAC)は8B/データライン */
+#define TREE_LINES_LOG2  (PROTECTION_SIZE_LOG2 - 6)
+/* 最上位ノード1つで全データラインを覆える最小の高さ */
+#define TREE_HEIGHT      ((TREE_LINES_LOG2 + TREE_ARITY_LOG2 - 1) / TREE_ARITY_LOG2)
+/* 階層i(0: 最上位)のエントリ1つが覆うデータライン数のlog2。(addr / 64) >> これ が階層iのパスインデックス */
+#define TREE_ENTRY_SPAN_LOG2(i) (TREE_ARITY_LOG2 * (TREE_HEIGHT - 1 - (i)))
+/* 階層iのノード数 */
+#define TREE_LEVEL_NODES(i) \
+  (1ULL << (TREE_LINES_LOG2 > TREE_ARITY_LOG2 * (TREE_HEIGHT - (i)) ? TREE_LINES_LOG2 - TREE_ARITY_LOG2 * (TREE_HEIGHT - (i)) : 0))
+/* 上位levels階層のノード数の合計。階層1は1ノードで、階層2以降は1階層ごとにTREE_ARITY倍になる (等比数列の和) */
+#define TREE_TOP_NODES(levels) \
+  ((levels) <= 1 ? (uint64_t)(levels) : 1 + (TREE_LEVEL_NODES((levels) - 1) * TREE_ARITY - TREE_LEVEL_NODES(1)) / (TREE_ARITY - 1))
+
+#define TREE_MINOR_BASE_BIT 64
+#define TREE_MINOR_BIT(entry) (TREE_MINOR_BASE_BIT + ((entry) % TREE_ARITY) * TREE_MINOR_BITS)
+#define TREE_MINOR_MAX   ((1ULL << TREE_MINOR_BITS) - 1)
+#define TREE_MAJOR_MASK  (TREE_MAJOR_BITS == 64 ? ~0ULL : (1ULL << (TREE_MAJOR_BITS % 64)) - 1)
+
+_Static_assert(TREE_ARITY_LOG2 >= 3 && TREE_ARITY_LOG2 <= 7, "tree arity must be a power of two in [8, 128]");
+_Static_assert(PROTECTION_SIZE_LOG2 >= 26 && PROTECTION_SIZE_LOG2 <= 34, "protected size must be a power of two in [64MB, 16GB]");
+_Static_assert(TREE_MAJOR_BITS >= 1 && TREE_MAJOR_BITS <= 64, "major counter must fit in the first word of a node");
+_Static_assert(TREE_MINOR_BITS >= 1 && TREE_MINOR_BITS <= 32, "minor counter width must be in [1, 32]");
+_Static_assert(TREE_MINOR_BASE_BIT + TREE_ARITY * TREE_MINOR_BITS <= 448, "minor counters do not fit in a 64B node next to the MAC");
+
+/* カウンター領域の先頭から階層iの先頭ノードまでのオフセット (リーフが先頭) */
+static inline uint64_t tree_level_base(uint64_t i){
+  uint64_t base = 0;
+  for (uint64_t j = i + 1; j < TREE_HEIGHT; ++j) base += TREE_LEVEL_NODES(j) * 64;
+  return base;
+}
@@ -1,19 +1,23 @@
 #include <stdint.h>
+#include <stdbool.h>
+/* SPMキャッシュの参照をブロックの種類ごとに性能カウンターへ通知する (定義は後方) */
+static void perfCountSpmLookup(uint64_t block_addr, bool is_hit);
+#define SPM_PERF_LOOKUP(block_addr, is_hit) perfCountSpmLookup(block_addr, is_hit)
 #include "mmio_reg/spm_reg.h"
 #include "mmio_reg/mac_reg.h"
 #include "mmio_reg/aes_reg.h"
 #include "mmio_reg/axim_reg.h"
 #include "mmio_reg/memreq_reg.h"
+#include "mmio_reg/perf_reg.h"
 #include "mmio_reg/reg_map.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+// 保護領域・データタグ・カウンターツリーのサイズはツリー形状(mmio_reg/tree_geometry.h)から導出する
 #define PROTECTION_BASE 0x90000000ULL
-#define PROTECTION_SIZE 0x04000000ULL // 64MB
-#define DATA_TAG_BASE  PROTECTION_BASE + PROTECTION_SIZE // 0x94000000
-#define DATA_TAG_SIZE 1024 * 1024 * 8 // 8MB
-#define COUNTER_BASE DATA_TAG_BASE + DATA_TAG_SIZE // 0x94800000
-#define HEIGHT 4
+#define DATA_TAG_BASE  (PROTECTION_BASE + PROTECTION_SIZE) // 0x94000000
+#define COUNTER_BASE (DATA_TAG_BASE + DATA_TAG_SIZE) // 0x94800000
+#define HEIGHT TREE_HEIGHT
 struct AddressContext {
     uint64_t request_addr;
     uint64_t counterblock_addr;
@@ -23,150 +27,413 @@ struct AddressContext {
     uint64_t spm_data;
     uint64_t spm_mac_block;
     uint64_t spm_counter_block;
-    uint64_t spm_counter_manage;
-    uint64_t spm_mac_manage;
 };
-static const uint64_t level_base_addr[HEIGHT] = {(1ULL << (5*3)) * 64 + (1ULL << (5 * 2)) * 64 + (1ULL << (5 * 1)) * 64, (1ULL << (5*3)) * 64 + (1ULL << (5 * 2)) * 64, (1ULL << (5*3)) * 64, 0};
+static uint64_t level_base_addr[HEIGHT]; // 各階層の先頭ノードのオフセット (initTreeGeometryで設定)
+
+static void initTreeGeometry(void){
+  for (uint64_t i = 0; i < HEIGHT; ++i) level_base_addr[i] = tree_level_base(i);
+  perf_set_layout(PROTECTION_BASE, DATA_TAG_BASE, COUNTER_BASE, COUNTER_BASE + level_base_addr[0] + TREE_LEVEL_NODES(0) * 64,
+                  HEIGHT, level_base_addr);
+}
+/* リクエストアドレスから各階層のパスインデックスを求める (先頭は階層1) */
+static void pathIndices(uint64_t request_addr, uint64_t* path_index){
+  for (uint64_t i = 0; i < HEIGHT; ++i){
+    path_index[i] = ((request_addr - PROTECTION_BASE) / 64) >> TREE_ENTRY_SPAN_LOG2(i);
+  }
+}
 
 struct AddressContext setupAddressContext() {
     struct AddressContext ctx;
     ctx.request_addr = AXIM_REQ_ADDR_REG;
     // DRAMアドレス
-    ctx.counterblock_addr = COUNTER_BASE + (((ctx.request_addr - PROTECTION_BASE) / (64 * 32))) * 64;
+    ctx.counterblock_addr = COUNTER_BASE + (((ctx.request_addr - PROTECTION_BASE) / (64 * TREE_ARITY))) * 64;
     ctx.datamacblock_addr = DATA_TAG_BASE + (((ctx.request_addr - PROTECTION_BASE) / (64 * 8))) * 64;
     // オフセット
-    ctx.counter_bit_offset = 64 + (ctx.request_addr / 64) % 32 * 8;
+    ctx.counter_bit_offset = TREE_MINOR_BIT(ctx.request_addr / 64);
     ctx.dmac_byte_offset = (ctx.request_addr / 64) % 8 * 8;
 
-    // SPMアドレス
-    ctx.spm_data = 0x040;
-    ctx.spm_mac_block = 0x080;
-    ctx.spm_counter_block = 0x0C0;
-    ctx.spm_mac_manage = 56 * 64 + 1*8;
-    ctx.spm_counter_manage = 56 * 64 + 3*8;
+    // SPMアドレス (カウンター・MACブロックはキャッシュ上の位置が決まった時点で設定する)
+    ctx.spm_data = SPM_LINE_OFF(SPM_DATA_LINE);
+    ctx.spm_mac_block = 0;
+    ctx.spm_counter_block = 0;
     return ctx;
 }
+static inline uint64_t treeNodeAddr(uint64_t i, uint64_t path_index){
+  return COUNTER_BASE + path_index / TREE_ARITY * 64 + level_base_addr[i];
+}
+/* 常駐階層iでpath_indexを含むノードを格納するSPMオフセット */
+static inline uint64_t pinnedNodeAddr(uint64_t i, uint64_t path_index){
+  return SPM_LINE_OFF(SPM_PINNED_FIRST_LINE + SPM_PINNED_LINE_COUNT(i) + path_index / TREE_ARITY);
+}
+/* ツリーノードのMACを計算する: ノード本体(448bit) + 親ノード中の対応するマイナーカウンター(最上位はルート) */
+static uint64_t computeNodeMac(uint64_t spm_addr, uint64_t level, uint64_t parent_spm_addr, uint64_t parent_entry){
+  mac_init();
+  mac_buffer_set(spm_addr);
+  mac_update(0, 447); // 448bit = 56B
+  mac_buffer_set(parent_spm_addr);
+  if (level == 0){
+    mac_update(0, 63);
+  } else {
+    uint64_t start_bit = TREE_MINOR_BIT(parent_entry);
+    mac_update(start_bit, start_bit + TREE_MINOR_BITS - 1);
+  }
+  return mac_final();
+}
+/* SPM上のノードの指定ビット位置からwidthビットを読み出す (64bit境界をまたいでもよい) */
+static uint64_t readNodeBits(uint64_t spm_addr, uint64_t bit, uint64_t width){
+  uint64_t word_addr = spm_addr + bit / 64 * 8;
+  uint64_t shift = bit % 64;
+  uint64_t value = spm_ld64(word_addr) >> shift;
+  if (shift + width > 64) value |= spm_ld64(word_addr + 8) << (64 - shift);
+  return value & ((1ULL << width) - 1);
+}
+/* SPM上のノードの指定ビット位置にwidthビットを書き込む (他のビットは保持する) */
+static void writeNodeBits(uint64_t spm_addr, uint64_t bit, uint64_t width, uint64_t value){
+  uint64_t word_addr = spm_addr + bit / 64 * 8;
+  uint64_t shift = bit % 64;
+  uint64_t mask = (1ULL << width) - 1;
+  spm_sd64(word_addr, (spm_ld64(word_addr) & ~(mask << shift)) | ((value & mask) << shift));
+  if (shift + width > 64){
+    spm_sd64(word_addr + 8, (spm_ld64(word_addr + 8) & ~(mask >> (64 - shift))) | ((value & mask) >> (64 - shift)));
+  }
+}
+/* ノード内のエントリに対応するマイナーカウンターを読み出す */
+static uint64_t readMinorCounter(uint64_t spm_addr, uint64_t entry){
+  return readNodeBits(spm_addr, TREE_MINOR_BIT(entry), TREE_MINOR_BITS);
+}
+/* データラインのMACを計算する: 暗号文(512bit) + カウンターブロック中の対応するマイナーカウンター */
+static uint64_t computeDataMac(uint64_t spm_data, uint64_t spm_counter_block, uint64_t bit_offset){
+  mac_init();
+  mac_buffer_set(spm_data);
+  mac_update(0, 511); // 512bit = 64B
+  mac_buffer_set(spm_counter_block);
+  mac_update(bit_offset, bit_offset + TREE_MINOR_BITS - 1);
+  return mac_final();
+}
+/* カウンターブロックが覆うデータラインを、繰り上げ後のメジャーカウンターで暗号化し直す。
+ * skip_line以外の書き込み済みのラインごとに、暗号文のMACを検証して旧カウンター(メジャー, マイナー)のOTPで復号し、
+ * 新カウンター(メジャー+1, 0)のOTPで暗号化する。マイナーカウンターを0にしてMACを更新し、DRAMに書き戻す。
+ * 書き込みリクエストの処理中に呼ばれるため、Read Bufferと暗号文用のSPMラインを作業領域に使う */
+static void reencryptCounterBlock(uint64_t spm_counter_block, uint64_t skip_line){
+  uint64_t old_major = spm_ld64(spm_counter_block);
+  uint64_t new_major = (old_major + 1) & TREE_MAJOR_MASK;
+  uint64_t spm_data = SPM_LINE_OFF(SPM_DATA_LINE);
+  uint64_t first_line = skip_line / TREE_ARITY * TREE_ARITY;
+  for (uint64_t line = first_line; line < first_line + TREE_ARITY; ++line){
+    uint64_t minor = readMinorCounter(spm_counter_block, line);
+    if (line == skip_line || (old_major == 0 && minor == 0)) continue; // 一度も書き込まれていないライン
+    uint64_t addr = PROTECTION_BASE + line * 64;
+    uint64_t bit_offset = TREE_MINOR_BIT(line);
+    uint64_t tag_offset = line % 8 * 8;
+    // データタグのブロックはこのラインの処理中のみ使用中とする
+    uint64_t saved_request_lines = spm_request_lines;
+    // 前回の繰り上げ以降に書き込まれていないライン (タグが0) は暗号文が無いので飛ばす
+    uint64_t spm_tag_block = ensureBlockInSpm(DATA_TAG_BASE + line / 8 * 64);
+    uint64_t expected_mac = spm_ld64(spm_tag_block + tag_offset);
+    if (minor == 0 && expected_mac == 0){
+      spm_request_lines = saved_request_lines;
+      continue;
+    }
+    // 暗号文を読み込み、旧カウンターでMACを検証
+    spm_copy_to_local(addr, spm_data, 64);
+    if (computeDataMac(spm_data, spm_counter_block, bit_offset) != expected_mac){
+      printf("[Core FW] MAC verification failed while re-encrypting 0x%llx. Aborting.\n", addr);
+      exit(1);
+    }
+    // 旧カウンターのOTPで復号し (Read Buffer上に平文)、新カウンターのOTPで暗号化してSPMに書き戻す
+    set_seed(old_major, minor, addr);
+    axim_copy(spm_data);
+    axim_decrypt();
+    set_seed(new_major, 0, addr);
+    axim_decrypt_to_spm(spm_data);
+    while(AXIM_BUSY_REG); // busy待ち
+    // マイナーカウンターを0にしてMACを更新
+    writeNodeBits(spm_counter_block, bit_offset, TREE_MINOR_BITS, 0);
+    spm_sd64(spm_tag_block + tag_offset, computeDataMac(spm_data, spm_counter_block, bit_offset));
+    setBlockdirty(spm_manage_of(spm_tag_block));
+    spm_write_back(spm_data, addr, 64);
+    spm_request_lines = saved_request_lines;
+  }
+}
+/* ノード内のエントリに対応するマイナーカウンターをインクリメントする (オーバーフロー時はメジャーカウンターを繰り上げる)
+ * カウンターブロック(リーフ)ではメジャーカウンターが全データラインのOTPに使われるため、他のラインを再暗号化する
+ * counter_block: spm_addrがカウンターブロックか (entryはデータラインの番号) */
+static uint64_t incrementMinorCounter(uint64_t spm_addr, uint64_t entry, bool counter_block){
+  uint64_t minor_counter_value = readMinorCounter(spm_addr, entry);
+  uint64_t new_minor_counter = 0;
+  if (minor_counter_value == TREE_MINOR_MAX){
+    if (counter_block) reencryptCounterBlock(spm_addr, entry);
+    spm_sd64(spm_addr, (spm_ld64(spm_addr) + 1) & TREE_MAJOR_MASK);
+    new_minor_counter = 0; // minor counterは0に戻す
+  } else {
+    new_minor_counter = minor_counter_value + 1;
+  }
+  writeNodeBits(spm_addr, TREE_MINOR_BIT(entry), TREE_MINOR_BITS, new_minor_counter);
+  return new_minor_counter;
+}
+static bool isZeroBlock(uint64_t spm_addr){
+  for (uint64_t off = 0; off < 64; off += 8){
+    if (spm_ld64(spm_addr + off) != 0) return false;
+  }
+  return true;
+}
+/* 一度も書き戻されていないツリーノードか (全て0で、親のカウンターも0。levelが0ならparent_spm_addrはルート)
+ * マイナーカウンターはオーバーフローでも0に戻るため、親のメジャーカウンターも0であることを確かめる。
+ * この判定は親の最初の繰り上げまでしか成り立たない (繰り上げ時にinitUnwrittenChildrenで子をDRAMに用意する) */
+static bool isNeverWrittenNode(uint64_t spm_addr, uint64_t level, uint64_t parent_spm_addr, uint64_t parent_entry){
+  if (spm_ld64(parent_spm_addr) != 0) return false; // ルート、または親のメジャーカウンター
+  if (level > 0 && readMinorCounter(parent_spm_addr, parent_entry) != 0) return false;
+  return isZeroBlock(spm_addr);
+}
+/* このインクリメントでメジャーカウンターが初めて繰り上がるか */
+static bool isFirstCarry(uint64_t spm_addr, uint64_t entry){
+  return spm_ld64(spm_addr) == 0 && readMinorCounter(spm_addr, entry) == TREE_MINOR_MAX;
+}
+/* ツリーノードのメジャーカウンターが初めて繰り上がった後に、一度も書き戻されていない子ノードをDRAMに用意する。
+ * 繰り上げ後は子を未書き込みと判定できなくなるため、マイナーカウンターが0の子(skip_entry以外、常駐しない階層のみ)の
+ * DRAMに、全て0のノードとそのMACを書き込む。scratchは作業に使うSPMライン (内容は壊れる) */
+static void initUnwrittenChildren(uint64_t spm_addr, uint64_t level, uint64_t skip_entry, uint64_t scratch){
+  if (level + 1 < SPM_PINNED_LEVELS) return; // 常駐階層はオンチップのノードが正
+  uint64_t first_entry = skip_entry / TREE_ARITY * TREE_ARITY;
+  uint64_t last_entry = first_entry + TREE_ARITY;
+  if (last_entry > TREE_LEVEL_NODES(level + 1)) last_entry = TREE_LEVEL_NODES(level + 1);
+  for (uint64_t off = 0; off < 64; off += 8) spm_sd64(scratch + off, 0);
+  for (uint64_t entry = first_entry; entry < last_entry; ++entry){
+    if (entry == skip_entry || readMinorCounter(spm_addr, entry) != 0) continue;
+    spm_sd64(scratch + 56, computeNodeMac(scratch, level + 1, spm_addr, entry)); // 56BにMACがある
+    uint64_t dram_addr = treeNodeAddr(level + 1, entry * TREE_ARITY);
+    spm_write_back(scratch, dram_addr, 64);
+    // SPMキャッシュ上の未書き込みのコピーにもMACを入れておく
+    uint64_t cached_addr = peekBlockInSpm(dram_addr);
+    if (cached_addr != 0 && isZeroBlock(cached_addr)) spm_sd64(cached_addr + 56, spm_ld64(scratch + 56));
+  }
+}
+/* 起動時処理: ツリーの上位階層をSPMの専用ラインにロード・検証して常駐させる */
+void bootPinTree(void){
+  for (uint64_t i = 0; i < SPM_PINNED_LEVELS; ++i){
+    for (uint64_t node = 0; node < TREE_LEVEL_NODES(i); ++node){
+      uint64_t dram_addr = treeNodeAddr(i, node * TREE_ARITY);
+      uint64_t spm_addr = pinnedNodeAddr(i, node * TREE_ARITY);
+      spm_copy_to_local(dram_addr, spm_addr, 64);
+      // 一度も書き込まれていないノードは検証しない (カウンターが0のリクエストと同じ扱い)
+      uint64_t parent_spm_addr = i == 0 ? SPM_LINE_OFF(SPM_ROOT_LINE) : pinnedNodeAddr(i - 1, node);
+      if (!isNeverWrittenNode(spm_addr, i, parent_spm_addr, node)){
+        if (computeNodeMac(spm_addr, i, parent_spm_addr, node) != spm_ld64(spm_addr + 56)){
+          printf("[Core FW] Boot: verification of pinned level %llu node %llu failed. Aborting.\n", i + 1, node);
+          exit(1);
+        }
+      }
+      spm_sd64(spm_manage_of(spm_addr), dram_addr | SPM_MANAGE_VALID | SPM_MANAGE_VERIFIED);
+    }
+  }
+}
 
-bool verifyTreePath(const uint64_t* path_indecis){
-  for(uint64_t i=0; i<HEIGHT; ++i){
-    uint64_t spm_addr = (6-i) * 64;
-    uint64_t manage_addr = 56 * 64 + (6 - i) * 8;
-    uint64_t dram_addr = COUNTER_BASE + path_indecis[i] / 32 * 64 + level_base_addr[i];
-    ensureBlockInSpm(dram_addr, spm_addr, manage_addr);
-    // MAC計算
-    mac_init();
-    mac_buffer_set(spm_addr);
-    mac_update(0,447);
+/* リーフ側から辿り、SPM上で検証済みの最初の祖先より下の階層のみを検証する
+ * 一度も書き戻されていないノード(isNeverWrittenNode)はMACを持たないので、検証せずに正当とする
+ * full_pathなら打ち切らず、常駐階層の直下からリーフまでの全ノードを検証済みにする (即時更新はパス上の全ノードのMACを再計算する) */
+bool verifyTreePath(const uint64_t* path_indecis, bool full_path){
+  // 常駐階層は起動時に検証済みなので、その直下から探せばよい
+  uint64_t first_level = SPM_PINNED_LEVELS;
+  uint64_t parent_spm_addr = first_level > 0 ? pinnedNodeAddr(first_level - 1, path_indecis[first_level - 1])
+                                             : SPM_LINE_OFF(SPM_ROOT_LINE);
+  for(uint64_t i=HEIGHT; !full_path && i-- > SPM_PINNED_LEVELS;){
+    uint64_t spm_addr = lookupBlockInSpm(treeNodeAddr(i, path_indecis[i]));
+    if (spm_addr != 0 && isBlockVerified(spm_manage_of(spm_addr))){
+      first_level = i + 1;
+      parent_spm_addr = spm_addr;
+      break;
+    }
+  }
+  // 検証する階層のノードをまとめてロードしておく。ロードと追い出す書き戻しは1つのスキャッター・ギャザーのコマンドで転送する。
+  // 遅延更新で追い出しにツリーノードの書き戻しが必要になったら、祖先(未検証のこのパス上のノードの場合がある)を
+  // 更新するため、そこで打ち切り、以降の階層は検証しながら1つずつロードする (リストが満杯になった場合も同様)
+  uint64_t spm_addrs[HEIGHT];
+  uint64_t prefetched = first_level;
+  uint64_t sg_count = 0;
+  for(; prefetched<HEIGHT; ++prefetched){
+    if (sg_count + 2 > SPM_DMA_SG_ENTRIES) break; // 書き戻しとロードの2エントリが入らない
+    spm_addrs[prefetched] = requestBlockInSpm(treeNodeAddr(prefetched, path_indecis[prefetched]), false, NULL, &sg_count);
+    if (spm_addrs[prefetched] == 0) break;
+  }
+  spm_sg_run(sg_count);
+  for(uint64_t i=first_level; i<HEIGHT; ++i){
+    uint64_t spm_addr = i < prefetched ? spm_addrs[i] : ensureBlockInSpm(treeNodeAddr(i, path_indecis[i]));
+    uint64_t manage_addr = spm_manage_of(spm_addr);
+    // 全体を検証する場合、検証済みのノードは親として使うだけでよい
+    if (isBlockVerified(manage_addr)){
+      parent_spm_addr = spm_addr;
+      continue;
+    }
+    if (!isNeverWrittenNode(spm_addr, i, parent_spm_addr, i == 0 ? 0 : path_indecis[i-1])){
+      // MAC計算
+      uint64_t computed_mac = computeNodeMac(spm_addr, i, parent_spm_addr, i == 0 ? 0 : path_indecis[i-1]);
+      uint64_t stored_mac = spm_ld64(spm_addr + 56);
+      if (computed_mac != stored_mac){
+        printf("Level %llu: computed_mac=%016llx, stored_mac=%016llx\n", i, computed_mac, stored_mac);
+        return false;
+      }
+    }
+    setBlockVerified(manage_addr);
+    parent_spm_addr = spm_addr;
+  }
+  return true;
+}
+
+static inline bool isTreeNodeAddr(uint64_t addr){
+  return addr >= COUNTER_BASE && addr < COUNTER_BASE + level_base_addr[0] + 64;
+}
+/* ツリーノードのDRAMアドレスから階層(0: 最上位)を求める */
+static uint64_t treeLevelOf(uint64_t addr){
+  uint64_t offset = addr - COUNTER_BASE;
+  uint64_t i = 0;
+  while (offset < level_base_addr[i]) ++i;
+  return i;
+}
+/* SPMキャッシュの参照をブロックの種類(データタグ・カウンター・ツリーの階層)ごとに数える */
+static void perfCountSpmLookup(uint64_t block_addr, bool is_hit){
+  if (!isTreeNodeAddr(block_addr)) {
+    perf_event(is_hit ? PERF_SPM_HIT_TAG : PERF_SPM_MISS_TAG);
+  } else if (treeLevelOf(block_addr) == HEIGHT - 1) {
+    perf_event(is_hit ? PERF_SPM_HIT_COUNTER : PERF_SPM_MISS_COUNTER);
+  } else {
+    perf_event(is_hit ? PERF_SPM_HIT_TREE(treeLevelOf(block_addr)) : PERF_SPM_MISS_TREE(treeLevelOf(block_addr)));
+  }
+}
+
+#if SPM_TREE_UPDATE == SPM_TREE_LAZY
+/* 遅延更新の書き戻し時に階層iのノードを一時的に置くSPMオフセット */
+static inline uint64_t stagingNodeAddr(uint64_t i){
+  return SPM_LINE_OFF(SPM_STAGING_FIRST_LINE + i - SPM_PINNED_LEVELS);
+}
+/* 追い出すDirtyなツリーノードを書き戻す。
+ * 親のカウンターをインクリメントしてからMACを再計算する。SPMキャッシュに無い祖先はステージングラインに
+ * 読み込んで検証し、同様に更新して書き戻す。キャッシュ上の祖先・常駐階層・ルートに到達したらそれを更新して終わる */
+static void writeBackTreeNode(uint64_t spm_addr, uint64_t dram_addr){
+  uint64_t level = treeLevelOf(dram_addr);
+  // ルートまでのパス (verifyTreePathと同じ形式。ノード内のエントリ番号は任意でよい)
+  uint64_t path[HEIGHT] = {0};
+  path[level] = (dram_addr - COUNTER_BASE - level_base_addr[level]) / 64 * TREE_ARITY;
+  for (uint64_t i = level; i-- > 0;) path[i] = path[i + 1] / TREE_ARITY;
+  // SPMキャッシュ上にある最も近い祖先を探す。無ければ常駐階層の最下位、またはルートまで辿る
+  uint64_t first_staged = level;
+  uint64_t anchor_spm_addr = 0;
+  while (first_staged > SPM_PINNED_LEVELS){
+    anchor_spm_addr = peekBlockInSpm(treeNodeAddr(first_staged - 1, path[first_staged - 1]));
+    if (anchor_spm_addr != 0) break;
+    --first_staged;
+  }
+  if (anchor_spm_addr == 0){
+    anchor_spm_addr = first_staged == 0 ? SPM_LINE_OFF(SPM_ROOT_LINE) : pinnedNodeAddr(first_staged - 1, path[first_staged - 1]);
+  }
+  // SPMに無い祖先をステージングラインに読み込み、上から順に検証する
+  uint64_t parent_spm_addr = anchor_spm_addr;
+  for (uint64_t i = first_staged; i < level; ++i){
+    uint64_t staged_addr = stagingNodeAddr(i);
+    spm_copy_to_local(treeNodeAddr(i, path[i]), staged_addr, 64);
+    // 一度も書き戻されていないノードはMACを持たない
+    bool never_written = isNeverWrittenNode(staged_addr, i, parent_spm_addr, i == 0 ? 0 : path[i - 1]);
+    if (!never_written && computeNodeMac(staged_addr, i, parent_spm_addr, i == 0 ? 0 : path[i - 1]) != spm_ld64(staged_addr + 56)){
+      printf("[Core FW] Verification failed at level %llu during write-back. Aborting.\n", i + 1);
+      exit(1);
+    }
+    parent_spm_addr = staged_addr;
+  }
+  // 下の階層から順に、親のカウンターをインクリメントしてMACを再計算し、DRAMに書き戻す
+  uint64_t node_spm_addr = spm_addr;
+  uint64_t first_carries = 0; // bit i: 階層iの親のメジャーカウンターが初めて繰り上がった
+  for (uint64_t i = level;; --i){
+    parent_spm_addr = i == first_staged ? anchor_spm_addr : stagingNodeAddr(i - 1);
     if (i == 0){
-      mac_buffer_set(0);
-      mac_update(0,63);
+      spm_sd64(parent_spm_addr, spm_ld64(parent_spm_addr) + 1); // root update
     } else {
-      mac_buffer_set(spm_addr + 64);
-      uint64_t start_bit = 64 + (path_indecis[i-1] % 32) * 8;
-      mac_update(start_bit, start_bit + 7);
+      if (isFirstCarry(parent_spm_addr, path[i - 1])) first_carries |= 1ULL << i;
+      incrementMinorCounter(parent_spm_addr, path[i - 1], false);
     }
-    uint64_t computed_mac = mac_final();
-    uint64_t stored_mac = spm_ld64(spm_addr + 56);
-    if (computed_mac != stored_mac){
-      printf("Level %llu: computed_mac=%016llx, stored_mac=%016llx\n", i, computed_mac, stored_mac);
-      return false;
+    spm_sd64(node_spm_addr + 56, computeNodeMac(node_spm_addr, i, parent_spm_addr, i == 0 ? 0 : path[i - 1]));
+    spm_write_back(node_spm_addr, treeNodeAddr(i, path[i]), 64);
+    if (i == first_staged) break;
+    node_spm_addr = parent_spm_addr;
+  }
+  // 繰り上がった親の未書き込みの子を用意する (書き戻しの済んだ追い出すラインを作業領域に使う)
+  for (uint64_t i = first_staged; i <= level; ++i){
+    if ((first_carries >> i) & 1){
+      initUnwrittenChildren(i == first_staged ? anchor_spm_addr : stagingNodeAddr(i - 1), i - 1, path[i - 1], spm_addr);
     }
   }
-  return true;
+  // カウンターを更新した祖先はDirtyになる (ルートは常にオンチップ)
+  if (first_staged > 0) setBlockdirty(spm_manage_of(anchor_spm_addr));
 }
+void spm_evict_dirty_block(uint64_t spm_offset, uint64_t block_addr){
+  if (isTreeNodeAddr(block_addr)){
+    writeBackTreeNode(spm_offset, block_addr);
+  } else {
+    spm_ring_post(block_addr, spm_offset, 64, 1, false); // 完了は待たない
+  }
+}
+bool spm_evict_updates_tree(uint64_t block_addr){
+  return isTreeNodeAddr(block_addr);
+}
+#endif
 
 void Authentication(){
    struct AddressContext ctx = setupAddressContext();
+   spm_cache_begin_request();
    uint64_t path_indecis[HEIGHT];
-    for(uint64_t i=0; i<HEIGHT; ++i){
-      path_indecis[3-i] = (ctx.request_addr - 0x90000000ULL) / (64 * (1ULL << (5 * i)));
-    }
+    pathIndices(ctx.request_addr, path_indecis);
     // printf("[Core FW] --- Starting Authentication ---\n");
     // printf("path: %llu, %llu, %llu, %llu\n", path_indecis[0], path_indecis[1], path_indecis[2], path_indecis[3]);
     {
-      ensureBlockInSpm(ctx.counterblock_addr, ctx.spm_counter_block, ctx.spm_counter_manage);
-      uint64_t major_counter = spm_ld64(ctx.spm_counter_block);
-      uint64_t minor_counter_byte_address = ctx.spm_counter_block + (ctx.counter_bit_offset / 64) * 8;
-      uint64_t minor_counter = spm_ld64(minor_counter_byte_address);
-      // ここから過去のminor counterを取り出す
-      uint8_t minor_counter_value = (minor_counter >> ((ctx.counter_bit_offset % 64) )) & 0xFF;
-      if (minor_counter_value != 0 || major_counter != 0){
-          // メジャーマイナー、どちらかが0でなければ検証を行う
-          // 1. パスの特定=親ノードの物理アドレスをルートまで計算していく。
-          bool verified = verifyTreePath(path_indecis);
-          if (verified == false){
-              printf("[Core FW] Authentication failed during counter verification. Aborting.\n");
-              exit(1);
-          }
+      // カウンターブロックはこのリクエスト中は使用中として扱われ、追い出されない
+      ctx.spm_counter_block = ensureBlockInSpm(ctx.counterblock_addr);
+      // 自分のカウンターが0でも、同じブロックの他のカウンターを改ざんされていないか検証する
+      // (一度も書き込まれていないブロックはverifyTreePathで正当と判定する)
+      // 即時更新ではパス上の全ノードのMACを再計算するため、全ノードを検証しておく
+      bool verified = verifyTreePath(path_indecis, SPM_TREE_UPDATE == SPM_TREE_EAGER);
+      if (verified == false){
+          printf("[Core FW] Authentication failed during counter verification. Aborting.\n");
+          exit(1);
       }
     }
-    uint64_t root = spm_ld64(0);
+#if SPM_TREE_UPDATE == SPM_TREE_LAZY
+    // リーフ(カウンターブロック)のカウンターのみ更新する。祖先はDirtyなノードの追い出し時に更新する
+    incrementMinorCounter(ctx.spm_counter_block, path_indecis[HEIGHT - 1], true);
+    // 検証済みのブロックを更新したので、MACは書き戻し時に再計算する
+    setBlockdirty(spm_manage_of(ctx.spm_counter_block));
+#else
+    uint64_t spm_root_addr = SPM_LINE_OFF(SPM_ROOT_LINE);
+    uint64_t root = spm_ld64(spm_root_addr);
     uint64_t new_root = root + 1;
-    spm_sd64(0, new_root);
+    spm_sd64(spm_root_addr, new_root);
+    uint64_t parent_spm_addr = spm_root_addr;
     for (uint64_t i=0;i<HEIGHT;i++){
-            uint64_t spm_addr = (6-i) * 64;
-            uint64_t spm_manage = 56 * 64 + (6-i) * 8;
-            uint64_t dram_addr = COUNTER_BASE + path_indecis[i] / 32 * 64;
-            dram_addr += level_base_addr[i];
-            ensureBlockInSpm(dram_addr, spm_addr, spm_manage);
+            uint64_t dram_addr = treeNodeAddr(i, path_indecis[i]);
+            uint64_t spm_addr = i < SPM_PINNED_LEVELS ? pinnedNodeAddr(i, path_indecis[i]) : ensureBlockInSpm(dram_addr);
+            uint64_t spm_manage = spm_manage_of(spm_addr);
             // height += 1;
-            // ここから過去のmajor, minor counterを取り出す
-            uint64_t major_counter = spm_ld64(spm_addr);
-            uint64_t minor_counter_byte_address = spm_addr + 8 + (path_indecis[i] % 32) / 8 * 8;
-            uint64_t minor_counter = spm_ld64(minor_counter_byte_address);
-            // ここから過去のminor counterを取り出す
-            uint8_t minor_counter_value = (minor_counter >> ((path_indecis[i] % 8) * 8)) & 0xFF;
-            uint8_t new_minor_counter = 0;
-            if (minor_counter_value == 0xFF){
-                uint64_t new_major_counter = major_counter + 1;
-                spm_sd64(spm_addr, new_major_counter);
-                new_minor_counter = 0; // minor counterは0に戻す
-                // printf("Major counter overflow. Incremented major to %llu and reset minor to 0.\n", new_major_counter);
-                // exit(1); // 今回はエラーにする
-            } else {
-                new_minor_counter = minor_counter_value + 1;
-            }
-            uint64_t shift_amount = (path_indecis[i] % 8) * 8;
-            uint64_t clear_mask = ~(0xFFULL << shift_amount);
-            uint64_t cleared_minor_counter = minor_counter & clear_mask;
-            // --- 新しい値を正しい位置へシフトする ---
-            uint64_t shifted_new_value = (new_minor_counter);
-            shifted_new_value <<= shift_amount;
-            uint64_t final_word = cleared_minor_counter | shifted_new_value;
-            // カウンターをprint
-            // 書き戻し
-            spm_sd64(minor_counter_byte_address, final_word);
+            // カウンターをインクリメントしてSPMに書き戻す
+            bool first_carry = i + 1 < HEIGHT && isFirstCarry(spm_addr, path_indecis[i]);
+            incrementMinorCounter(spm_addr, path_indecis[i], i == HEIGHT - 1);
+            // 繰り上がったら未書き込みの子を用意する (暗号文用のラインは手順4まで空いている)
+            if (first_carry) initUnwrittenChildren(spm_addr, i, path_indecis[i], ctx.spm_data);
             // ブロックをdirtyに設定する
-            setBlockdirty(spm_manage, dram_addr);
-            // MAC計算を実行
-            // Hash関数を初期化してから当該ブロックをMAC
-            mac_init();
-            mac_buffer_set(spm_addr);
-            mac_update(0, 447); // 448bit = 56B
-            // 親ノードのヘッダーをMACの内部バッファにセット
-            if (i == 0){
-                // 最上位層はrootノードを使う
-                mac_buffer_set(0);
-                mac_update(0, 63);
-            } else {
-                uint64_t parent_offset = path_indecis[i-1] % 32 * 8;
-                mac_buffer_set(spm_addr+ 64);
-                uint64_t start_bit = 64 + parent_offset;
-                mac_update(start_bit, start_bit + 7);
+            setBlockdirty(spm_manage);
+            // 常駐階層はオンチップで信頼できるため、MACの再計算は不要
+            if (i < SPM_PINNED_LEVELS){
+                parent_spm_addr = spm_addr;
+                continue;
             }
-            // MAC計算完了
-            uint64_t mac_result = mac_final();
-            // printf("Level %llu: Updated Major=%llu, Minor=%u, New MAC=%016llx\n", i, major_counter, new_minor_counter, mac_result);
-            spm_sd64(spm_addr + 56, mac_result); // 56BにMACがある
+            // MAC計算を実行 (親ノードはこの時点で更新済み)
+            uint64_t mac_result = computeNodeMac(spm_addr, i, parent_spm_addr, i == 0 ? 0 : path_indecis[i-1]);
+            spm_sd64(spm_addr + 56, mac_result); // 56BにMACがある (ノードはverifyTreePathで検証済み)
+            parent_spm_addr = spm_addr;
         }
+#endif
     uint64_t major_counter = spm_ld64(ctx.spm_counter_block);
     // minor_counterのload
-    // bitオフセットを元にアドレスを8Bにアライメントして、minor counterを含む64ビットを読み出す.
-    uint64_t minor_counter_byte_address = ctx.spm_counter_block + (ctx.counter_bit_offset / 64) * 8;
-    uint64_t minor_counter = spm_ld64(minor_counter_byte_address);
-    uint8_t minor_counter_value = (minor_counter >> ((ctx.counter_bit_offset % 64))) & 0xFF;
+    // bitオフセットからminor counterを読み出す (64bit境界をまたいでもよい)
+    uint64_t minor_counter_value = readNodeBits(ctx.spm_counter_block, ctx.counter_bit_offset, TREE_MINOR_BITS);
     // --- 手順2: アドレスとカウンター値を元にSeed値を計算し、AES_moduleに書き込み起動する ---
-    printf("[Core FW] Major Counter: %llu, Minor Counter: %u, Request Address: 0x%llx\n", major_counter, minor_counter_value, ctx.request_addr);
+    printf("[Core FW] Major Counter: %llu, Minor Counter: %llu, Request Address: 0x%llx\n", major_counter, minor_counter_value, ctx.request_addr);
     set_seed(major_counter, minor_counter_value, ctx.request_addr);
     // --- 手順3: AXI ManagerにOTPとともにXORを実行し、暗号化を指示 ---
     // busy wait AESモジュールの計算完了を待つ
@@ -179,15 +446,15 @@ void Authentication(){
     mac_buffer_set(ctx.spm_data); 
     mac_update(0, 511); // 512bit = 64B
     mac_buffer_set(ctx.spm_counter_block);
-    mac_update(ctx.counter_bit_offset, ctx.counter_bit_offset + 7); // 8bit = 1B
+    mac_update(ctx.counter_bit_offset, ctx.counter_bit_offset + TREE_MINOR_BITS - 1);
     // MAC計算完了
     uint64_t computed_mac = mac_final();
     // --- 手順6: Hashモジュールの計算完了を待ち、結果をSPMに保存 ---
     // SPMに当該MACブロックがあればそのままmodify,なければ今あるブロックをDRAMにwrite backしてから適切なブロックをSPMにDRAMコピー
-    ensureBlockInSpm(ctx.datamacblock_addr, ctx.spm_mac_block, ctx.spm_mac_manage);
+    ctx.spm_mac_block = ensureBlockInSpm(ctx.datamacblock_addr);
     spm_sd64(ctx.spm_mac_block + ctx.dmac_byte_offset, computed_mac);
     // SPM上のMACブロックをDirtyに設定する
-    setBlockdirty(ctx.spm_mac_manage, ctx.datamacblock_addr);
+    setBlockdirty(spm_manage_of(ctx.spm_mac_block));
     // --- 手順7: SPM DMAを起動し、SPMからDRAMへ暗号文をwrite back ---
     spm_write_back(ctx.spm_data, ctx.request_addr, 64);
 
@@ -200,6 +467,7 @@ void Authentication(){
 void Verification(){
   // printf("[Core FW] --- Starting Verification ---\n");
   struct AddressContext ctx = setupAddressContext();
+  spm_cache_begin_request();
   // printf("[Core FW] Request Address: 0x%llx\n", ctx.request_addr);
   // --- 手順1: SPMからカウンターをload ---
   // 初めにspmにあるカウンターのアドレスを確認する
@@ -208,26 +476,23 @@ void Verification(){
   {
       // missの場合、カウンターブロックの検証が必要
       // 1. パスの特定=親ノードの物理アドレスをルートまで計算していく。
-      uint64_t path_index[4]; // 先頭は階層1
-      for(uint64_t i=0; i<HEIGHT; ++i){
-          path_index[3-i] = (ctx.request_addr - 0x90000000ULL) / (64 * (1ULL << (5 * i)));
-      }
-      bool verified = verifyTreePath(path_index);
+      uint64_t path_index[HEIGHT]; // 先頭は階層1
+      pathIndices(ctx.request_addr, path_index);
+      bool verified = verifyTreePath(path_index, false);
       if (verified == false){
           printf("[Core FW] Verification failed during counter verification. Aborting.\n");
           exit(1);
       }
   }
   // --- 手順1.2 : ツリーの検証は終了、カウンターのload ---
+  ctx.spm_counter_block = ensureBlockInSpm(ctx.counterblock_addr);
   uint64_t major_counter = spm_ld64(ctx.spm_counter_block);
   // minor_counterのload
-  // bitオフセットを元にアドレスを8Bにアライメントして、minor counterを含む64ビットを読み出す.
-  uint64_t minor_counter_byte_address = ctx.spm_counter_block + (ctx.counter_bit_offset / 64) * 8;
-  uint64_t minor_counter = spm_ld64(minor_counter_byte_address);
-  uint8_t minor_counter_value = (minor_counter >> ((ctx.counter_bit_offset % 64) )) & 0xFF;
+  // bitオフセットからminor counterを読み出す (64bit境界をまたいでもよい)
+  uint64_t minor_counter_value = readNodeBits(ctx.spm_counter_block, ctx.counter_bit_offset, TREE_MINOR_BITS);
   // --- 手順2: アドレスとカウンター値を元にSeed値を計算し、AES_moduleに書き込み起動する ---
   printf("[Core FW] Step 2: Setting AES seed and starting encryption...\n");
-  printf("[Core FW] Major Counter: %llu, Minor Counter: %u, Request Address: 0x%llx\n", major_counter, minor_counter_value, ctx.request_addr);
+  printf("[Core FW] Major Counter: %llu, Minor Counter: %llu, Request Address: 0x%llx\n", major_counter, minor_counter_value, ctx.request_addr);
   set_seed(major_counter, minor_counter_value, ctx.request_addr);
   // --- 手順3: SPM DMAを起動し、DRAMから暗号文をSPMにコピー ---
   spm_copy_to_local(ctx.request_addr, ctx.spm_data, 64);
@@ -244,13 +509,13 @@ void Verification(){
   mac_update(0, 511);
   // SPMからカウンターブロックをコピー
   mac_buffer_set(ctx.spm_counter_block);
-  mac_update(ctx.counter_bit_offset, ctx.counter_bit_offset + 7); // todo: correct end bit length
+  mac_update(ctx.counter_bit_offset, ctx.counter_bit_offset + TREE_MINOR_BITS - 1);
   // MAC計算完了
 
   // --- 手順6: Hashモジュールの計算完了を待ち、結果を取得しSPMから正しい結果をload ---
   uint64_t mac_result = mac_final();
   // SPMに当該MACブロックがあるかを確認。なければコピー。
-  ensureBlockInSpm(ctx.datamacblock_addr, ctx.spm_mac_block, ctx.spm_mac_manage);
+  ctx.spm_mac_block = ensureBlockInSpm(ctx.datamacblock_addr);
   uint64_t expected_mac = spm_ld64(ctx.spm_mac_block + ctx.dmac_byte_offset);
   if (mac_result != expected_mac) {
       printf("[Core FW] Verification failed: MAC mismatch! Computed: %016llx, Expected: %016llx\n", mac_result, expected_mac);
@@ -266,6 +531,10 @@ void Verification(){
 
 int main(void){
   /* MEMREQの設定 */
+  /* ツリー上位階層をSPMに常駐させる */
+  initTreeGeometry();
+  bootPinTree();
+  perf_reset(); // 起動時の常駐階層の検証は計測に含めない
   memreq_make(1024 * 1024, 40000); // 64B, 400リクエスト
   // printf("[Core FW] MEMREQ configured for 64B transfers.\n");
   while(1){